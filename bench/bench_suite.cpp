@@ -0,0 +1,424 @@
+#include <span>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CPU6502.h"
+
+// Standard workloads for catching performance regressions. Every workload
+// is an endless loop at 0x400 that is run for a fixed instruction budget,
+// several times from a fresh image, and reported as MIPS and emulated MHz.
+// With --json the results are also written out for tooling to compare.
+
+using Memory = std::array<uint8_t, MEMORY_SIZE>;
+
+constexpr uint16_t ENTRY_POINT = 0x400;
+
+struct Workload {
+    const char* name;
+    const char* description;
+    std::vector<uint8_t> code;
+    void (*setup)(Memory& memory);
+};
+
+// Fills a range with a byte pattern that is not all zeroes
+static void fill_pattern(Memory& memory, uint16_t start, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++) {
+        memory[start + i] = (i * 7 + 3) & 0xFF;
+    }
+}
+
+const std::vector<Workload> WORKLOADS = {
+    {"alu", "tight loop of accumulator arithmetic, logic and shifts", {
+        0xA2, 0x00,       // 0400 LDX #$00
+        0x18,             // 0402 loop: CLC
+        0x69, 0x37,       // 0403 ADC #$37
+        0x49, 0xA5,       // 0405 EOR #$A5
+        0x0A,             // 0407 ASL A
+        0x2A,             // 0408 ROL A
+        0x29, 0xF7,       // 0409 AND #$F7
+        0x09, 0x11,       // 040B ORA #$11
+        0x38,             // 040D SEC
+        0xE9, 0x13,       // 040E SBC #$13
+        0x4A,             // 0410 LSR A
+        0x6A,             // 0411 ROR A
+        0xA8,             // 0412 TAY
+        0xC8,             // 0413 INY
+        0x98,             // 0414 TYA
+        0xCA,             // 0415 DEX
+        0xD0, 0xEA,       // 0416 BNE $0402
+        0x4C, 0x02, 0x04, // 0418 JMP $0402
+    }, [](Memory&) {}},
+    {"copy", "copies four pages with absolute,X loads and stores", {
+        0xA2, 0x00,       // 0400 start: LDX #$00
+        0xBD, 0x00, 0x10, // 0402 loop: LDA $1000,X
+        0x9D, 0x00, 0x20, // 0405 STA $2000,X
+        0xBD, 0x00, 0x11, // 0408 LDA $1100,X
+        0x9D, 0x00, 0x21, // 040B STA $2100,X
+        0xBD, 0x00, 0x12, // 040E LDA $1200,X
+        0x9D, 0x00, 0x22, // 0411 STA $2200,X
+        0xBD, 0x00, 0x13, // 0414 LDA $1300,X
+        0x9D, 0x00, 0x23, // 0417 STA $2300,X
+        0xE8,             // 041A INX
+        0xD0, 0xE5,       // 041B BNE $0402
+        0x4C, 0x00, 0x04, // 041D JMP $0400
+    }, [](Memory& memory) {
+        fill_pattern(memory, 0x1000, 0x400);
+    }},
+    {"indirect", "sums pages through (zp),Y pointers, half the reads cross a page", {
+        0xA0, 0x00,       // 0400 start: LDY #$00
+        0xB1, 0x10,       // 0402 loop: LDA ($10),Y
+        0x18,             // 0404 CLC
+        0x71, 0x12,       // 0405 ADC ($12),Y
+        0x91, 0x12,       // 0407 STA ($12),Y
+        0xC8,             // 0409 INY
+        0xD0, 0xF6,       // 040A BNE $0402
+        0xE6, 0x11,       // 040C INC $11
+        0xA5, 0x11,       // 040E LDA $11
+        0x29, 0x0F,       // 0410 AND #$0F
+        0x09, 0x10,       // 0412 ORA #$10
+        0x85, 0x11,       // 0414 STA $11
+        0x4C, 0x00, 0x04, // 0416 JMP $0400
+    }, [](Memory& memory) {
+        memory[0x10] = 0x80;
+        memory[0x11] = 0x10;
+        memory[0x12] = 0x00;
+        memory[0x13] = 0x20;
+        fill_pattern(memory, 0x1000, 0x1000);
+    }},
+    {"branch", "data dependent branches driven by an 8 bit LFSR", {
+        0xA2, 0x00,       // 0400 start: LDX #$00
+        0xA5, 0x20,       // 0402 loop: LDA $20
+        0x0A,             // 0404 ASL A
+        0x90, 0x02,       // 0405 BCC $0409
+        0x49, 0x1D,       // 0407 EOR #$1D
+        0x85, 0x20,       // 0409 nofeed: STA $20
+        0x30, 0x03,       // 040B BMI $0410
+        0xC8,             // 040D INY
+        0xD0, 0x02,       // 040E BNE $0412
+        0x88,             // 0410 negative: DEY
+        0xEA,             // 0411 NOP
+        0xC9, 0x40,       // 0412 compare: CMP #$40
+        0xB0, 0x01,       // 0414 BCS $0417
+        0xE8,             // 0416 INX
+        0x29, 0x03,       // 0417 skip: AND #$03
+        0xF0, 0x02,       // 0419 BEQ $041D
+        0x50, 0x00,       // 041B BVC $041D
+        0xCA,             // 041D next: DEX
+        0xD0, 0xE2,       // 041E BNE $0402
+        0x4C, 0x00, 0x04, // 0420 JMP $0400
+    }, [](Memory& memory) {
+        memory[0x20] = 0x01;
+    }},
+    // Checks its own results like a functional test ROM, any wrong answer
+    // jumps to an invalid opcode and fails the run
+    {"functional", "self checking pass over loads, arithmetic, RMW, stack, JSR and addressing modes", {
+        0x4C, 0x04, 0x04, // 0400 start: JMP $0404
+        0x02,             // 0403 fail: .BYTE $02
+        0xA2, 0xFF,       // 0404 begin: LDX #$FF
+        0x9A,             // 0406 TXS
+        0xD8,             // 0407 CLD
+        0xA9, 0x55,       // 0408 LDA #$55
+        0x85, 0x30,       // 040A STA $30
+        0xA6, 0x30,       // 040C LDX $30
+        0xE0, 0x55,       // 040E CPX #$55
+        0xD0, 0xF1,       // 0410 BNE $0403
+        0x18,             // 0412 CLC
+        0xA9, 0xF0,       // 0413 LDA #$F0
+        0x69, 0x20,       // 0415 ADC #$20
+        0x90, 0xEA,       // 0417 BCC $0403
+        0xC9, 0x10,       // 0419 CMP #$10
+        0xD0, 0xE6,       // 041B BNE $0403
+        0x18,             // 041D CLC
+        0xA9, 0x7F,       // 041E LDA #$7F
+        0x69, 0x01,       // 0420 ADC #$01
+        0x50, 0xDF,       // 0422 BVC $0403
+        0x10, 0xDD,       // 0424 BPL $0403
+        0x38,             // 0426 SEC
+        0xA9, 0x10,       // 0427 LDA #$10
+        0xE9, 0x20,       // 0429 SBC #$20
+        0xB0, 0xD6,       // 042B BCS $0403
+        0xC9, 0xF0,       // 042D CMP #$F0
+        0xD0, 0xD2,       // 042F BNE $0403
+        0xA9, 0x81,       // 0431 LDA #$81
+        0x0A,             // 0433 ASL A
+        0x90, 0xCD,       // 0434 BCC $0403
+        0xC9, 0x02,       // 0436 CMP #$02
+        0xD0, 0xC9,       // 0438 BNE $0403
+        0x4A,             // 043A LSR A
+        0xB0, 0xC6,       // 043B BCS $0403
+        0x4A,             // 043D LSR A
+        0x90, 0xC3,       // 043E BCC $0403
+        0xD0, 0xC1,       // 0440 BNE $0403
+        0x38,             // 0442 SEC
+        0x6A,             // 0443 ROR A
+        0x10, 0xBD,       // 0444 BPL $0403
+        0xB0, 0xBB,       // 0446 BCS $0403
+        0xA9, 0xFF,       // 0448 LDA #$FF
+        0x85, 0x31,       // 044A STA $31
+        0xE6, 0x31,       // 044C INC $31
+        0xD0, 0xB3,       // 044E BNE $0403
+        0xC6, 0x31,       // 0450 DEC $31
+        0xC6, 0x31,       // 0452 DEC $31
+        0xA5, 0x31,       // 0454 LDA $31
+        0xC9, 0xFE,       // 0456 CMP #$FE
+        0xD0, 0xA9,       // 0458 BNE $0403
+        0x06, 0x31,       // 045A ASL $31
+        0x90, 0xA5,       // 045C BCC $0403
+        0x26, 0x31,       // 045E ROL $31
+        0xA5, 0x31,       // 0460 LDA $31
+        0xC9, 0xF9,       // 0462 CMP #$F9
+        0xD0, 0x9D,       // 0464 BNE $0403
+        0xA9, 0xA5,       // 0466 LDA #$A5
+        0x48,             // 0468 PHA
+        0xA9, 0x00,       // 0469 LDA #$00
+        0x68,             // 046B PLA
+        0xC9, 0xA5,       // 046C CMP #$A5
+        0xD0, 0x63,       // 046E BNE $04D3
+        0x38,             // 0470 SEC
+        0x08,             // 0471 PHP
+        0x18,             // 0472 CLC
+        0x28,             // 0473 PLP
+        0x90, 0x5D,       // 0474 BCC $04D3
+        0xA2, 0x03,       // 0476 LDX #$03
+        0x20, 0xD1, 0x04, // 0478 JSR $04D1
+        0xE0, 0x04,       // 047B CPX #$04
+        0xD0, 0x54,       // 047D BNE $04D3
+        0xA9, 0x00,       // 047F LDA #$00
+        0x85, 0x40,       // 0481 STA $40
+        0xA9, 0x03,       // 0483 LDA #$03
+        0x85, 0x41,       // 0485 STA $41
+        0xA0, 0x05,       // 0487 LDY #$05
+        0xA9, 0x77,       // 0489 LDA #$77
+        0x91, 0x40,       // 048B STA ($40),Y
+        0xAD, 0x05, 0x03, // 048D LDA $0305
+        0xC9, 0x77,       // 0490 CMP #$77
+        0xD0, 0x3F,       // 0492 BNE $04D3
+        0xA9, 0x66,       // 0494 LDA #$66
+        0x8D, 0x00, 0x03, // 0496 STA $0300
+        0xA2, 0x02,       // 0499 LDX #$02
+        0xA1, 0x3E,       // 049B LDA ($3E,X)
+        0xC9, 0x66,       // 049D CMP #$66
+        0xD0, 0x32,       // 049F BNE $04D3
+        0xA9, 0xC0,       // 04A1 LDA #$C0
+        0x85, 0x32,       // 04A3 STA $32
+        0xA9, 0x01,       // 04A5 LDA #$01
+        0x24, 0x32,       // 04A7 BIT $32
+        0x10, 0x28,       // 04A9 BPL $04D3
+        0x50, 0x26,       // 04AB BVC $04D3
+        0xD0, 0x24,       // 04AD BNE $04D3
+        0xA9, 0xF0,       // 04AF LDA #$F0
+        0x29, 0x3C,       // 04B1 AND #$3C
+        0xC9, 0x30,       // 04B3 CMP #$30
+        0xD0, 0x1C,       // 04B5 BNE $04D3
+        0x09, 0x03,       // 04B7 ORA #$03
+        0x49, 0xFF,       // 04B9 EOR #$FF
+        0xC9, 0xCC,       // 04BB CMP #$CC
+        0xD0, 0x14,       // 04BD BNE $04D3
+        0xA0, 0x42,       // 04BF LDY #$42
+        0x98,             // 04C1 TYA
+        0xAA,             // 04C2 TAX
+        0xE0, 0x42,       // 04C3 CPX #$42
+        0xD0, 0x0C,       // 04C5 BNE $04D3
+        0x88,             // 04C7 DEY
+        0xC0, 0x41,       // 04C8 CPY #$41
+        0xD0, 0x07,       // 04CA BNE $04D3
+        0xE6, 0x33,       // 04CC INC $33
+        0x4C, 0x00, 0x04, // 04CE JMP $0400
+        0xE8,             // 04D1 sub: INX
+        0x60,             // 04D2 RTS
+        0x02,             // 04D3 fail2: .BYTE $02
+    }, [](Memory&) {}},
+};
+
+struct Sample {
+    double seconds;
+    uint64_t instructions;
+    uint64_t cycles;
+};
+
+struct Stats {
+    double median;
+    double mean;
+    double min;
+    double max;
+    double stddev;
+};
+
+static Stats statistics(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    Stats stats{};
+    size_t n = values.size();
+    stats.min = values.front();
+    stats.max = values.back();
+    stats.median = n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+    for (double value : values) {
+        stats.mean += value;
+    }
+    stats.mean /= n;
+    for (double value : values) {
+        stats.stddev += (value - stats.mean) * (value - stats.mean);
+    }
+    stats.stddev = n > 1 ? std::sqrt(stats.stddev / (n - 1)) : 0;
+    return stats;
+}
+
+static bool parse_dispatch(const char* name, Dispatch& dispatch) {
+    const std::pair<Dispatch, const char*> backends[] = {
+        {Dispatch::SWITCH, "switch"},
+        {Dispatch::TABLE, "table"},
+        {Dispatch::THREADED, "threaded"},
+        {Dispatch::DECODED, "decoded"},
+        {Dispatch::JIT, "jit"},
+    };
+    for (auto [backend, backend_name] : backends) {
+        if (strcmp(name, backend_name) == 0) {
+            dispatch = backend;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Runs a workload for exactly budget instructions from a fresh image, false
+// if it stopped before then which for these workloads means it is broken
+static bool run_workload(const Workload& workload, uint64_t budget, const Dispatch* dispatch, Sample& sample) {
+    auto memory = std::make_unique<Memory>();
+    std::copy(workload.code.begin(), workload.code.end(), memory->begin() + ENTRY_POINT);
+    workload.setup(*memory);
+    CPU6502 cpu(*memory, ENTRY_POINT);
+    auto start = std::chrono::steady_clock::now();
+    RunResult result = dispatch ? cpu.run(budget, UINT64_MAX, *dispatch) : cpu.run(budget);
+    auto end = std::chrono::steady_clock::now();
+    sample = {std::chrono::duration<double>(end - start).count(), result.instructions, result.cycles};
+    if (result.reason != StopReason::BUDGET) {
+        std::cerr << workload.name << " stopped after " << result.instructions
+                  << " instructions at PC " << std::hex << cpu.PC() << std::dec << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void print_stats(FILE* out, const char* name, const Stats& stats) {
+    fprintf(out, "\"%s\": {\"median\": %.3f, \"mean\": %.3f, \"min\": %.3f, \"max\": %.3f, \"stddev\": %.3f}",
+        name, stats.median, stats.mean, stats.min, stats.max, stats.stddev);
+}
+
+static void usage(const char* program) {
+    std::cout << "Usage : " << program << " [--instructions N] [--repeats N]"
+              << " [--dispatch switch|table|threaded|decoded|jit] [--workload NAME]... [--json PATH]" << std::endl;
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    uint64_t budget = 20000000;
+    int repeats = 5;
+    Dispatch dispatch_choice = Dispatch::SWITCH;
+    const Dispatch* dispatch = nullptr;
+    const char* dispatch_name = "default";
+    const char* json_path = nullptr;
+    std::vector<std::string> selected;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        if (strcmp(argv[i], "--instructions") == 0) {
+            budget = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--repeats") == 0) {
+            repeats = std::max(1, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--dispatch") == 0) {
+            dispatch_name = argv[++i];
+            if (!parse_dispatch(dispatch_name, dispatch_choice)) {
+                usage(argv[0]);
+            }
+            dispatch = &dispatch_choice;
+        }
+        else if (strcmp(argv[i], "--workload") == 0) {
+            selected.push_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--json") == 0) {
+            json_path = argv[++i];
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    FILE* json = nullptr;
+    if (json_path != nullptr) {
+        json = fopen(json_path, "w");
+        if (json == nullptr) {
+            std::cout << "Could not open JSON file: " << json_path << std::endl;
+            exit(1);
+        }
+        fprintf(json, "{\"dispatch\": \"%s\", \"instructions\": %llu, \"repeats\": %d, \"workloads\": [",
+            dispatch_name, (unsigned long long) budget, repeats);
+    }
+
+    bool failed = false;
+    bool first = true;
+    printf("%-12s %10s %10s %10s %10s %6s\n", "workload", "MIPS", "stddev", "MHz", "stddev", "CPI");
+    for (const Workload& workload : WORKLOADS) {
+        if (!selected.empty() && std::find(selected.begin(), selected.end(), workload.name) == selected.end()) {
+            continue;
+        }
+        // one untimed run to fault in memory and warm the caches
+        Sample sample;
+        if (!run_workload(workload, std::min<uint64_t>(budget, 100000), dispatch, sample)) {
+            failed = true;
+            continue;
+        }
+        std::vector<Sample> samples;
+        std::vector<double> mips;
+        std::vector<double> mhz;
+        for (int i = 0; i < repeats; i++) {
+            if (!run_workload(workload, budget, dispatch, sample)) {
+                failed = true;
+                break;
+            }
+            samples.push_back(sample);
+            mips.push_back(sample.instructions / sample.seconds / 1e6);
+            mhz.push_back(sample.cycles / sample.seconds / 1e6);
+        }
+        if (samples.size() != (size_t) repeats) {
+            continue;
+        }
+        Stats mips_stats = statistics(mips);
+        Stats mhz_stats = statistics(mhz);
+        double cpi = (double) samples[0].cycles / samples[0].instructions;
+        printf("%-12s %10.1f %10.1f %10.1f %10.1f %6.2f\n", workload.name,
+            mips_stats.median, mips_stats.stddev, mhz_stats.median, mhz_stats.stddev, cpi);
+        if (json != nullptr) {
+            fprintf(json, "%s\n  {\"name\": \"%s\", \"description\": \"%s\", \"cycles_per_instruction\": %.4f, ",
+                first ? "" : ",", workload.name, workload.description, cpi);
+            print_stats(json, "mips", mips_stats);
+            fprintf(json, ", ");
+            print_stats(json, "mhz", mhz_stats);
+            fprintf(json, ", \"samples\": [");
+            for (size_t i = 0; i < samples.size(); i++) {
+                fprintf(json, "%s{\"seconds\": %.6f, \"instructions\": %llu, \"cycles\": %llu}", i ? ", " : "",
+                    samples[i].seconds, (unsigned long long) samples[i].instructions,
+                    (unsigned long long) samples[i].cycles);
+            }
+            fprintf(json, "]}");
+        }
+        first = false;
+    }
+    if (json != nullptr) {
+        fprintf(json, "\n], \"failed\": %s}\n", failed ? "true" : "false");
+        fclose(json);
+    }
+    return failed ? 1 : 0;
+}
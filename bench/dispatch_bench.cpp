@@ -0,0 +1,109 @@
+#include <array>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CPU6502.h"
+
+// Compares the interpreter backends on the same ROM image. ROMs use the
+// same layout as the emulator, loaded at 0x000A with the entry point at 0x400.
+
+using Memory = std::array<uint8_t, MEMORY_SIZE>;
+
+constexpr uint16_t ENTRY_POINT = 0x400;
+constexpr int REPEATS = 5;
+
+// Never ending mix of ALU work, indexed loads and stores and branches
+const std::vector<uint8_t> BUILTIN_WORKLOAD = {
+    0xA0, 0x00,       // 0400 LDY #$00
+    0xA2, 0x00,       // 0402 LDX #$00
+    0xE8,             // 0404 INX
+    0x18,             // 0405 CLC
+    0x69, 0x03,       // 0406 ADC #$03
+    0x9D, 0x00, 0x02, // 0408 STA $0200,X
+    0x5D, 0x00, 0x03, // 040B EOR $0300,X
+    0xB1, 0x10,       // 040E LDA ($10),Y
+    0xE0, 0x00,       // 0410 CPX #$00
+    0xD0, 0xF0,       // 0412 BNE $0404
+    0x88,             // 0414 DEY
+    0xD0, 0xEB,       // 0415 BNE $0402
+    0x4C, 0x00, 0x04, // 0417 JMP $0400
+};
+
+struct Sample {
+    double seconds;
+    uint64_t instructions;
+};
+
+// Runs the image for exactly budget instructions, restarting it from a
+// fresh copy whenever it stops on its own
+Sample run_backend(const Memory& image, uint64_t budget, Dispatch dispatch, uint16_t& final_PC) {
+    auto memory = std::make_shared<Memory>(image);
+    auto cpu = std::make_unique<CPU6502>(memory, ENTRY_POINT);
+    uint64_t remaining = budget;
+    auto start = std::chrono::steady_clock::now();
+    while (remaining > 0) {
+        RunResult result = cpu->run(remaining, UINT64_MAX, dispatch);
+        remaining -= result.instructions;
+        if (result.reason != StopReason::BUDGET) {
+            *memory = image;
+            cpu = std::make_unique<CPU6502>(memory, ENTRY_POINT);
+            if (result.instructions == 0) {
+                std::cout << "ROM does not execute any valid instructions" << std::endl;
+                exit(1);
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    final_PC = cpu->PC();
+    return {std::chrono::duration<double>(end - start).count(), budget};
+}
+
+int main(int argc, char** argv) {
+    if (argc > 3) {
+        std::cout << "Usage : " << argv[0] << " [path to rom] [instructions]" << std::endl;
+        exit(1);
+    }
+    Memory image{};
+    if (argc >= 2) {
+        std::ifstream file(argv[1], std::ios::in | std::ios::binary);
+        if (!file) {
+            std::cout << "Could not open ROM file: " << argv[1] << std::endl;
+            exit(1);
+        }
+        file.read(reinterpret_cast<char*>(image.data()+0xa), MEMORY_SIZE-0xa);
+    }
+    else {
+        std::copy(BUILTIN_WORKLOAD.begin(), BUILTIN_WORKLOAD.end(), image.begin() + ENTRY_POINT);
+        image[0x10] = 0x00;
+        image[0x11] = 0x03;
+    }
+    uint64_t budget = (argc == 3) ? strtoull(argv[2], nullptr, 0) : 100000000;
+
+    const std::pair<Dispatch, const char*> backends[] = {
+        {Dispatch::SWITCH, "switch"},
+        {Dispatch::TABLE, "table"},
+        {Dispatch::THREADED, "threaded"},
+        {Dispatch::DECODED, "decoded"},
+        {Dispatch::JIT, "jit"},
+    };
+    printf("%-10s %10s %10s %8s\n", "backend", "best MIPS", "median", "PC");
+    for (auto [dispatch, name] : backends) {
+        std::vector<double> mips;
+        uint16_t final_PC = 0;
+        for (int i = 0; i < REPEATS; i++) {
+            Sample sample = run_backend(image, budget, dispatch, final_PC);
+            mips.push_back(sample.instructions / sample.seconds / 1e6);
+        }
+        std::sort(mips.begin(), mips.end());
+        printf("%-10s %10.1f %10.1f %8.4x\n", name, mips.back(), mips[REPEATS/2], final_PC);
+    }
+    return 0;
+}
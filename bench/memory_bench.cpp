@@ -0,0 +1,137 @@
+#include <span>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CPU6502.h"
+
+// Measures what a memory access costs through each way of holding the
+// 64 KiB: the shared_ptr the CPU used to dereference on every access, a raw
+// base pointer, and the bus page table, then the CPU itself constructed
+// with shared, borrowed and owned memory.
+
+using Memory = std::array<uint8_t, MEMORY_SIZE>;
+
+constexpr int REPEATS = 5;
+constexpr uint64_t ACCESSES = 50000000;
+
+// Stands in for the old CPU, which reached memory through its member
+struct SharedHolder {
+    std::shared_ptr<Memory> memory;
+};
+
+struct RawHolder {
+    uint8_t* memory;
+};
+
+// Every iteration loads one byte and stores another at pseudo random
+// addresses, the store stops the compiler hoisting the base pointer load
+template <typename Read, typename Write>
+double time_accesses(Read read, Write write) {
+    uint16_t addr = 1;
+    uint8_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < ACCESSES; i++) {
+        addr = addr * 75 + 74;
+        sum += read(addr);
+        write(addr ^ 0x5555, sum);
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (sum == 0x42) {
+        puts("");
+    }
+    return std::chrono::duration<double>(end - start).count();
+}
+
+[[gnu::noinline]] uint8_t read_shared_copy(std::shared_ptr<Memory> memory, uint16_t addr) {
+    return (*memory)[addr];
+}
+
+void report(const char* name, std::vector<double> seconds, uint64_t operations) {
+    std::sort(seconds.begin(), seconds.end());
+    printf("%-24s %8.2f ns/op %8.2f median\n", name, seconds.front() / operations * 1e9, seconds[REPEATS/2] / operations * 1e9);
+}
+
+template <typename F>
+std::vector<double> repeat(F f) {
+    std::vector<double> seconds;
+    for (int i = 0; i < REPEATS; i++) {
+        seconds.push_back(f());
+    }
+    return seconds;
+}
+
+// A loop that copies and sums a page forever
+const std::vector<uint8_t> WORKLOAD = {
+    0xA2, 0x00,       // 0400 LDX #$00
+    0xBD, 0x00, 0x02, // 0402 LDA $0200,X
+    0x7D, 0x00, 0x03, // 0405 ADC $0300,X
+    0x9D, 0x00, 0x03, // 0408 STA $0300,X
+    0xE8,             // 040B INX
+    0xD0, 0xF4,       // 040C BNE $0402
+    0x4C, 0x00, 0x04, // 040E JMP $0400
+};
+
+double time_cpu(CPU6502& cpu) {
+    auto memory = cpu.memory();
+    std::copy(WORKLOAD.begin(), WORKLOAD.end(), memory.begin() + 0x400);
+    auto start = std::chrono::steady_clock::now();
+    cpu.run(ACCESSES);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main() {
+    auto shared = std::make_shared<Memory>();
+    SharedHolder shared_holder{shared};
+    RawHolder raw_holder{shared->data()};
+    SharedHolder* shared_ptr = &shared_holder;
+    RawHolder* raw_ptr = &raw_holder;
+    CPU6502 bus_cpu(0x400);
+    Bus& bus = bus_cpu.bus();
+
+    printf("memory accesses (one read and one write per op)\n");
+    report("shared_ptr", repeat([&] {
+        return time_accesses(
+            [&](uint16_t addr) { return (*shared_ptr->memory)[addr]; },
+            [&](uint16_t addr, uint8_t value) { (*shared_ptr->memory)[addr] = value; });
+    }), ACCESSES);
+    report("shared_ptr copied", repeat([&] {
+        return time_accesses(
+            [&](uint16_t addr) { return read_shared_copy(shared_ptr->memory, addr); },
+            [&](uint16_t addr, uint8_t value) { (*shared_ptr->memory)[addr] = value; });
+    }), ACCESSES);
+    report("raw pointer", repeat([&] {
+        return time_accesses(
+            [&](uint16_t addr) { return raw_ptr->memory[addr]; },
+            [&](uint16_t addr, uint8_t value) { raw_ptr->memory[addr] = value; });
+    }), ACCESSES);
+    report("bus", repeat([&] {
+        return time_accesses(
+            [&](uint16_t addr) { return bus.read(addr); },
+            [&](uint16_t addr, uint8_t value) { bus.write(addr, value); });
+    }), ACCESSES);
+
+    printf("CPU6502::run by memory ownership\n");
+    report("shared", repeat([&] {
+        CPU6502 cpu(std::make_shared<Memory>(), 0x400);
+        return time_cpu(cpu);
+    }), ACCESSES);
+    Memory borrowed{};
+    report("borrowed", repeat([&] {
+        CPU6502 cpu(std::span<uint8_t, MEMORY_SIZE>(borrowed), 0x400);
+        return time_cpu(cpu);
+    }), ACCESSES);
+    report("owned", repeat([&] {
+        CPU6502 cpu(0x400);
+        return time_cpu(cpu);
+    }), ACCESSES);
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "Bus.h"
+#include <bit>
+#include <cstdint>
+
+Bus::Bus() {
+    _read_pages.fill(nullptr);
+    _write_pages.fill(nullptr);
+    _io_pages.fill(-1);
+    _dirty.fill(UINT64_MAX);
+}
+
+void Bus::clear_dirty() {
+    for (int word = 0; word < PAGE_COUNT / 64; word++) {
+        for (uint64_t bits = _dirty[word]; bits != 0; bits &= bits - 1) {
+            _store_generations[word * 64 + std::countr_zero(bits)]++;
+        }
+        _dirty[word] = 0;
+    }
+}
+
+std::vector<uint8_t> Bus::delta(const std::array<uint32_t, PAGE_COUNT>& since) {
+    const auto& generations = store_generations();
+    std::vector<uint8_t> delta;
+    for (int page = 0; page < PAGE_COUNT; page++) {
+        if (generations[page] != since[page]) {
+            delta.push_back(page);
+            for (int offset = 0; offset < PAGE_SIZE; offset++) {
+                delta.push_back(peek(page * PAGE_SIZE + offset));
+            }
+        }
+    }
+    return delta;
+}
+
+void Bus::map_ram(uint8_t first_page, uint16_t page_count, uint8_t* memory) {
+    for (uint16_t i = 0; i < page_count && first_page + i < PAGE_COUNT; i++) {
+        remap(first_page + i, memory + i * PAGE_SIZE, memory + i * PAGE_SIZE, -1);
+    }
+}
+
+void Bus::map_rom(uint8_t first_page, uint16_t page_count, const uint8_t* memory) {
+    for (uint16_t i = 0; i < page_count && first_page + i < PAGE_COUNT; i++) {
+        remap(first_page + i, memory + i * PAGE_SIZE, _rom_sink.data(), -1);
+    }
+}
+
+void Bus::map_io(uint8_t first_page, uint16_t page_count, IOHandler handler) {
+    _io_handlers.push_back(std::move(handler));
+    int16_t index = _io_handlers.size() - 1;
+    for (uint16_t i = 0; i < page_count && first_page + i < PAGE_COUNT; i++) {
+        remap(first_page + i, nullptr, nullptr, index);
+    }
+}
+
+void Bus::unmap(uint8_t first_page, uint16_t page_count) {
+    for (uint16_t i = 0; i < page_count && first_page + i < PAGE_COUNT; i++) {
+        remap(first_page + i, nullptr, nullptr, -1);
+    }
+}
+
+void Bus::remap(uint8_t page, const uint8_t* read_page, uint8_t* write_page, int16_t io) {
+    if (_write_trap >= 0 && page == _write_trap >> 8) {
+        // the trap stays on RAM and is dropped with anything else
+        if (write_page != nullptr && write_page != _rom_sink.data()) {
+            _write_trap_page = write_page;
+            write_page = nullptr;
+        }
+        else {
+            clear_write_trap();
+        }
+    }
+    _read_pages[page] = read_page;
+    _write_pages[page] = write_page;
+    _io_pages[page] = io;
+    _watched[page] = nullptr;
+    _code_generations[page]++;
+}
+
+void Bus::watch(uint8_t page) {
+    if (_write_pages[page] == nullptr || _write_pages[page] == _rom_sink.data()) {
+        return;
+    }
+    _watched[page] = _write_pages[page];
+    _write_pages[page] = nullptr;
+}
+
+uint8_t* Bus::ram_page(uint8_t page) {
+    if (_watched[page] != nullptr) {
+        return _watched[page];
+    }
+    if (_write_trap >= 0 && page == _write_trap >> 8) {
+        return _write_trap_page;
+    }
+    return _write_pages[page] != _rom_sink.data() ? _write_pages[page] : nullptr;
+}
+
+bool Bus::trap_write(uint16_t addr, std::function<void(uint8_t)> on_write) {
+    clear_write_trap();
+    uint8_t page = addr >> 8;
+    uint8_t* write_page = ram_page(page);
+    if (write_page == nullptr) {
+        return false;
+    }
+    _watched[page] = nullptr;
+    _write_pages[page] = nullptr;
+    _write_trap = addr;
+    _write_trap_page = write_page;
+    _on_write_trap = std::move(on_write);
+    return true;
+}
+
+void Bus::clear_write_trap() {
+    if (_write_trap < 0) {
+        return;
+    }
+    _write_pages[_write_trap >> 8] = _write_trap_page;
+    _write_trap = -1;
+    _write_trap_page = nullptr;
+    _on_write_trap = nullptr;
+}
+
+uint8_t Bus::read_io(uint16_t addr) {
+    int16_t index = _io_pages[addr >> 8];
+    if (index < 0 || !_io_handlers[index].read) {
+        return 0;
+    }
+    return _io_handlers[index].read(addr);
+}
+
+void Bus::write_io(uint16_t addr, uint8_t value) {
+    uint8_t page = addr >> 8;
+    if (_watched[page] != nullptr) {
+        _write_pages[page] = _watched[page];
+        _watched[page] = nullptr;
+        _code_generations[page]++;
+        write(addr, value);
+        return;
+    }
+    if (_write_trap >= 0 && page == _write_trap >> 8) {
+        _write_trap_page[addr & 0xFF] = value;
+        mark_dirty(page);
+        _code_generations[page]++;
+        if (addr == _write_trap) {
+            _on_write_trap(value);
+        }
+        return;
+    }
+    int16_t index = _io_pages[page];
+    if (index < 0 || !_io_handlers[index].write) {
+        return;
+    }
+    _io_handlers[index].write(addr, value);
+}
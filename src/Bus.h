@@ -0,0 +1,129 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+constexpr int32_t PAGE_SIZE = 0x100;
+constexpr int32_t PAGE_COUNT = 0x100;
+
+// Callbacks for a memory mapped device, both receive the full address
+struct IOHandler {
+    std::function<uint8_t(uint16_t)> read;
+    std::function<void(uint16_t, uint8_t)> write;
+};
+
+// The 6502 address space as 256 pages. A page is either plain RAM, read
+// only ROM or handled by an I/O device. RAM and ROM pages are a pointer
+// in the page table, so accessing them is one indexed load with no calls.
+// Unmapped pages read as 0 and ignore writes.
+//
+// Every write to a RAM or ROM page also sets that page's bit in a dirty
+// bitmap, a single OR per store. Reading the store generations folds the
+// bits into a counter per page, so snapshots, delta dumps and anything else
+// can each keep the generations they last saw and find the pages written
+// since without scanning memory or clearing bits another user relies on.
+//
+// Each page also has a code generation counter for anything caching what a page
+// holds, such as translated code. It moves on whenever the page is
+// remapped, touched, or written while watched. A watched page has its
+// write pointer cleared so the first write to it takes the slow path, which
+// bumps the code generation and stops watching.
+class Bus {
+    public:
+        Bus();
+        Bus(const Bus&) = delete;
+        Bus& operator=(const Bus&) = delete;
+        // Maps page_count pages starting at first_page onto consecutive
+        // pages of memory, which must outlive the mapping
+        void map_ram(uint8_t first_page, uint16_t page_count, uint8_t* memory);
+        void map_rom(uint8_t first_page, uint16_t page_count, const uint8_t* memory);
+        void map_io(uint8_t first_page, uint16_t page_count, IOHandler handler);
+        void unmap(uint8_t first_page, uint16_t page_count);
+        uint8_t read(uint16_t addr) {
+            const uint8_t* page = _read_pages[addr >> 8];
+            if (page != nullptr) [[likely]] {
+                return page[addr & 0xFF];
+            }
+            return read_io(addr);
+        };
+        void write(uint16_t addr, uint8_t value) {
+            uint8_t* page = _write_pages[addr >> 8];
+            if (page != nullptr) [[likely]] {
+                page[addr & 0xFF] = value;
+                _dirty[addr >> 14] |= 1ull << ((addr >> 8) & 63);
+                return;
+            }
+            write_io(addr, value);
+        };
+        // Reads without side effects, I/O pages read as 0
+        uint8_t peek(uint16_t addr) {
+            const uint8_t* page = _read_pages[addr >> 8];
+            return page != nullptr ? page[addr & 0xFF] : 0;
+        };
+        // Dirty pages, written since the store generations were last read.
+        // Writes made directly to the memory behind a page are not seen and
+        // have to be recorded with touch().
+        bool dirty(uint8_t page) { return (_dirty[page >> 6] >> (page & 63)) & 1; };
+        void mark_dirty(uint8_t page) { _dirty[page >> 6] |= 1ull << (page & 63); };
+        void mark_all_dirty() { _dirty.fill(UINT64_MAX); };
+        const std::array<uint64_t, PAGE_COUNT / 64>& dirty_pages() { return _dirty; };
+        // Folds the dirty bits into the store generations, nothing is lost
+        void clear_dirty();
+        // Moves on between two reads if the page was written in between
+        uint32_t store_generation(uint8_t page) {
+            if (dirty(page)) {
+                _dirty[page >> 6] &= ~(1ull << (page & 63));
+                _store_generations[page]++;
+            }
+            return _store_generations[page];
+        };
+        const std::array<uint32_t, PAGE_COUNT>& store_generations() {
+            clear_dirty();
+            return _store_generations;
+        };
+        // Each page whose store generation has moved on from since, as its
+        // page number followed by its 256 bytes read with peek()
+        std::vector<uint8_t> delta(const std::array<uint32_t, PAGE_COUNT>& since);
+        // RAM and ROM pages, which can be read ahead without side effects
+        bool memory_backed(uint8_t page) { return _read_pages[page] != nullptr; };
+        // Memory behind a RAM page, watched or trapped or not, nullptr for
+        // ROM, I/O and unmapped pages
+        uint8_t* ram_page(uint8_t page);
+        uint32_t code_generation(uint8_t page) { return _code_generations[page]; };
+        // Watches a RAM page for its next write, ROM and I/O pages are not
+        // watched as their contents only change by remapping them
+        void watch(uint8_t page);
+        // Records a write made directly to the memory behind a page
+        void touch(uint8_t page) {
+            _code_generations[page]++;
+            mark_dirty(page);
+        };
+        // Calls on_write with the value after every write to addr, which must
+        // be RAM. Writes to its page take the slow path while it is set and
+        // move its code generation on as if it were watched. Only one address is
+        // trapped at a time, false if addr is not RAM.
+        bool trap_write(uint16_t addr, std::function<void(uint8_t)> on_write);
+        void clear_write_trap();
+    private:
+        friend class JIT;
+        std::array<const uint8_t*, PAGE_COUNT> _read_pages;
+        std::array<uint8_t*, PAGE_COUNT> _write_pages;
+        // Index into _io_handlers for I/O pages, -1 for everything else
+        std::array<int16_t, PAGE_COUNT> _io_pages;
+        std::vector<IOHandler> _io_handlers;
+        // ROM pages point their writes here so they need no special casing
+        std::array<uint8_t, PAGE_SIZE> _rom_sink;
+        std::array<uint64_t, PAGE_COUNT / 64> _dirty;
+        std::array<uint32_t, PAGE_COUNT> _store_generations{};
+        std::array<uint32_t, PAGE_COUNT> _code_generations{};
+        // Write pointers of watched pages, nullptr for everything else
+        std::array<uint8_t*, PAGE_COUNT> _watched{};
+        // Trapped address, -1 for none, and the write pointer of its page
+        int32_t _write_trap = -1;
+        uint8_t* _write_trap_page = nullptr;
+        std::function<void(uint8_t)> _on_write_trap;
+        void remap(uint8_t page, const uint8_t* read_page, uint8_t* write_page, int16_t io);
+        [[gnu::cold]] uint8_t read_io(uint16_t addr);
+        [[gnu::cold]] void write_io(uint16_t addr, uint8_t value);
+};
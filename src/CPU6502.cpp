@@ -1,680 +1,1140 @@
 #include "CPU6502.h"
+#include "OpcodeMap.h"
+#include "Trace.h"
 #include <cstdint>
+#include <algorithm>
+#include <type_traits>
 #include <cstdio>
 #include <iostream>
 
-constexpr uint8_t N_FLAG = 0x80; // Negative Flag
-constexpr uint8_t V_FLAG = 0x40; // Overflow Flag
-constexpr uint8_t U_FLAG = 0x20; // Unused 
-constexpr uint8_t B_FLAG = 0x10; // Break Flag
-constexpr uint8_t D_FLAG = 0x08; // Decimal Flag (use BCD for arithmetic)
-constexpr uint8_t I_FLAG = 0x04; // Interrupt Flag (IRQ disable)
-constexpr uint8_t Z_FLAG = 0x02; // Zero Flag
-constexpr uint8_t C_FLAG = 0x01; // Carry
-
 constexpr uint16_t STACK_OFFSET = 0x100;
 constexpr uint16_t NMI_VECTOR_OFFSET = 0xFFFA;
 constexpr uint16_t RES_VECTOR_OFFSET = 0xFFFC;
 constexpr uint16_t IRQ_VECTOR_OFFSET = 0xFFFE;
 
+// Default interpreter backend, picked at build time
+#if defined(CPU6502_DISPATCH_SWITCH)
+constexpr Dispatch DEFAULT_DISPATCH = Dispatch::SWITCH;
+#elif defined(CPU6502_DISPATCH_TABLE) || !defined(__GNUC__)
+constexpr Dispatch DEFAULT_DISPATCH = Dispatch::TABLE;
+#else
+constexpr Dispatch DEFAULT_DISPATCH = Dispatch::THREADED;
+#endif
+
+// Tracing and profiling hooks, each is compiled out unless CPU6502_TRACE
+// or CPU6502_PROFILE is defined
+#if defined(CPU6502_TRACE)
+#define TRACE_INSTRUCTION(instruction_PC) \
+    if (_trace != nullptr) { \
+        trace_instruction(instruction_PC); \
+    }
+#define TRACE_ADDRESS(addr) \
+    if (_trace_record != nullptr) { \
+        _trace_record->address = addr; \
+        _trace_record->has_address = 1; \
+    }
+#else
+#define TRACE_INSTRUCTION(instruction_PC)
+#define TRACE_ADDRESS(addr)
+#endif
+
+#if defined(CPU6502_PROFILE)
+#define PROFILE_INSTRUCTION(instruction_PC) \
+    if (_profiler != nullptr) { \
+        _profiler->instruction(instruction_PC, _bus.peek(instruction_PC), _cycles); \
+    }
+#define PROFILE_CALL(routine) \
+    if (_profiler != nullptr) { \
+        _profiler->call(routine, _cycles); \
+    }
+#define PROFILE_RETURN() \
+    if (_profiler != nullptr) { \
+        _profiler->ret(_cycles); \
+    }
+#else
+#define PROFILE_INSTRUCTION(instruction_PC)
+#define PROFILE_CALL(routine)
+#define PROFILE_RETURN()
+#endif
+
+#define BEFORE_INSTRUCTION(instruction_PC) \
+    TRACE_INSTRUCTION(instruction_PC) \
+    PROFILE_INSTRUCTION(instruction_PC)
+
+// Calls f with the variant as a compile time constant, so a variant is
+// picked once per call into the CPU rather than per instruction
+template <typename F>
+static auto with_variant(Variant variant, F&& f) {
+    switch (variant) {
+        case Variant::NMOS_ILLEGAL:
+            return f(std::integral_constant<Variant, Variant::NMOS_ILLEGAL>{});
+        case Variant::CMOS_65C02:
+            return f(std::integral_constant<Variant, Variant::CMOS_65C02>{});
+        case Variant::NMOS:
+            break;
+    }
+    return f(std::integral_constant<Variant, Variant::NMOS>{});
+}
+
+// Base cycles per opcode, page crossing and branch penalties are added by the
+// handlers. Opcodes no NMOS variant implements are 0.
+constexpr std::array<uint8_t, 256> NMOS_CYCLES = {
+//  0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+    7, 6, 0, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6, // 0
+    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 1
+    6, 6, 0, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6, // 2
+    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 3
+    6, 6, 0, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6, // 4
+    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 5
+    6, 6, 0, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6, // 6
+    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 7
+    2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 0, 4, 4, 4, 4, // 8
+    2, 6, 0, 0, 4, 4, 4, 4, 2, 5, 2, 0, 0, 5, 0, 0, // 9
+    2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 0, 4, 4, 4, 4, // A
+    2, 5, 0, 5, 4, 4, 4, 4, 2, 4, 2, 0, 4, 4, 4, 4, // B
+    2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6, // C
+    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // D
+    2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6, // E
+    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // F
+};
+
+// The same for the 65C02, where decimal ADC and SBC also take a cycle more
+// and the unused opcodes are NOPs
+constexpr std::array<uint8_t, 256> CMOS_CYCLES = {
+//  0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+    7, 6, 2, 1, 5, 3, 5, 0, 3, 2, 2, 1, 6, 4, 6, 0, // 0
+    2, 5, 5, 1, 5, 4, 6, 0, 2, 4, 2, 1, 6, 4, 6, 0, // 1
+    6, 6, 2, 1, 3, 3, 5, 0, 4, 2, 2, 1, 4, 4, 6, 0, // 2
+    2, 5, 5, 1, 4, 4, 6, 0, 2, 4, 2, 1, 4, 4, 6, 0, // 3
+    6, 6, 2, 1, 3, 3, 5, 0, 3, 2, 2, 1, 3, 4, 6, 0, // 4
+    2, 5, 5, 1, 4, 4, 6, 0, 2, 4, 3, 1, 8, 4, 6, 0, // 5
+    6, 6, 2, 1, 3, 3, 5, 0, 4, 2, 2, 1, 6, 4, 6, 0, // 6
+    2, 5, 5, 1, 4, 4, 6, 0, 2, 4, 4, 1, 6, 4, 6, 0, // 7
+    2, 6, 2, 1, 3, 3, 3, 0, 2, 2, 2, 1, 4, 4, 4, 0, // 8
+    2, 6, 5, 1, 4, 4, 4, 0, 2, 5, 2, 1, 4, 5, 5, 0, // 9
+    2, 6, 2, 1, 3, 3, 3, 0, 2, 2, 2, 1, 4, 4, 4, 0, // A
+    2, 5, 5, 1, 4, 4, 4, 0, 2, 4, 2, 1, 4, 4, 4, 0, // B
+    2, 6, 2, 1, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0, // C
+    2, 5, 5, 1, 4, 4, 6, 0, 2, 4, 3, 0, 4, 4, 7, 0, // D
+    2, 6, 2, 1, 3, 3, 5, 0, 2, 2, 2, 1, 4, 4, 6, 0, // E
+    2, 5, 5, 1, 4, 4, 6, 0, 2, 4, 4, 1, 4, 4, 7, 0, // F
+};
+
+template <Variant V>
+constexpr std::array<uint8_t, 256> CPU6502::CYCLES = V == Variant::CMOS_65C02 ? CMOS_CYCLES : NMOS_CYCLES;
+
+const std::array<uint8_t, 256>* CPU6502::cycle_table(Variant variant) {
+    return with_variant(variant, [](auto variant) { return &CYCLES<variant()>; });
+}
+
+
+// Expands X(n) for every opcode n from 0x00 to 0xFF in order
+#define OPCODES_16(X, h) \
+    X(h##0) X(h##1) X(h##2) X(h##3) X(h##4) X(h##5) X(h##6) X(h##7) \
+    X(h##8) X(h##9) X(h##A) X(h##B) X(h##C) X(h##D) X(h##E) X(h##F)
+#define OPCODES_256(X) \
+    OPCODES_16(X, 0x0) OPCODES_16(X, 0x1) OPCODES_16(X, 0x2) OPCODES_16(X, 0x3) \
+    OPCODES_16(X, 0x4) OPCODES_16(X, 0x5) OPCODES_16(X, 0x6) OPCODES_16(X, 0x7) \
+    OPCODES_16(X, 0x8) OPCODES_16(X, 0x9) OPCODES_16(X, 0xA) OPCODES_16(X, 0xB) \
+    OPCODES_16(X, 0xC) OPCODES_16(X, 0xD) OPCODES_16(X, 0xE) OPCODES_16(X, 0xF)
+
+// Handlers
+//
+// Every opcode is an operation applied to the operand its addressing mode
+// produces. Both are compile time constants so each handler gets its own
+// copy of the addressing code inlined into it.
+
+template <auto Mode, auto Op>
+void CPU6502::addressed() {
+    // Operations that take a value read it from the address the mode
+    // produces (unless the mode is immediate), read-modify-write operations
+    // take the value and return the result to be written back, and stores
+    // and jumps take the address itself
+    constexpr bool reads_memory = std::is_same_v<decltype(Op), void (CPU6502::*)(uint8_t)>
+        && std::is_same_v<decltype(Mode), uint16_t (CPU6502::*)()>;
+    if constexpr (reads_memory) {
+        uint16_t addr = (this->*Mode)();
+        TRACE_ADDRESS(addr);
+        // Indexed reads take an extra cycle when the index carries into the
+        // high byte of the address, before the read itself. Stores and
+        // read-modify-writes always pay for it and have it in their base
+        // cycles.
+        if constexpr (Mode == &CPU6502::absolute_X || Mode == &CPU6502::absolute_Y || Mode == &CPU6502::zeropage_ptr_Y
+                || Mode == &CPU6502::decoded_absolute_X || Mode == &CPU6502::decoded_absolute_Y
+                || Mode == &CPU6502::decoded_zeropage_ptr_Y) {
+            _cycles += _page_crossed;
+        }
+        (this->*Op)(read(addr));
+    }
+    else if constexpr (std::is_same_v<decltype(Op), uint8_t (CPU6502::*)(uint8_t)>) {
+        uint16_t addr = (this->*Mode)();
+        TRACE_ADDRESS(addr);
+        if constexpr (Mode == &CPU6502::absolute_X_shift || Mode == &CPU6502::decoded_absolute_X_shift) {
+            _cycles += _page_crossed;
+        }
+        write(addr, (this->*Op)(read(addr)));
+    }
+    else if constexpr (std::is_same_v<decltype(Mode), uint16_t (CPU6502::*)()>) {
+        uint16_t addr = (this->*Mode)();
+        TRACE_ADDRESS(addr);
+        (this->*Op)(addr);
+    }
+    else {
+        (this->*Op)((this->*Mode)());
+    }
+}
+
+template <auto Op>
+void CPU6502::implied() {
+    (this->*Op)();
+}
+
+template <auto Op>
+void CPU6502::accumulator() {
+    _A = (this->*Op)(_A);
+}
+
+#define HANDLER_ADDRESSED(n, mode, op) table[n] = &C::addressed<&C::mode, &C::op>;
+#define HANDLER_IMPLIED(n, op) table[n] = &C::implied<&C::op>;
+#define HANDLER_ACCUMULATOR(n, op) table[n] = &C::accumulator<&C::op>;
+#define DECODED_ADDRESSED(n, mode, op) table[n] = &C::addressed<&C::decoded_##mode, &C::op>;
+#define WRITES_ADDRESSED(n, mode, op) table[n] = writes(&C::op);
+#define WRITES_IMPLIED(n, op) table[n] = writes(&C::op);
+#define WRITES_ACCUMULATOR(n, op) table[n] = false;
+
+// nullptr marks an invalid opcode
+template <Variant V>
+constexpr std::array<CPU6502::Handler, 256> CPU6502::HANDLERS = [] {
+    using C = CPU6502;
+    std::array<Handler, 256> table{};
+    VARIANT_MAP(V, HANDLER_ADDRESSED, HANDLER_IMPLIED, HANDLER_ACCUMULATOR)
+    return table;
+}();
+
+// The same handlers with addressing modes that take their operand from a
+// pre-decoded record rather than fetching it
+template <Variant V>
+constexpr std::array<CPU6502::Handler, 256> CPU6502::DECODED_HANDLERS = [] {
+    using C = CPU6502;
+    std::array<Handler, 256> table{};
+    VARIANT_MAP(V, DECODED_ADDRESSED, HANDLER_IMPLIED, HANDLER_ACCUMULATOR)
+    return table;
+}();
+
+// Opcodes that can write memory, and so invalidate pre-decoded blocks
+template <Variant V>
+constexpr std::array<bool, 256> CPU6502::WRITES_MEMORY = [] {
+    using C = CPU6502;
+    std::array<bool, 256> table{};
+    auto writes = [](auto op) {
+        if constexpr (std::is_same_v<decltype(op), uint8_t (C::*)(uint8_t)>) {
+            return true;
+        }
+        else if constexpr (std::is_same_v<decltype(op), void (C::*)(uint16_t)>) {
+            return op == &C::STA || op == &C::STX || op == &C::STY || op == &C::JSR || op == &C::SAX
+                || op == &C::STZ;
+        }
+        else if constexpr (std::is_same_v<decltype(op), void (C::*)()>) {
+            return op == &C::BRK || op == &C::PHA || op == &C::PHP || op == &C::PHX || op == &C::PHY;
+        }
+        return false;
+    };
+    VARIANT_MAP(V, WRITES_ADDRESSED, WRITES_IMPLIED, WRITES_ACCUMULATOR)
+    return table;
+}();
+
+// Bytes taken by each addressing mode's operand
+constexpr uint8_t OPERAND_LENGTH_imediate = 1;
+constexpr uint8_t OPERAND_LENGTH_imediate_16 = 2;
+constexpr uint8_t OPERAND_LENGTH_absolute = 2;
+constexpr uint8_t OPERAND_LENGTH_absolute_16 = 2;
+constexpr uint8_t OPERAND_LENGTH_absolute_X = 2;
+constexpr uint8_t OPERAND_LENGTH_absolute_Y = 2;
+constexpr uint8_t OPERAND_LENGTH_zeropage = 1;
+constexpr uint8_t OPERAND_LENGTH_zeropage_X = 1;
+constexpr uint8_t OPERAND_LENGTH_zeropage_Y = 1;
+constexpr uint8_t OPERAND_LENGTH_zeropage_X_ptr = 1;
+constexpr uint8_t OPERAND_LENGTH_zeropage_ptr_Y = 1;
+constexpr uint8_t OPERAND_LENGTH_absolute_ptr = 2;
+constexpr uint8_t OPERAND_LENGTH_absolute_X_ptr = 2;
+constexpr uint8_t OPERAND_LENGTH_absolute_X_shift = 2;
+constexpr uint8_t OPERAND_LENGTH_zeropage_ptr = 1;
+
+#define LENGTH_ADDRESSED(n, mode, op) table[n] = 1 + OPERAND_LENGTH_##mode;
+#define LENGTH_IMPLIED(n, op) table[n] = 1;
+
+// Length in bytes of each valid opcode, 0 for invalid ones
+template <Variant V>
+constexpr std::array<uint8_t, 256> LENGTHS = [] {
+    std::array<uint8_t, 256> table{};
+    VARIANT_MAP(V, LENGTH_ADDRESSED, LENGTH_IMPLIED, LENGTH_IMPLIED)
+    return table;
+}();
+
+uint8_t instruction_length(Variant variant, uint8_t opcode) {
+    return with_variant(variant, [&](auto variant) { return std::max<uint8_t>(LENGTHS<variant()>[opcode], 1); });
+}
+
 bool CPU6502::execute_instruction() {
-    uint8_t opcode = (*_memory)[_PC.PC];
+    BEFORE_INSTRUCTION(_PC.PC);
+    uint8_t opcode = read(_PC.PC);
     _PC.PC++;
-    switch (opcode) {
-        case 0x00:
-            BRK();
-            break;
-        case 0x01:
-            ORA(zeropage_X_ptr());
-            break;
-        case 0x05:
-            ORA(zeropage());
-            break;
-        case 0x06:
-            ASL(zeropage());
-            break;
-        case 0x08:
-            PHP();
-            break;
-        case 0x09:
-            ORA(imediate());
-            break;
-        case 0x0A:
-            ASL(_A);
-            break;
-        case 0x0D:
-            ORA(absolute());
-            break;
-        case 0x0E:
-            ASL(absolute());
-            break;
-        case 0x10:
-            BPL(imediate());
-            break;
-        case 0x11:
-            ORA(zeropage_ptr_Y());
-            break;
-        case 0x15:
-            ORA(zeropage_X());
-            break;
-        case 0x16:
-            ASL(zeropage_X());
-            break;
-        case 0x18:
-            CLC();
-            break;
-        case 0x19:
-            ORA(absolute_Y());
-            break;
-        case 0x1D:
-            ORA(absolute_X());
-            break;
-        case 0x1E:
-            ASL(absolute_X());
-            break;
-        case 0x20:
-            JSR(imediate_16());
-            break;
-        case 0x21:
-            AND(zeropage_X_ptr());
-            break;
-        case 0x24:
-            BIT(zeropage());
-            break;
-        case 0x25:
-            AND(zeropage());
-            break;
-        case 0x26:
-            ROL(zeropage());
-            break;
-        case 0x28:
-            PLP();
-            break;
-        case 0x29:
-            AND(imediate());
-            break;
-        case 0x2A:
-            ROL(_A);
-            break;
-        case 0x2C:
-            BIT(absolute());
-            break;
-        case 0x2D:
-            AND(absolute());
-            break;
-        case 0x2E:
-            ROL(absolute());
-            break;
-        case 0x30:
-            BMI(imediate());
-            break;
-        case 0x31:
-            AND(zeropage_ptr_Y());
-            break;
-        case 0x35:
-            AND(zeropage_X());
-            break;
-        case 0x36:
-            ROL(zeropage_X());
-            break;
-        case 0x38:
-            SEC();
-            break;
-        case 0x39:
-            AND(absolute_Y());
-            break;
-        case 0x3E:
-            ROL(absolute_X());
-            break;
-        case 0x3D:
-            AND(absolute_X());
-            break;
-        case 0x40:
-            RTI();
-            break;
-        case 0x41:
-            EOR(zeropage_X_ptr());
-            break;
-        case 0x45:
-            EOR(zeropage());
-            break;
-        case 0x46:
-            LSR(zeropage());
-            break;
-        case 0x48:
-            PHA();
-            break;
-        case 0x4A:
-            LSR(_A);
-            break;
-        case 0x4C:
-            JMP(imediate_16());
-            break;
-        case 0x4D:
-            EOR(absolute());
-            break;
-        case 0x4E:
-            LSR(absolute());
-            break;
-        case 0x49:
-            EOR(imediate());
-            break;
-        case 0x50:
-            BVC(imediate());
-            break;
-        case 0x51:
-            EOR(zeropage_ptr_Y());
-            break;
-        case 0x55:
-            EOR(zeropage_X());
-            break;
-        case 0x56:
-            LSR(zeropage_X());
-            break;
-        case 0x58:
-            CLI();
-            break;
-        case 0x59:
-            EOR(absolute_Y());
-            break;
-        case 0x5D:
-            EOR(absolute_X());
-            break;
-        case 0x5E:
-            LSR(absolute_X());
-            break;
-        case 0x60:
-            RTS();
-            break;
-        case 0x61:
-            ADC(zeropage_X_ptr());
-            break;
-        case 0x65:
-            ADC(zeropage());
-            break;
-        case 0x66:
-            ROR(zeropage());
-            break;
-        case 0x68:
-            PLA();
-            break;
-        case 0x69:
-            ADC(imediate());
-            break;
-        case 0x6A:
-            ROR(_A);
-            break;
-        case 0x6C:
-            JMP(absolute_16());
-            break;
-        case 0x6D:
-            ADC(absolute());
-            break;
-        case 0x6E:
-            ROR(absolute());
-            break;
-        case 0x70:
-            BVS(imediate());
-            break;
-        case 0x71:
-            ADC(zeropage_ptr_Y());
-            break;
-        case 0x75:
-            ADC(zeropage_X());
-            break;
-        case 0x76:
-            ROR(zeropage_X());
-            break;
-        case 0x78:
-            SEI();
-            break;
-        case 0x79:
-            ADC(absolute_Y());
-            break;
-        case 0x7D:
-            ADC(absolute_X());
-            break;
-        case 0x7E:
-            ROR(absolute_X());
-            break;
-        case 0x81:
-            STA(zeropage_X_ptr());
-            break;
-        case 0x84:
-            STY(zeropage());
-            break;
-        case 0x85:
-            STA(zeropage());
-            break;
-        case 0x86:
-            STX(zeropage());
-            break;
-        case 0x88:
-            DEY();
-            break;
-        case 0x8A:
-            TXA();
-            break;
-        case 0x8C:
-            STY(absolute());
-            break;
-        case 0x8D:
-            STA(absolute());
-            break;
-        case 0x8E:
-            STX(absolute());
-            break;
-        case 0x90:
-            BCC(imediate());
-            break;
-        case 0x91:
-            STA(zeropage_ptr_Y());
-            break;
-        case 0x94:
-            STY(zeropage_X());
-            break;
-        case 0x95:
-            STA(zeropage_X());
-            break;
-        case 0x96:
-            STX(zeropage_Y());
-            break;
-        case 0x98:
-            TYA();
-            break;
-        case 0x99:
-            STA(absolute_Y());
-            break;
-        case 0x9A:
-            TXS();
-            break;
-        case 0x9D:
-            STA(absolute_X());
-            break;
-        case 0xA0:
-            LDY(imediate());
-            break;
-        case 0xA1:
-            LDA(zeropage_X_ptr());
-            break;
-        case 0xA2:
-            LDX(imediate());
-            break;
-        case 0xA4:
-            LDY(zeropage());
-            break;
-        case 0xAA:
-            TAX();
-            break;
-        case 0xAD:
-            LDA(absolute());
-            break;
-        case 0xA5:
-            LDA(zeropage());
-            break;
-        case 0xA6:
-            LDX(zeropage());
-            break;
-        case 0xA8:
-            TAY();
-            break;
-        case 0xA9:
-            LDA(imediate());
-            break;
-        case 0xAC:
-            LDY(absolute());
-            break;
-        case 0xAE:
-            LDX(absolute());
-            break;
-        case 0xB0:
-            BCS(imediate());
-            break;
-        case 0xB1:
-            LDA(zeropage_ptr_Y());
-            break;
-        case 0xB4:
-            LDY(zeropage_X());
-            break;
-        case 0xB8:
-            CLV();
-            break;
-        case 0xBA:
-            TSX();
-            break;
-        case 0xBC:
-            LDY(absolute_X());
-            break;
-        case 0xBD:
-            LDA(absolute_X());
-            break;
-        case 0xB5:
-            LDA(zeropage_X());
-            break;
-        case 0xB6:
-            LDX(zeropage_Y());
-            break;
-        case 0xB9:
-            LDA(absolute_Y());
-            break;
-        case 0xBE:
-            LDX(absolute_Y());
-            break;
-        case 0xC0:
-            CPY(imediate());
-            break;
-        case 0xC1:
-            CMP(zeropage_X_ptr());
-            break;
-        case 0xC4:
-            CPY(zeropage());
-            break;
-        case 0xC5:
-            CMP(zeropage());
-            break;
-        case 0xC6:
-            DEC(zeropage());
-            break;
-        case 0xC8:
-            INY();
-            break;
-        case 0xCA:
-            DEX();
-            break;
-        case 0xCC:
-            CPY(absolute());
-            break;
-        case 0xCD:
-            CMP(absolute());
-            break;
-        case 0xCE:
-            DEC(absolute());
-            break;
-        case 0xC9:
-            CMP(imediate());
-            break;
-        case 0xD0:
-            BNE(imediate());
-            break;
-        case 0xD1:
-            CMP(zeropage_ptr_Y());
-            break;
-        case 0xD5:
-            CMP(zeropage_X());
-            break;
-        case 0xD6:
-            DEC(zeropage_X());
-            break;
-        case 0xD8:
-            CLD();
-            break;
-        case 0xD9:
-            CMP(absolute_Y());
-            break;
-        case 0xDD:
-            CMP(absolute_X());
-            break;
-        case 0xDE:
-            DEC(absolute_X());
-            break;
-        case 0xE0:
-            CPX(imediate());
-            break;
-        case 0xE1:
-            SBC(zeropage_X_ptr());
-            break;
-        case 0xE4:
-            CPX(zeropage());
-            break;
-        case 0xE5:
-            SBC(zeropage());
-            break;
-        case 0xE6:
-            INC(zeropage());
-            break;
-        case 0xE8:
-            INX();
-            break;
-        case 0xE9:
-            SBC(imediate());
-            break;
-        case 0xEA:
-            NOP();
-            break;
-        case 0xEC:
-            CPX(absolute());
-            break;
-        case 0xED:
-            SBC(absolute());
-            break;
-        case 0xEE:
-            INC(absolute());
-            break;
-        case 0xF0:
-            BEQ(imediate());
-            break;
-        case 0xF1:
-            SBC(zeropage_ptr_Y());
-            break;
-        case 0xF5:
-            SBC(zeropage_X());
-            break;
-        case 0xF6:
-            INC(zeropage_X());
-            break;
-        case 0xF8:
-            SED();
-            break;
-        case 0xF9:
-            SBC(absolute_Y());
-            break;
-        case 0xFD:
-            SBC(absolute_X());
-            break;
-        case 0xFE:
-            INC(absolute_X());
-            break;
-        default:
-            printf("Invalid Opcode 0x%02x\n", opcode);
-            return false;
+    bool valid = with_variant(_variant, [&](auto variant) { return dispatch<variant()>(opcode); });
+    if (!valid) {
+        printf("Invalid Opcode 0x%02x\n", opcode);
+        return false;
     }
     return true;
 }
 
+Dispatch CPU6502::default_dispatch() {
+    return DEFAULT_DISPATCH;
+}
+
+RunResult CPU6502::run(uint64_t max_instructions) {
+    return run(max_instructions, UINT64_MAX, DEFAULT_DISPATCH);
+}
+
+RunResult CPU6502::run_cycles(uint64_t max_cycles) {
+    return run(UINT64_MAX, max_cycles, DEFAULT_DISPATCH);
+}
+
+RunResult CPU6502::run(uint64_t max_instructions, uint64_t max_cycles, Dispatch dispatch) {
+    // the run stops once the counter reaches the limit, finishing the
+    // instruction that crosses it
+    uint64_t cycle_limit = (max_cycles > UINT64_MAX - _cycles) ? UINT64_MAX : _cycles + max_cycles;
+    if (dispatch == Dispatch::JIT) {
+#if defined(CPU6502_JIT)
+        if (use_jit()) {
+            return _jit->run(max_instructions, cycle_limit);
+        }
+#endif
+        dispatch = DEFAULT_DISPATCH;
+    }
+    return with_variant(_variant, [&](auto variant) {
+        return run_variant<variant()>(max_instructions, cycle_limit, dispatch);
+    });
+}
+
+template <Variant V>
+RunResult CPU6502::run_variant(uint64_t max_instructions, uint64_t cycle_limit, Dispatch dispatch) {
+    switch (dispatch) {
+        case Dispatch::SWITCH:
+            return run_switch<V>(max_instructions, cycle_limit);
+        case Dispatch::TABLE:
+            return run_table<V>(max_instructions, cycle_limit);
+        case Dispatch::THREADED:
+            return run_threaded<V>(max_instructions, cycle_limit);
+        case Dispatch::DECODED:
+            return run_decoded<V>(max_instructions, cycle_limit);
+        case Dispatch::JIT:
+            break;
+    }
+    return run_table<V>(max_instructions, cycle_limit);
+}
+
+RunResult CPU6502::interpret(uint64_t max_instructions, uint64_t cycle_limit) {
+    return with_variant(_variant, [&](auto variant) {
+        return run_switch<variant()>(max_instructions, cycle_limit);
+    });
+}
+
+#if defined(CPU6502_JIT)
+
+// Tracing and profiling hook every instruction, which only the interpreters do
+bool CPU6502::use_jit() {
+#if defined(CPU6502_TRACE)
+    if (_trace != nullptr) {
+        return false;
+    }
+#endif
+#if defined(CPU6502_PROFILE)
+    if (_profiler != nullptr) {
+        return false;
+    }
+#endif
+    if (_jit == nullptr) {
+        _jit = std::make_unique<JIT>(*this);
+    }
+    return _jit->ok();
+}
+
+#endif
+
+#define SWITCH_CASE(n) \
+    case n: \
+        if constexpr (HANDLERS<V>[n] == nullptr) { \
+            return false; \
+        } \
+        else { \
+            _cycles += CYCLES<V>[n]; \
+            (this->*HANDLERS<V>[n])(); \
+            return true; \
+        }
+
+template <Variant V>
+inline bool CPU6502::dispatch(uint8_t opcode) {
+    switch (opcode) {
+        OPCODES_256(SWITCH_CASE)
+    }
+    return false;
+}
+
+template <Variant V>
+RunResult CPU6502::run_switch(uint64_t max_instructions, uint64_t cycle_limit) {
+    uint64_t executed = 0;
+    uint64_t start_cycles = _cycles;
+    StopReason reason = StopReason::BUDGET;
+    while (executed < max_instructions && _cycles < cycle_limit) {
+        if (_events && service_events(reason)) [[unlikely]] {
+            if (reason != StopReason::BUDGET) {
+                return {reason, executed, _cycles - start_cycles};
+            }
+            continue;
+        }
+        uint16_t instruction_PC = _PC.PC;
+        BEFORE_INSTRUCTION(instruction_PC);
+        uint8_t opcode = read(instruction_PC);
+        _PC.PC++;
+        if (!dispatch<V>(opcode)) [[unlikely]] {
+            return {StopReason::INVALID_OPCODE, executed, _cycles - start_cycles};
+        }
+        executed++;
+        if (_PC.PC == instruction_PC && (reason = self_trap()) != StopReason::BUDGET) [[unlikely]] {
+            // jump or branch to self, the machine can never leave this state
+            return {reason, executed, _cycles - start_cycles};
+        }
+    }
+    return {StopReason::BUDGET, executed, _cycles - start_cycles};
+}
+
+template <Variant V>
+RunResult CPU6502::run_table(uint64_t max_instructions, uint64_t cycle_limit) {
+    uint64_t executed = 0;
+    uint64_t start_cycles = _cycles;
+    StopReason reason = StopReason::BUDGET;
+    while (executed < max_instructions && _cycles < cycle_limit) {
+        if (_events && service_events(reason)) [[unlikely]] {
+            if (reason != StopReason::BUDGET) {
+                return {reason, executed, _cycles - start_cycles};
+            }
+            continue;
+        }
+        uint16_t instruction_PC = _PC.PC;
+        BEFORE_INSTRUCTION(instruction_PC);
+        uint8_t opcode = read(instruction_PC);
+        Handler handler = HANDLERS<V>[opcode];
+        _PC.PC++;
+        if (handler == nullptr) [[unlikely]] {
+            return {StopReason::INVALID_OPCODE, executed, _cycles - start_cycles};
+        }
+        _cycles += CYCLES<V>[opcode];
+        (this->*handler)();
+        executed++;
+        if (_PC.PC == instruction_PC && (reason = self_trap()) != StopReason::BUDGET) [[unlikely]] {
+            return {reason, executed, _cycles - start_cycles};
+        }
+    }
+    return {StopReason::BUDGET, executed, _cycles - start_cycles};
+}
+
+// Pre-decoded blocks
+
+#define DECODED_CASE(n) \
+    case n: \
+        if constexpr (DECODED_HANDLERS<V>[n] != nullptr) { \
+            (this->*DECODED_HANDLERS<V>[n])(); \
+        } \
+        return;
+
+template <Variant V>
+inline void CPU6502::decoded_dispatch(uint8_t opcode) {
+    switch (opcode) {
+        OPCODES_256(DECODED_CASE)
+    }
+}
+
+constexpr uint32_t NO_DECODED_BLOCK = UINT32_MAX;
+constexpr uint32_t MAX_DECODED_BLOCK = 64;
+// Records kept before everything is dropped and decoded afresh, stale blocks
+// leave theirs behind until then
+constexpr size_t MAX_DECODED_RECORDS = 1 << 18;
+// Times a page's blocks can be invalidated before it is left to the switch
+constexpr uint32_t DECODE_REWRITE_LIMIT = 64;
+
+// Jumps, calls, returns and BRK end a block, conditional branches do not as
+// not taking them carries on in a straight line. CLI and PLP also end one as
+// they can let a waiting IRQ in.
+template <Variant V>
+constexpr bool ends_block(uint8_t opcode) {
+    if (V == Variant::CMOS_65C02 && (opcode == 0x7C || opcode == 0x80)) {
+        return true; // JMP (abs,X) and BRA
+    }
+    return opcode == 0x00 || opcode == 0x20 || opcode == 0x40 || opcode == 0x4C
+        || opcode == 0x60 || opcode == 0x6C || opcode == 0x58 || opcode == 0x28;
+}
+
+template <Variant V>
+RunResult CPU6502::run_decoded(uint64_t max_instructions, uint64_t cycle_limit) {
+    uint64_t executed = 0;
+    uint64_t start_cycles = _cycles;
+    while (executed < max_instructions && _cycles < cycle_limit) {
+        const DecodedBlock& block = decoded_block<V>(_PC.PC);
+        // blocks only run when every instruction in them would have, so
+        // budgets end exactly where the other backends end them, and only
+        // while no interrupt is waiting
+        if (_events || block.count == 0 || block.count > max_instructions - executed
+                || block.max_cycles >= cycle_limit - _cycles) [[unlikely]] {
+            RunResult step = run_switch<V>(1, cycle_limit);
+            executed += step.instructions;
+            if (step.reason != StopReason::BUDGET) {
+                return {step.reason, executed, _cycles - start_cycles};
+            }
+            continue;
+        }
+        const Decoded* first = &_decoded[block.first];
+        const Decoded* record = first;
+        const Decoded* end = first + block.count;
+        uint16_t instruction_PC;
+        do {
+            const Decoded& instruction = *record++;
+            instruction_PC = _PC.PC;
+            uint16_t next_PC = instruction_PC + instruction.length;
+            BEFORE_INSTRUCTION(instruction_PC);
+            _PC.PC = next_PC;
+            _operand = instruction.operand;
+            _cycles += instruction.cycles;
+            decoded_dispatch<V>(instruction.opcode);
+            // a taken branch leaves the block, and so does a write to it
+            // since the records after it may no longer match memory, or a
+            // write to a device that raises an interrupt
+            if (_PC.PC != next_PC || (instruction.writes_memory
+                    && (_bus.code_generation(block.first_page) != block.generations[0]
+                    || _bus.code_generation(block.last_page) != block.generations[1] || _events))) {
+                break;
+            }
+        } while (record != end);
+        executed += record - first;
+        if (_PC.PC == instruction_PC) [[unlikely]] {
+            StopReason reason = self_trap();
+            if (reason != StopReason::BUDGET) {
+                return {reason, executed, _cycles - start_cycles};
+            }
+        }
+    }
+    return {StopReason::BUDGET, executed, _cycles - start_cycles};
+}
+
+// Finds the block starting at PC, decoding it again if a page it was read
+// from has changed since
+template <Variant V>
+const CPU6502::DecodedBlock& CPU6502::decoded_block(uint16_t PC) {
+    if (_decoded_block_at.empty()) {
+        _decoded_block_at.assign(MEMORY_SIZE, NO_DECODED_BLOCK);
+    }
+    uint32_t index = _decoded_block_at[PC];
+    if (index != NO_DECODED_BLOCK) {
+        DecodedBlock& block = _decoded_blocks[index];
+        bool first_valid = _bus.code_generation(block.first_page) == block.generations[0];
+        bool last_valid = _bus.code_generation(block.last_page) == block.generations[1];
+        if (first_valid && last_valid) {
+            return block;
+        }
+        _decode_rewrites[block.first_page] += !first_valid;
+        _decode_rewrites[block.last_page] += !last_valid;
+    }
+    if (_decoded.size() > MAX_DECODED_RECORDS - MAX_DECODED_BLOCK) {
+        _decoded.clear();
+        _decoded_blocks.clear();
+        _decoded_block_at.assign(MEMORY_SIZE, NO_DECODED_BLOCK);
+        index = NO_DECODED_BLOCK;
+    }
+    if (index == NO_DECODED_BLOCK) {
+        index = _decoded_blocks.size();
+        _decoded_block_at[PC] = index;
+        _decoded_blocks.emplace_back();
+    }
+    _decoded_blocks[index] = decode<V>(PC);
+    return _decoded_blocks[index];
+}
+
+// Decodes a straight line run starting at PC, within the page it starts on
+// and the next. Code on I/O pages and pages rewritten too often is left to
+// the switch, as are invalid opcodes.
+template <Variant V>
+CPU6502::DecodedBlock CPU6502::decode(uint16_t PC) {
+    uint8_t first_page = PC >> 8;
+    DecodedBlock block = {(uint32_t)_decoded.size(), 0, 0, first_page, first_page, {}};
+    auto decodable = [&](uint8_t page) {
+        return _bus.memory_backed(page) && _decode_rewrites[page] <= DECODE_REWRITE_LIMIT
+            && (page == first_page || page == (uint8_t)(first_page + 1));
+    };
+    while (block.count < MAX_DECODED_BLOCK) {
+        uint8_t opcode = _bus.peek(PC);
+        uint16_t last_byte = PC + LENGTHS<V>[opcode] - 1;
+        if (DECODED_HANDLERS<V>[opcode] == nullptr || !decodable(PC >> 8) || !decodable(last_byte >> 8)) {
+            break;
+        }
+        uint16_t operand = 0;
+        if (LENGTHS<V>[opcode] >= 2) {
+            operand = _bus.peek(PC + 1);
+        }
+        if (LENGTHS<V>[opcode] == 3) {
+            operand |= _bus.peek(PC + 2) << 8;
+        }
+        _decoded.push_back({opcode, operand, LENGTHS<V>[opcode], CYCLES<V>[opcode], WRITES_MEMORY<V>[opcode]});
+        block.count++;
+        // taken branches cost up to two cycles more, and page crossings one.
+        // On the 65C02 a page crossing and decimal mode can both add one.
+        block.max_cycles += CYCLES<V>[opcode] + (((opcode & 0x1F) == 0x10 || V == Variant::CMOS_65C02) ? 2 : 1);
+        block.last_page = last_byte >> 8;
+        PC += LENGTHS<V>[opcode];
+        if (ends_block<V>(opcode)) {
+            break;
+        }
+    }
+    _bus.watch(block.first_page);
+    _bus.watch(block.last_page);
+    block.generations[0] = _bus.code_generation(block.first_page);
+    block.generations[1] = _bus.code_generation(block.last_page);
+    return block;
+}
+
+#if defined(__GNUC__)
+
+// Each handler ends in its own copy of the dispatch so the host branch
+// predictor sees one indirect jump per opcode rather than a single shared one
+#define THREADED_NEXT \
+    executed++; \
+    if (_PC.PC == instruction_PC) [[unlikely]] { \
+        goto trap; \
+    } \
+    if (executed == max_instructions || _cycles >= cycle_limit || _events) [[unlikely]] { \
+        goto next; \
+    } \
+    instruction_PC = _PC.PC; \
+    BEFORE_INSTRUCTION(instruction_PC); \
+    _PC.PC++; \
+    goto *labels[read(instruction_PC)];
+
+#define THREADED_LABEL(n) &&op_##n,
+
+#define THREADED_HANDLER(n) \
+    op_##n: \
+        if constexpr (HANDLERS<V>[n] == nullptr) { \
+            goto invalid; \
+        } \
+        else { \
+            _cycles += CYCLES<V>[n]; \
+            (this->*HANDLERS<V>[n])(); \
+            THREADED_NEXT \
+        }
+
+template <Variant V>
+RunResult CPU6502::run_threaded(uint64_t max_instructions, uint64_t cycle_limit) {
+    static void* const labels[256] = { OPCODES_256(THREADED_LABEL) };
+    uint64_t executed = 0;
+    uint64_t start_cycles = _cycles;
+    StopReason reason = StopReason::BUDGET;
+    uint16_t instruction_PC;
+next:
+    if (executed == max_instructions || _cycles >= cycle_limit) {
+        goto budget;
+    }
+    if (_events && service_events(reason)) [[unlikely]] {
+        if (reason != StopReason::BUDGET) {
+            goto stop;
+        }
+        goto next;
+    }
+    instruction_PC = _PC.PC;
+    BEFORE_INSTRUCTION(instruction_PC);
+    _PC.PC++;
+    goto *labels[read(instruction_PC)];
+    OPCODES_256(THREADED_HANDLER)
+invalid:
+    return {StopReason::INVALID_OPCODE, executed, _cycles - start_cycles};
+trap:
+    reason = self_trap();
+    if (reason == StopReason::BUDGET) {
+        goto next;
+    }
+stop:
+    return {reason, executed, _cycles - start_cycles};
+budget:
+    return {StopReason::BUDGET, executed, _cycles - start_cycles};
+}
+
+#else
+
+template <Variant V>
+RunResult CPU6502::run_threaded(uint64_t max_instructions, uint64_t cycle_limit) {
+    return run_table<V>(max_instructions, cycle_limit);
+}
+
+#endif
+
+// Interrupts
+
+void CPU6502::set_irq(bool asserted) {
+    if (asserted && !_irq_line) {
+        _raised_at[(int) Interrupt::IRQ] = _cycles;
+    }
+    _irq_line = asserted;
+    update_irq();
+}
+
+void CPU6502::set_nmi(bool asserted) {
+    if (asserted && !_nmi_line) {
+        _raised_at[(int) Interrupt::NMI] = _cycles;
+        _events |= NMI_EVENT;
+    }
+    _nmi_line = asserted;
+}
+
+void CPU6502::reset() {
+    _raised_at[(int) Interrupt::RESET] = _cycles;
+    _events |= RESET_EVENT;
+}
+
+void CPU6502::take_interrupt() {
+    Interrupt input;
+    if (_events & RESET_EVENT) {
+        // the stack pointer moves as if three bytes were pushed but the
+        // writes never reach memory
+        input = Interrupt::RESET;
+        _events &= ~(RESET_EVENT | NMI_EVENT);
+        _S -= 3;
+        _P |= I_FLAG;
+        if (_variant == Variant::CMOS_65C02) {
+            _P &= ~D_FLAG;
+        }
+        _PC.PCX[0] = read(RES_VECTOR_OFFSET);
+        _PC.PCX[1] = read(RES_VECTOR_OFFSET+1);
+        update_irq();
+    }
+    else if (_events & NMI_EVENT) {
+        input = Interrupt::NMI;
+        _events &= ~NMI_EVENT;
+        interrupt(NMI_VECTOR_OFFSET);
+    }
+    else {
+        input = Interrupt::IRQ;
+        interrupt(IRQ_VECTOR_OFFSET);
+    }
+    InterruptStats& stats = _interrupt_stats[(int) input];
+    uint64_t latency = _cycles - _raised_at[(int) input];
+    stats.taken++;
+    stats.total_latency += latency;
+    stats.max_latency = latency > stats.max_latency ? latency : stats.max_latency;
+    _cycles += 7;
+}
+
+// Pushes the PC and status, B clear, and jumps through the vector with
+// further IRQs masked. The 65C02 also leaves decimal mode.
+void CPU6502::interrupt(uint16_t vector) {
+    write(STACK_OFFSET + _S, _PC.PCX[1]);
+    _S--;
+    write(STACK_OFFSET + _S, _PC.PCX[0]);
+    _S--;
+    write(STACK_OFFSET + _S, (status() & ~B_FLAG) | U_FLAG);
+    _S--;
+    _P |= I_FLAG;
+    if (_variant == Variant::CMOS_65C02) {
+        _P &= ~D_FLAG;
+    }
+    _PC.PCX[0] = read(vector);
+    _PC.PCX[1] = read(vector+1);
+    update_irq();
+}
+
+// Traps
+
+void CPU6502::set_breakpoint(uint16_t PC, bool enabled) {
+    if (breakpoint(PC) == enabled) {
+        return;
+    }
+    _breakpoints[PC >> 6] ^= 1ull << (PC & 63);
+    _breakpoint_count += enabled ? 1 : -1;
+    _events = (_events & ~BREAKPOINT_EVENT) | (_breakpoint_count != 0 ? BREAKPOINT_EVENT : 0);
+}
+
+void CPU6502::clear_breakpoints() {
+    _breakpoints.fill(0);
+    _breakpoint_count = 0;
+    _events &= ~BREAKPOINT_EVENT;
+}
+
+bool CPU6502::set_exit_address(std::optional<uint16_t> addr) {
+    _events &= ~EXIT_EVENT;
+    if (!addr) {
+        _bus.clear_write_trap();
+        return true;
+    }
+    return _bus.trap_write(*addr, [this](uint8_t) { _events |= EXIT_EVENT; });
+}
+
+bool CPU6502::service_events(StopReason& reason) {
+    if (_events & EXIT_EVENT) {
+        _events &= ~EXIT_EVENT;
+        reason = StopReason::EXIT;
+        return true;
+    }
+    if (_events & BREAKPOINT_EVENT) {
+        std::optional<uint16_t> resumed_from = _resumed_from;
+        _resumed_from.reset();
+        if (breakpoint(_PC.PC) && resumed_from != _PC.PC) {
+            _resumed_from = _PC.PC;
+            reason = StopReason::BREAKPOINT;
+            return true;
+        }
+    }
+    if (_events & INTERRUPT_EVENTS) {
+        take_interrupt();
+        return true;
+    }
+    return false;
+}
+
+StopReason CPU6502::self_trap() {
+    if (_brk_trapped) {
+        _brk_trapped = false;
+        return StopReason::BRK;
+    }
+    return _trap_self_loops ? StopReason::TRAP : StopReason::BUDGET;
+}
+
 // Addressing Modes
 
 uint8_t CPU6502::imediate() {
-    uint8_t value = (*_memory)[_PC.PC];
+    uint8_t value = read(_PC.PC);
     _PC.PC++;
     return value;
 }
 
 uint16_t CPU6502::imediate_16() {
-    uint8_t value_l = (*_memory)[_PC.PC];
+    uint8_t value_l = read(_PC.PC);
     _PC.PC++;
-    uint8_t value_u = (*_memory)[_PC.PC];
+    uint8_t value_u = read(_PC.PC);
     _PC.PC++;
     uint16_t value = (value_u << 8) + value_l;
     return value;
 }
 
-uint8_t& CPU6502::absolute() {
-    uint8_t addr_l = (*_memory)[_PC.PC];
+uint16_t CPU6502::absolute() {
+    uint8_t addr_l = read(_PC.PC);
     _PC.PC++;
-    uint8_t addr_u = (*_memory)[_PC.PC];
+    uint8_t addr_u = read(_PC.PC);
     _PC.PC++;
     uint16_t addr = (addr_u << 8) + addr_l;
-    return (*_memory)[addr];
+    return addr;
 }
 
+// JMP indirect, the NMOS part fetches the high byte of the target without
+// carrying into the pointer's high byte so JMP ($xxFF) wraps to $xx00
 uint16_t CPU6502::absolute_16() {
-    uint8_t addr_l = (*_memory)[_PC.PC];
+    uint8_t addr_l = read(_PC.PC);
     _PC.PC++;
-    uint8_t addr_u = (*_memory)[_PC.PC];
+    uint8_t addr_u = read(_PC.PC);
     _PC.PC++;
     uint16_t addr = (addr_u << 8) + addr_l;
-    uint8_t value_l = (*_memory)[addr];
-    uint8_t value_h = (*_memory)[addr+1];
+    uint8_t value_l = read(addr);
+    uint8_t value_h = read((addr & 0xFF00) | (uint8_t)(addr_l + 1));
     uint16_t value = (value_h << 8) + value_l;
     return value;
 }
 
-uint8_t& CPU6502::absolute_X() {
-    uint8_t addr_l = (*_memory)[_PC.PC];
+uint16_t CPU6502::absolute_X() {
+    uint8_t addr_l = read(_PC.PC);
     _PC.PC++;
-    uint8_t addr_u = (*_memory)[_PC.PC];
+    uint8_t addr_u = read(_PC.PC);
     _PC.PC++;
     uint16_t addr = (addr_u << 8) + addr_l;
-    return (*_memory)[addr+_X];
+    _page_crossed = (addr_l + _X) >> 8;
+    return addr + _X;
 }
 
-uint8_t& CPU6502::absolute_Y() {
-    uint8_t addr_l = (*_memory)[_PC.PC];
+uint16_t CPU6502::absolute_Y() {
+    uint8_t addr_l = read(_PC.PC);
     _PC.PC++;
-    uint8_t addr_u = (*_memory)[_PC.PC];
+    uint8_t addr_u = read(_PC.PC);
     _PC.PC++;
     uint16_t addr = (addr_u << 8) + addr_l;
-    return (*_memory)[addr+_Y];
+    _page_crossed = (addr_l + _Y) >> 8;
+    return addr + _Y;
 }
 
-uint8_t& CPU6502::zeropage() {
-    uint16_t addr = (*_memory)[_PC.PC];
+uint16_t CPU6502::zeropage() {
+    uint16_t addr = read(_PC.PC);
     _PC.PC++;
-    return (*_memory)[addr];
+    return addr;
 }
 
-uint8_t& CPU6502::zeropage_X() {
-    uint8_t addr = ((*_memory)[_PC.PC]+_X) & 0xFF;
+uint16_t CPU6502::zeropage_X() {
+    uint8_t addr = (read(_PC.PC)+_X) & 0xFF;
     _PC.PC++;
-    return (*_memory)[addr];
+    return addr;
 }
 
-uint8_t& CPU6502::zeropage_Y() {
-    uint8_t addr = ((*_memory)[_PC.PC]+_Y) & 0xFF;
+uint16_t CPU6502::zeropage_Y() {
+    uint8_t addr = (read(_PC.PC)+_Y) & 0xFF;
     _PC.PC++;
-    return (*_memory)[addr];
+    return addr;
 }
 
-uint8_t& CPU6502::zeropage_X_ptr() {
-    uint8_t ptr = ((*_memory)[_PC.PC]+_X) & 0xFF;
+uint16_t CPU6502::zeropage_X_ptr() {
+    uint8_t ptr = (read(_PC.PC)+_X) & 0xFF;
     _PC.PC++;
-    uint8_t addr_l = (*_memory)[ptr];
-    uint8_t addr_u = (*_memory)[ptr+1];
+    uint8_t addr_l = read(ptr);
+    uint8_t addr_u = read((uint8_t)(ptr+1));
     uint16_t addr = (addr_u << 8) + addr_l;
-    return (*_memory)[addr];
+    return addr;
 }
 
-uint8_t& CPU6502::zeropage_ptr_Y() {
-    uint8_t ptr = (*_memory)[_PC.PC]; 
+uint16_t CPU6502::zeropage_ptr_Y() {
+    uint8_t ptr = read(_PC.PC); 
     _PC.PC++;
-    uint8_t addr_l = (*_memory)[ptr];
-    uint8_t addr_u = (*_memory)[ptr+1];
+    uint8_t addr_l = read(ptr);
+    uint8_t addr_u = read((uint8_t)(ptr+1));
     uint16_t addr = (addr_u << 8) + addr_l + _Y;
-    return (*_memory)[addr];
+    _page_crossed = (addr_l + _Y) >> 8;
+    return addr;
 }
 
-// Flag Manipulation
-//
-void CPU6502::set_flags(uint8_t value, uint8_t mask) {
-    if ((mask & N_FLAG)) {
-        _P = (_P & ~N_FLAG) | ((value & 0x80) ? N_FLAG : 0);
-    }
-    if ((mask & Z_FLAG)) {
-        _P = (_P & ~Z_FLAG) | ((value == 0) ? Z_FLAG : 0);
-    }
+// JMP ($xxxx) on the 65C02, which reads the target across a page boundary
+uint16_t CPU6502::absolute_ptr() {
+    uint16_t addr = absolute();
+    uint8_t value_l = read(addr);
+    uint8_t value_h = read(addr+1);
+    return (value_h << 8) + value_l;
+}
+
+// JMP ($xxxx,X)
+uint16_t CPU6502::absolute_X_ptr() {
+    uint16_t addr = absolute() + _X;
+    uint8_t value_l = read(addr);
+    uint8_t value_h = read(addr+1);
+    return (value_h << 8) + value_l;
+}
+
+// Absolute,X for the 65C02's shifts and rotates, which only pay for a page
+// crossing when there is one
+uint16_t CPU6502::absolute_X_shift() {
+    return absolute_X();
+}
+
+// ($xx), wrapping within the zero page
+uint16_t CPU6502::zeropage_ptr() {
+    uint8_t ptr = read(_PC.PC);
+    _PC.PC++;
+    uint8_t addr_l = read(ptr);
+    uint8_t addr_u = read((uint8_t)(ptr+1));
+    return (addr_u << 8) + addr_l;
+}
+
+// Pre-decoded addressing modes, the PC is already past the operand
+
+uint8_t CPU6502::decoded_imediate() {
+    return _operand;
+}
+
+uint16_t CPU6502::decoded_imediate_16() {
+    return _operand;
+}
+
+uint16_t CPU6502::decoded_absolute() {
+    return _operand;
+}
+
+uint16_t CPU6502::decoded_absolute_16() {
+    uint8_t value_l = read(_operand);
+    uint8_t value_h = read((_operand & 0xFF00) | (uint8_t)(_operand + 1));
+    uint16_t value = (value_h << 8) + value_l;
+    return value;
+}
+
+uint16_t CPU6502::decoded_absolute_X() {
+    _page_crossed = ((_operand & 0xFF) + _X) >> 8;
+    return _operand + _X;
+}
+
+uint16_t CPU6502::decoded_absolute_Y() {
+    _page_crossed = ((_operand & 0xFF) + _Y) >> 8;
+    return _operand + _Y;
+}
+
+uint16_t CPU6502::decoded_zeropage() {
+    return _operand;
+}
+
+uint16_t CPU6502::decoded_zeropage_X() {
+    return (_operand + _X) & 0xFF;
+}
+
+uint16_t CPU6502::decoded_zeropage_Y() {
+    return (_operand + _Y) & 0xFF;
+}
+
+uint16_t CPU6502::decoded_zeropage_X_ptr() {
+    uint8_t ptr = (_operand + _X) & 0xFF;
+    uint8_t addr_l = read(ptr);
+    uint8_t addr_u = read((uint8_t)(ptr+1));
+    uint16_t addr = (addr_u << 8) + addr_l;
+    return addr;
+}
+
+uint16_t CPU6502::decoded_zeropage_ptr_Y() {
+    uint8_t ptr = _operand;
+    uint8_t addr_l = read(ptr);
+    uint8_t addr_u = read((uint8_t)(ptr+1));
+    uint16_t addr = (addr_u << 8) + addr_l + _Y;
+    _page_crossed = (addr_l + _Y) >> 8;
+    return addr;
+}
+
+uint16_t CPU6502::decoded_absolute_ptr() {
+    uint8_t value_l = read(_operand);
+    uint8_t value_h = read(_operand+1);
+    return (value_h << 8) + value_l;
+}
+
+uint16_t CPU6502::decoded_absolute_X_ptr() {
+    uint16_t addr = _operand + _X;
+    uint8_t value_l = read(addr);
+    uint8_t value_h = read(addr+1);
+    return (value_h << 8) + value_l;
+}
+
+uint16_t CPU6502::decoded_absolute_X_shift() {
+    return decoded_absolute_X();
+}
+
+uint16_t CPU6502::decoded_zeropage_ptr() {
+    uint8_t ptr = _operand;
+    uint8_t addr_l = read(ptr);
+    uint8_t addr_u = read((uint8_t)(ptr+1));
+    return (addr_u << 8) + addr_l;
+}
+
+#if defined(CPU6502_TRACE)
+
+// Tracing
+
+void CPU6502::trace_instruction(uint16_t instruction_PC) {
+    TraceRecord* record = _trace->next();
+    record->PC = instruction_PC;
+    record->address = 0;
+    record->opcode = _bus.peek(instruction_PC);
+    record->operands[0] = _bus.peek(instruction_PC + 1);
+    record->operands[1] = _bus.peek(instruction_PC + 2);
+    record->A = _A;
+    record->X = _X;
+    record->Y = _Y;
+    record->P = status();
+    record->S = _S;
+    record->has_address = 0;
+    _trace_record = record;
+}
+
+#endif
+
+// Branching
+
+void CPU6502::branch(bool taken, uint8_t offset) {
+    uint16_t target = _PC.PC + (int8_t) offset;
+    // a taken branch costs one more cycle, two if it lands on another page
+    _cycles += taken + (taken & ((target ^ _PC.PC) > 0xFF));
+    _PC.PC = taken ? target : _PC.PC;
 }
 
 // Instructions
 
 void CPU6502::ADC(uint8_t value) {
-    //printf("A = %02x, M = %02x, C = %02x\n", _A, value, _P & C_FLAG);
+    if (_P & D_FLAG) [[unlikely]] {
+        ADC_decimal(value);
+        return;
+    }
     uint16_t result = _A + value + ((_P & C_FLAG) ? 1 : 0);
     bool byte_overflowed = (result > 0xFF);
     _P = (_P & ~C_FLAG) | (byte_overflowed ? C_FLAG : 0);
     bool sign_changed = !((_A ^ value) & 0x80) && ((_A ^ (uint8_t)result) & 0x80);
-    //printf("Sign Changed %d\n", sign_changed);
     _P = (_P & ~V_FLAG) | (sign_changed ? V_FLAG : 0);
     _A = result;
-    set_flags(_A, N_FLAG | Z_FLAG);
+    set_NZ(_A);
 }
 
 void CPU6502::AND(uint8_t value) {
     _A &= value;
-    set_flags(_A, N_FLAG | Z_FLAG);
+    set_NZ(_A);
 }
 
-void CPU6502::ASL(uint8_t& value) {
+uint8_t CPU6502::ASL(uint8_t value) {
     _P = (0x80 & value) ? _P|C_FLAG : _P & ~C_FLAG;
     value <<= 1;
-    set_flags(value, N_FLAG | Z_FLAG);
+    set_NZ(value);
+    return value;
 }
 
 void CPU6502::BCC(uint8_t value) {
-    if (!(_P & C_FLAG)) {
-        _PC.PC += (int8_t) value;
-    }
+    branch(!(_P & C_FLAG), value);
 }
 
 void CPU6502::BCS(uint8_t value) {
-    if (_P & C_FLAG) {
-        _PC.PC += (int8_t) value;
-    }
+    branch(_P & C_FLAG, value);
 }
 
 void CPU6502::BEQ(uint8_t value) {
-    if (_P & Z_FLAG) {
-        _PC.PC += (int8_t) value;
-    }
+    branch(_Z_result == 0, value);
 }
 
 void CPU6502::BIT(uint8_t value) {
-    uint8_t mask = (N_FLAG | V_FLAG);
-    _P = (_P & ~mask) | (value & mask);
-    set_flags(_A & value, Z_FLAG);
+    _P = (_P & ~V_FLAG) | (value & V_FLAG);
+    _N_result = value;
+    _Z_result = _A & value;
 }
 
 void CPU6502::BMI(uint8_t value) {
-    if (_P & N_FLAG) {
-        _PC.PC += (int8_t) value;
-    }
+    branch(_N_result & N_FLAG, value);
 }
 
 void CPU6502::BNE(uint8_t value) {
-    if (!(_P & Z_FLAG)) {
-        _PC.PC += (int8_t) value;
-    }
+    branch(_Z_result != 0, value);
 }
 
 void CPU6502::BPL(uint8_t value) {
-    if (!(_P & N_FLAG)) {
-        _PC.PC += (int8_t) value;
-    }
+    branch(!(_N_result & N_FLAG), value);
 }
 
-// this instruction is fubar
+// Enters the IRQ handler like an interrupt, but with B set in the pushed
+// status so the handler can tell them apart
 void CPU6502::BRK() {
+    if (_trap_brk) {
+        _PC.PC--;
+        _brk_trapped = true;
+        return;
+    }
     _PC.PC++; // BRK is a two byte instructions, no matter what they say
-    (*_memory)[STACK_OFFSET + _S] = _PC.PCX[0];
+    write(STACK_OFFSET + _S, _PC.PCX[1]);
     _S--;
-    (*_memory)[STACK_OFFSET + _S] = _PC.PCX[1];
+    write(STACK_OFFSET + _S, _PC.PCX[0]);
     _S--;
-    (*_memory)[STACK_OFFSET + _S] = _P | B_FLAG;
+    write(STACK_OFFSET + _S, status() | B_FLAG | U_FLAG);
     _S--;
-    _PC.PCX[0] = (*_memory)[NMI_VECTOR_OFFSET]; // I know it's a NMI, don't ask
-    _PC.PCX[1] = (*_memory)[NMI_VECTOR_OFFSET+1]; // I know it's a NMI, don't ask
+    _PC.PCX[0] = read(IRQ_VECTOR_OFFSET);
+    _PC.PCX[1] = read(IRQ_VECTOR_OFFSET+1);
     _P |= I_FLAG;
+    if (_variant == Variant::CMOS_65C02) {
+        _P &= ~D_FLAG;
+    }
+    update_irq();
 }
 
 void CPU6502::BVC(uint8_t value) {
-    if (!(_P & V_FLAG)) {
-        _PC.PC += (int8_t) value;
-    }
+    branch(!(_P & V_FLAG), value);
 }
 
 void CPU6502::BVS(uint8_t value) {
-    if (_P & V_FLAG) {
-        _PC.PC += (int8_t) value;
-    }
+    branch(_P & V_FLAG, value);
 }
 
 void CPU6502::CLC() {
@@ -687,6 +1147,7 @@ void CPU6502::CLD() {
 
 void CPU6502::CLI() {
     _P &= ~(I_FLAG);
+    update_irq();
 }
 
 void CPU6502::CLV() {
@@ -696,54 +1157,56 @@ void CPU6502::CLV() {
 void CPU6502::CMP(uint8_t value) {
     uint8_t result = _A - value;
     _P = (_P & ~C_FLAG) | (_A >= value ? 1 : 0);
-    set_flags(result, N_FLAG | Z_FLAG);
+    set_NZ(result);
 }
 
 void CPU6502::CPX(uint8_t value) {
     uint8_t result = _X - value;
     _P = (_P & ~C_FLAG) | (_X >= value ? 1 : 0);
-    set_flags(result, N_FLAG | Z_FLAG);
+    set_NZ(result);
 }
 
 void CPU6502::CPY(uint8_t value) {
     uint8_t result = _Y - value;
     _P = (_P & ~C_FLAG) | (_Y >= value ? 1 : 0);
-    set_flags(result, N_FLAG | Z_FLAG);
+    set_NZ(result);
 }
 
-void CPU6502::DEC(uint8_t& value) {
+uint8_t CPU6502::DEC(uint8_t value) {
     value--;
-    set_flags(value, N_FLAG | Z_FLAG);
+    set_NZ(value);
+    return value;
 }
 
 void CPU6502::DEX() {
     _X--;
-    set_flags(_X, N_FLAG | Z_FLAG);
+    set_NZ(_X);
 }
 
 void CPU6502::DEY() {
     _Y--;
-    set_flags(_Y, N_FLAG | Z_FLAG);
+    set_NZ(_Y);
 }
 
 void CPU6502::EOR(uint8_t value) {
     _A ^= value;
-    set_flags(_A, N_FLAG | Z_FLAG);
+    set_NZ(_A);
 }
 
-void CPU6502::INC(uint8_t& value) {
+uint8_t CPU6502::INC(uint8_t value) {
     value = (int8_t) value + 1;
-    set_flags(value, N_FLAG | Z_FLAG);
+    set_NZ(value);
+    return value;
 }
 
 void CPU6502::INX() {
     _X = (int8_t) _X +1;
-    set_flags(_X, N_FLAG | Z_FLAG);
+    set_NZ(_X);
 }
 
 void CPU6502::INY() {
     _Y = (int8_t) _Y +1;
-    set_flags(_Y, N_FLAG | Z_FLAG);
+    set_NZ(_Y);
 }
 
 void CPU6502::JMP(uint16_t value) {
@@ -751,32 +1214,35 @@ void CPU6502::JMP(uint16_t value) {
 }
 
 void CPU6502::JSR(uint16_t value) {
-    (*_memory)[STACK_OFFSET + _S] = _PC.PCX[1];
+    PROFILE_CALL(value);
+    uint16_t return_address = _PC.PC - 1;
+    write(STACK_OFFSET + _S, return_address >> 8);
     _S--;
-    (*_memory)[STACK_OFFSET + _S] = _PC.PCX[0]-1;
+    write(STACK_OFFSET + _S, return_address & 0xFF);
     _S--;
     _PC.PC = value;
 }
 
 void CPU6502::LDA(uint8_t value) {
     _A = value;
-    set_flags(_A, N_FLAG | Z_FLAG);
+    set_NZ(_A);
 }
 
 void CPU6502::LDX(uint8_t value) {
     _X = value;
-    set_flags(_X, N_FLAG | Z_FLAG);
+    set_NZ(_X);
 }
 
 void CPU6502::LDY(uint8_t value) {
     _Y = value;
-    set_flags(_Y, N_FLAG | Z_FLAG);
+    set_NZ(_Y);
 }
 
-void CPU6502::LSR(uint8_t& value) {
+uint8_t CPU6502::LSR(uint8_t value) {
     _P = (0x1 & value) ? _P|C_FLAG : _P & ~C_FLAG;
     value = (value >> 1);
-    set_flags(value, N_FLAG | Z_FLAG);
+    set_NZ(value);
+    return value;
 }
 
 void CPU6502::NOP() {
@@ -785,79 +1251,139 @@ void CPU6502::NOP() {
 
 void CPU6502::ORA(uint8_t value) {
     _A |= value;
-    set_flags(_A, N_FLAG | Z_FLAG);
+    set_NZ(_A);
 }
 
 void CPU6502::PHA() {
-    (*_memory)[STACK_OFFSET + _S] = _A;
+    write(STACK_OFFSET + _S, _A);
     _S--;
 }
 
 void CPU6502::PHP() {
-    (*_memory)[STACK_OFFSET + _S] = (_P | B_FLAG | U_FLAG);
+    write(STACK_OFFSET + _S, (status() | B_FLAG | U_FLAG));
     _S--;
 }
 
 void CPU6502::PLA() {
     _S++;
-    _A = (*_memory)[STACK_OFFSET + _S];
-    set_flags(_A, N_FLAG | Z_FLAG);
+    _A = read(STACK_OFFSET + _S);
+    set_NZ(_A);
 }
 
 void CPU6502::PLP() {
     _S++;
-    _P = (*_memory)[STACK_OFFSET + _S];// & ~(B_FLAG | U_FLAG);
+    set_status(read(STACK_OFFSET + _S));// & ~(B_FLAG | U_FLAG);
 }
 
-void CPU6502::ROL(uint8_t& value) {
+uint8_t CPU6502::ROL(uint8_t value) {
     bool C_old = _P & C_FLAG; 
     _P = (0x80 & value) ? (_P | C_FLAG) : (_P & ~C_FLAG);
     value = (value << 1) + (C_old ? 1 : 0);
-    set_flags(value, N_FLAG | Z_FLAG);
+    set_NZ(value);
+    return value;
 }
 
-void CPU6502::ROR(uint8_t& value) {
+uint8_t CPU6502::ROR(uint8_t value) {
     bool C_old = _P & C_FLAG; 
     _P = (0x1 & value) ? _P|C_FLAG : _P & ~C_FLAG;
     value = (value >> 1) + (C_old ? 0x80 : 0);
-    set_flags(value, N_FLAG | Z_FLAG);
+    set_NZ(value);
+    return value;
 }
 
 void CPU6502::RTI() {
     _S++;
-    _P = (*_memory)[STACK_OFFSET + _S] & ~(B_FLAG | U_FLAG);
+    set_status(read(STACK_OFFSET + _S) & ~(B_FLAG | U_FLAG));
     _S++;
-    uint8_t addr_l = (*_memory)[STACK_OFFSET + _S];
+    uint8_t addr_l = read(STACK_OFFSET + _S);
     _S++;
-    uint8_t addr_u = (*_memory)[STACK_OFFSET + _S];
+    uint8_t addr_u = read(STACK_OFFSET + _S);
     uint16_t addr = (addr_u << 8) + addr_l;
     _PC.PC = addr;
 }
 
 void CPU6502::RTS() {
+    PROFILE_RETURN();
     _S++;
-    uint8_t addr_l = (*_memory)[STACK_OFFSET + _S];
+    uint8_t addr_l = read(STACK_OFFSET + _S);
     _S++;
-    uint8_t addr_u = (*_memory)[STACK_OFFSET + _S];
+    uint8_t addr_u = read(STACK_OFFSET + _S);
     uint16_t addr = (addr_u << 8) + addr_l;
     _PC.PC = addr + 1;
 }
 
 void CPU6502::SBC(uint8_t value) {
-    //printf("A = %02x, M = %02x, C = %02x\n", _A, value, _P & C_FLAG);
+    if (_P & D_FLAG) [[unlikely]] {
+        SBC_decimal(value);
+        return;
+    }
     uint16_t result = (uint16_t) (_A & 0xFF) - (value & 0xFF) - ((_P & C_FLAG) ? 0  : 1);
-    //printf("result = %02x\n", result);
-    // Flag setting Mostly copy and pasted form ADC, probably also mostly wrong...
-    bool byte_overflowed = result < 0x100;
-    //printf("Byte Overflowed %d\n", byte_overflowed);
-    _P = (_P & ~C_FLAG) | (byte_overflowed ? C_FLAG : 0);
+    bool no_borrow = result < 0x100;
+    _P = (_P & ~C_FLAG) | (no_borrow ? C_FLAG : 0);
     bool sign_changed = ((_A ^ value) & 0x80) && ((_A ^ (uint8_t)result) & 0x80);
-    //printf("Sign Changed %d\n", sign_changed);
     _P = (_P & ~V_FLAG) | (sign_changed ? V_FLAG : 0);
-    set_flags(result, N_FLAG | Z_FLAG);
+    set_NZ(result);
     _A = result;
 }
 
+// The NMOS part adds each digit with a decimal adjust but takes Z from the
+// binary sum and N and V from the high digit before it is adjusted. The
+// 65C02 takes N and Z from the result instead, for a cycle more.
+void CPU6502::ADC_decimal(uint8_t value) {
+    uint8_t carry = (_P & C_FLAG) ? 1 : 0;
+    uint16_t result = (_A & 0x0F) + (value & 0x0F) + carry;
+    if (result > 0x09) {
+        result += 0x06;
+    }
+    result = (result & 0x0F) + (_A & 0xF0) + (value & 0xF0) + (result > 0x0F ? 0x10 : 0);
+    _Z_result = _A + value + carry;
+    _N_result = result;
+    bool sign_changed = !((_A ^ value) & 0x80) && ((_A ^ result) & 0x80);
+    _P = (_P & ~V_FLAG) | (sign_changed ? V_FLAG : 0);
+    if ((result & 0x1F0) > 0x90) {
+        result += 0x60;
+    }
+    _P = (_P & ~C_FLAG) | ((result & 0xFF0) > 0xF0 ? C_FLAG : 0);
+    _A = result;
+    if (_variant == Variant::CMOS_65C02) {
+        set_NZ(_A);
+        _cycles++;
+    }
+}
+
+// C and V are set as the binary subtraction sets them. The NMOS part adjusts
+// each digit of A and leaves N and Z as the binary result set them, the
+// 65C02 adjusts the binary difference as a whole and takes N and Z from the
+// result, for a cycle more.
+void CPU6502::SBC_decimal(uint8_t value) {
+    uint8_t borrow = (_P & C_FLAG) ? 0 : 1;
+    uint16_t binary = _A - value - borrow;
+    uint16_t result = (_A & 0x0F) - (value & 0x0F) - borrow;
+    if (_variant == Variant::CMOS_65C02) {
+        result = binary - ((binary & 0x100) ? 0x60 : 0) - ((result & 0x10) ? 0x06 : 0);
+    }
+    else {
+        if (result & 0x10) {
+            result = ((result - 0x06) & 0x0F) | ((_A & 0xF0) - (value & 0xF0) - 0x10);
+        }
+        else {
+            result = (result & 0x0F) | ((_A & 0xF0) - (value & 0xF0));
+        }
+        if (result & 0x100) {
+            result -= 0x60;
+        }
+    }
+    _P = (_P & ~C_FLAG) | (binary < 0x100 ? C_FLAG : 0);
+    bool sign_changed = ((_A ^ value) & 0x80) && ((_A ^ binary) & 0x80);
+    _P = (_P & ~V_FLAG) | (sign_changed ? V_FLAG : 0);
+    set_NZ(binary);
+    _A = result;
+    if (_variant == Variant::CMOS_65C02) {
+        set_NZ(_A);
+        _cycles++;
+    }
+}
+
 void CPU6502::SEC() {
     _P |= C_FLAG;
 }
@@ -868,38 +1394,39 @@ void CPU6502::SED() {
 
 void CPU6502::SEI() {
     _P |= I_FLAG;
+    update_irq();
 }
 
-void CPU6502::STA(uint8_t& value) {
-    value = _A;
+void CPU6502::STA(uint16_t addr) {
+    write(addr, _A);
 }
 
-void CPU6502::STX(uint8_t& value) {
-    value = _X;
+void CPU6502::STX(uint16_t addr) {
+    write(addr, _X);
 }
 
-void CPU6502::STY(uint8_t& value) {
-    value = _Y;
+void CPU6502::STY(uint16_t addr) {
+    write(addr, _Y);
 }
 
 void CPU6502::TAX() {
     _X = _A;
-    set_flags(_X, N_FLAG | Z_FLAG);
+    set_NZ(_X);
 }
 
 void CPU6502::TAY() {
     _Y = _A;
-    set_flags(_Y, N_FLAG | Z_FLAG);
+    set_NZ(_Y);
 }
 
 void CPU6502::TSX() {
     _X = _S;
-    set_flags(_X, N_FLAG | Z_FLAG);
+    set_NZ(_X);
 }
 
 void CPU6502::TXA() {
     _A = _X;
-    set_flags(_A, N_FLAG | Z_FLAG);
+    set_NZ(_A);
 }
 
 void CPU6502::TXS() {
@@ -908,6 +1435,153 @@ void CPU6502::TXS() {
 
 void CPU6502::TYA() {
     _A = _Y;
-    set_flags(_A, N_FLAG | Z_FLAG);
+    set_NZ(_A);
+}
+
+// Undocumented Instructions
+//
+// Most combine a read-modify-write with the ALU operation from the same
+// column of the opcode map, on the value written back
+
+void CPU6502::ALR(uint8_t value) {
+    AND(value);
+    _A = LSR(_A);
+}
+
+void CPU6502::ANC(uint8_t value) {
+    AND(value);
+    _P = (_P & ~C_FLAG) | ((_A & 0x80) ? C_FLAG : 0);
+}
+
+// AND then ROR A, with C and V taken from bits 6 and 5 of the result. In
+// decimal mode each digit of the AND is then adjusted as if it were a BCD
+// sum.
+void CPU6502::ARR(uint8_t value) {
+    uint8_t anded = _A & value;
+    uint8_t result = (anded >> 1) | ((_P & C_FLAG) ? 0x80 : 0);
+    set_NZ(result);
+    if (_P & D_FLAG) {
+        _P = (_P & ~V_FLAG) | (((result ^ anded) & 0x40) ? V_FLAG : 0);
+        if ((anded & 0x0F) + (anded & 0x01) > 0x05) {
+            result = (result & 0xF0) | ((result + 0x06) & 0x0F);
+        }
+        bool carry = (anded & 0xF0) + (anded & 0x10) > 0x50;
+        if (carry) {
+            result = (result & 0x0F) | ((result + 0x60) & 0xF0);
+        }
+        _P = (_P & ~C_FLAG) | (carry ? C_FLAG : 0);
+    }
+    else {
+        _P = (_P & ~C_FLAG) | ((result & 0x40) ? C_FLAG : 0);
+        _P = (_P & ~V_FLAG) | (((result ^ (result << 1)) & 0x40) ? V_FLAG : 0);
+    }
+    _A = result;
+}
+
+uint8_t CPU6502::DCP(uint8_t value) {
+    value = DEC(value);
+    CMP(value);
+    return value;
+}
+
+void CPU6502::IGN(uint8_t) {
+    // the read is all it does
+}
+
+uint8_t CPU6502::ISC(uint8_t value) {
+    value = INC(value);
+    SBC(value);
+    return value;
+}
+
+void CPU6502::LAX(uint8_t value) {
+    _A = value;
+    _X = value;
+    set_NZ(value);
+}
+
+uint8_t CPU6502::RLA(uint8_t value) {
+    value = ROL(value);
+    AND(value);
+    return value;
+}
+
+uint8_t CPU6502::RRA(uint8_t value) {
+    value = ROR(value);
+    ADC(value);
+    return value;
+}
+
+void CPU6502::SAX(uint16_t addr) {
+    write(addr, _A & _X);
+}
+
+// X = (A & X) - value, setting the flags like CMP
+void CPU6502::SBX(uint8_t value) {
+    uint8_t anded = _A & _X;
+    _P = (_P & ~C_FLAG) | (anded >= value ? C_FLAG : 0);
+    _X = anded - value;
+    set_NZ(_X);
+}
+
+uint8_t CPU6502::SLO(uint8_t value) {
+    value = ASL(value);
+    ORA(value);
+    return value;
+}
+
+uint8_t CPU6502::SRE(uint8_t value) {
+    value = LSR(value);
+    EOR(value);
+    return value;
+}
+
+// 65C02 Instructions
+
+// Only sets Z, N and V are left alone
+void CPU6502::BIT_imediate(uint8_t value) {
+    _Z_result = _A & value;
+}
+
+void CPU6502::BRA(uint8_t value) {
+    branch(true, value);
+}
+
+void CPU6502::PHX() {
+    write(STACK_OFFSET + _S, _X);
+    _S--;
+}
+
+void CPU6502::PHY() {
+    write(STACK_OFFSET + _S, _Y);
+    _S--;
+}
+
+void CPU6502::PLX() {
+    _S++;
+    _X = read(STACK_OFFSET + _S);
+    set_NZ(_X);
+}
+
+void CPU6502::PLY() {
+    _S++;
+    _Y = read(STACK_OFFSET + _S);
+    set_NZ(_Y);
+}
+
+void CPU6502::STZ(uint16_t addr) {
+    write(addr, 0);
+}
+
+// TRB and TSB set Z from A AND the value like BIT, then clear or set the
+// bits of A in it
+uint8_t CPU6502::TRB(uint8_t value) {
+    _Z_result = _A & value;
+    return value & ~_A;
+}
+
+uint8_t CPU6502::TSB(uint8_t value) {
+    _Z_result = _A & value;
+    return value | _A;
 }
 
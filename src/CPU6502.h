@@ -1,58 +1,365 @@
 #pragma once
 #include <array>
+#include <span>
 #include <memory>
+#include <vector>
 #include <cstdint>
+#include <optional>
 #include <sys/types.h>
 
+#include "Bus.h"
+#include "Snapshot.h"
+#if defined(CPU6502_TRACE)
+#include "Trace.h"
+#endif
+#if defined(CPU6502_PROFILE)
+#include "Profiler.h"
+#endif
+#if defined(CPU6502_JIT)
+#include "JIT.h"
+#endif
+
 constexpr int32_t MEMORY_SIZE = 65536;
 
+// Status register bits
+constexpr uint8_t N_FLAG = 0x80; // Negative Flag
+constexpr uint8_t V_FLAG = 0x40; // Overflow Flag
+constexpr uint8_t U_FLAG = 0x20; // Unused 
+constexpr uint8_t B_FLAG = 0x10; // Break Flag
+constexpr uint8_t D_FLAG = 0x08; // Decimal Flag (use BCD for arithmetic)
+constexpr uint8_t I_FLAG = 0x04; // Interrupt Flag (IRQ disable)
+constexpr uint8_t Z_FLAG = 0x02; // Zero Flag
+constexpr uint8_t C_FLAG = 0x01; // Carry
+
+// Why a call to CPU6502::run() returned
+enum class StopReason {
+    BUDGET,         // the instruction budget was used up
+    INVALID_OPCODE, // PC is one past an opcode the CPU does not implement
+    TRAP,           // an instruction jumped or branched to itself
+    BREAKPOINT,     // PC reached a breakpoint, the instruction there has not run
+    EXIT,           // the program wrote to the exit address
+    BRK,            // a trapped BRK, PC is left on it
+};
+
+// Interpreter backends, the default is picked at build time with the
+// CPU6502_DISPATCH CMake option
+enum class Dispatch {
+    SWITCH,   // a single switch over the opcode
+    TABLE,    // indirect call through a 256 entry handler table
+    THREADED, // computed goto between inlined handlers, GCC and clang only
+    JIT,      // basic blocks translated to native code, x86-64 Linux builds
+              // with CPU6502_JIT, otherwise the default backend
+    DECODED,  // basic blocks decoded once into handler and operand records
+};
+
+// Instruction sets a CPU can be built with. Each gets its own handler
+// tables and interpreters, so the variant is never tested per instruction.
+enum class Variant : int {
+    NMOS,         // the documented NMOS 6502 instructions, anything else is invalid
+    NMOS_ILLEGAL, // plus the stable undocumented NMOS opcodes (LAX, SAX, DCP,
+                  // ISC, SLO, RLA, SRE, RRA, ANC, ALR, ARR, SBX and the NOPs)
+    CMOS_65C02,   // the 65C02, without the Rockwell and WDC bit instructions
+                  // or WAI and STP
+};
+
+// Interrupt inputs
+enum class Interrupt {
+    IRQ,
+    NMI,
+    RESET,
+};
+
+// Interrupts taken on one input, and the cycles from its line being raised
+// to the CPU starting to take it
+struct InterruptStats {
+    uint64_t taken;
+    uint64_t total_latency;
+    uint64_t max_latency;
+};
+
+struct RunResult {
+    StopReason reason;
+    uint64_t instructions; // instructions retired by this call
+    uint64_t cycles;       // cycles elapsed during this call
+};
+
 class CPU6502 {
     public:
-        CPU6502(std::shared_ptr<std::array<uint8_t, MEMORY_SIZE>> memory, uint16_t entry_point) : 
-            _memory{memory} 
+        // Each constructor maps the whole address space as RAM, pages can then
+        // be remapped to ROM or devices through bus(). Only the bus page table
+        // is used to reach memory so none of them cost anything per access.
+        //
+        // Shares memory with the caller and keeps it alive
+        CPU6502(std::shared_ptr<std::array<uint8_t, MEMORY_SIZE>> memory, uint16_t entry_point, Variant variant = Variant::NMOS) : 
+            _memory{memory}, _variant{variant}
         {
-            _PC.PC = entry_point;
+            map_memory(_memory->data(), entry_point);
+        };
+        // Borrows memory, the caller must keep it alive for the CPU's lifetime
+        CPU6502(std::span<uint8_t, MEMORY_SIZE> memory, uint16_t entry_point, Variant variant = Variant::NMOS) :
+            _variant{variant}
+        {
+            map_memory(memory.data(), entry_point);
+        };
+        // Owns a zeroed 64 KiB of its own
+        CPU6502(uint16_t entry_point, Variant variant = Variant::NMOS) :
+            _owned_memory{std::make_unique<std::array<uint8_t, MEMORY_SIZE>>()}, _variant{variant}
+        {
+            map_memory(_owned_memory->data(), entry_point);
         };
         bool execute_instruction();
+        // Executes up to max_instructions (or until max_cycles have elapsed) in
+        // a single loop, stopping early on an invalid opcode or when the
+        // program traps itself
+        RunResult run(uint64_t max_instructions);
+        RunResult run_cycles(uint64_t max_cycles);
+        RunResult run(uint64_t max_instructions, uint64_t max_cycles, Dispatch dispatch);
+        // The backend run() uses when none is given, chosen when configuring
+        static Dispatch default_dispatch();
         uint8_t A() { return _A; };
         uint8_t X() { return _X; };
         uint8_t Y() { return _Y; };
-        uint8_t P() { return _P; };
+        uint8_t P() { return status(); };
         uint16_t PC() { return _PC.PC; };
         uint8_t PCL() { return _PC.PCX[0]; };
         uint8_t PCH() { return _PC.PCX[1]; };
         uint8_t S() { return _S; };
+        Variant variant() { return _variant; };
+        // Captures registers, cycle count, interrupt lines and the CPU's
+        // RAM. Only pages dirtied since the last snapshot or restore are
+        // copied, and restoring only copies back the pages that differ.
+        // Pages the bus maps to ROM, I/O or anything but the CPU's own RAM
+        // are neither saved nor restored.
+        Snapshot snapshot();
+        void restore(const Snapshot& snapshot);
+#if defined(CPU6502_TRACE)
+        // Records every instruction executed from now on, nullptr stops
+        void set_trace(TraceWriter* trace) { _trace = trace; _trace_record = nullptr; };
+#endif
+#if defined(CPU6502_PROFILE)
+        // Counts every instruction executed from now on, nullptr stops
+        void set_profiler(Profiler* profiler) {
+            _profiler = profiler;
+            if (_profiler != nullptr) {
+                _profiler->start(_PC.PC, _cycles);
+            }
+        };
+#endif
+        // Interrupt lines, sampled before each instruction. IRQ is level
+        // triggered and masked by the I flag, NMI is taken once per rising
+        // edge and RESET once per call. Devices can drive them from their
+        // I/O handlers. Taking one costs 7 cycles but is not an instruction.
+        void set_irq(bool asserted);
+        void set_nmi(bool asserted);
+        void reset();
+        const InterruptStats& interrupt_stats(Interrupt input) { return _interrupt_stats[(int) input]; };
+        // Traps end a run with their own StopReason. Jumps and branches to
+        // self trap unless turned off, everything else is off until set.
+        // Breakpoints stop before the instruction at their PC and the next
+        // run carries on from it. A trapped BRK stops with PC left on it and
+        // nothing pushed. The exit address must be RAM, a write to it stops
+        // the run at the next instruction boundary.
+        void set_trap_self_loops(bool enabled) { _trap_self_loops = enabled; };
+        void set_trap_brk(bool enabled) { _trap_brk = enabled; };
+        void set_breakpoint(uint16_t PC, bool enabled = true);
+        void clear_breakpoints();
+        bool breakpoint(uint16_t PC) { return (_breakpoints[PC >> 6] >> (PC & 63)) & 1; };
+        bool set_exit_address(std::optional<uint16_t> addr);
+        uint64_t cycles() { return _cycles; };
+        Bus& bus() { return _bus; };
+        // View of the RAM the CPU was constructed with, valid while the CPU is
+        std::span<uint8_t, MEMORY_SIZE> memory() { return std::span<uint8_t, MEMORY_SIZE>(_ram, MEMORY_SIZE); };
     private:
         // Memory 
-        std::shared_ptr<std::array<uint8_t, MEMORY_SIZE>> _memory;
+        Bus _bus;
+        uint8_t* _ram = nullptr; // RAM backing the whole address space
+        std::shared_ptr<std::array<uint8_t, MEMORY_SIZE>> _memory; // Keeps shared RAM alive
+        std::unique_ptr<std::array<uint8_t, MEMORY_SIZE>> _owned_memory;
+        // Pages of the last snapshot taken or restored and the bus store
+        // generations at the time, RAM has moved on from a page once its
+        // generation has
+        std::array<std::shared_ptr<const Page>, PAGE_COUNT> _snapshot_pages;
+        std::array<uint32_t, PAGE_COUNT> _snapshot_generations{};
+        // Whether the bus maps page to the CPU's own RAM at that page
+        bool ram_mapped(uint8_t page) { return _bus.ram_page(page) == _ram + page * PAGE_SIZE; };
+        void map_memory(uint8_t* ram, uint16_t entry_point) {
+            _ram = ram;
+            _bus.map_ram(0x00, PAGE_COUNT, _ram);
+            _PC.PC = entry_point;
+        };
+        Variant _variant; // fixed at construction
+        uint8_t read(uint16_t addr) { return _bus.read(addr); };
+        void write(uint16_t addr, uint8_t value) { _bus.write(addr, value); };
         // Registers
         uint8_t _A = 0; // Accumulator
         uint8_t _X = 0; // Index register X
         uint8_t _Y = 0; // Index register Y
-        uint8_t _P = 0; // CPU Status register
+        uint8_t _P = 0; // CPU Status register, N and Z are kept lazily below
+        // N is bit 7 of the last result to set it and Z is set while the last
+        // result to set it is 0. Storing the results is cheaper than folding
+        // them into _P, which is only built when something reads the flags.
+        uint8_t _N_result = 0;
+        uint8_t _Z_result = 1;
+        uint8_t status() {
+            return (_P & ~(N_FLAG | Z_FLAG)) | (_N_result & N_FLAG) | (_Z_result == 0 ? Z_FLAG : 0);
+        };
+        void set_status(uint8_t P) {
+            _P = P;
+            _N_result = P;
+            _Z_result = ~P & Z_FLAG;
+            update_irq();
+        };
         union {
             uint8_t PCX[2];
             uint16_t PC;
         } _PC = {0}; // Program Counter
         uint8_t _S = 0x00; // Stack Pointer Register 
+        // Timing
+        uint64_t _cycles = 0; // Cycles elapsed since power on
+        uint8_t _page_crossed = 0; // Set by indexed addressing modes
+        // Interrupts
+        //
+        // Inputs waiting to be taken, so the run loops test a single word per
+        // instruction. IRQ is only in it while its line is asserted and the I
+        // flag is clear, anything changing either keeps it up to date.
+        static constexpr uint32_t IRQ_EVENT = 0x01;
+        static constexpr uint32_t NMI_EVENT = 0x02;
+        static constexpr uint32_t RESET_EVENT = 0x04;
+        uint32_t _events = 0;
+        bool _irq_line = false;
+        bool _nmi_line = false;
+        std::array<uint64_t, 3> _raised_at{}; // cycle each input was last raised
+        std::array<InterruptStats, 3> _interrupt_stats{};
+        void update_irq() {
+            _events = (_events & ~IRQ_EVENT) | ((_irq_line && !(_P & I_FLAG)) ? IRQ_EVENT : 0);
+        };
+        // Takes the highest priority pending interrupt
+        void take_interrupt();
+        // Traps
+        //
+        // They ride on the checks the run loops already make. An exit write
+        // raises EXIT_EVENT and BREAKPOINT_EVENT is held while any breakpoint
+        // is set, so breakpoints cost nothing until there are some. A
+        // trapped BRK leaves PC where it was like a jump to self.
+        static constexpr uint32_t INTERRUPT_EVENTS = IRQ_EVENT | NMI_EVENT | RESET_EVENT;
+        static constexpr uint32_t EXIT_EVENT = 0x08;
+        static constexpr uint32_t BREAKPOINT_EVENT = 0x10;
+        bool _trap_self_loops = true;
+        bool _trap_brk = false;
+        bool _brk_trapped = false;
+        std::optional<uint16_t> _resumed_from; // breakpoint last stopped on, skipped once if PC is still there
+        uint32_t _breakpoint_count = 0;
+        std::array<uint64_t, MEMORY_SIZE / 64> _breakpoints{};
+        // Handles _events before an instruction. True if the instruction
+        // has to wait, either for the run to stop with reason or because
+        // an interrupt was taken.
+        bool service_events(StopReason& reason);
+        // Why the run stops after an instruction left PC where it was,
+        // BUDGET if it carries on
+        StopReason self_trap();
+        void interrupt(uint16_t vector);
+#if defined(CPU6502_TRACE)
+        // Tracing
+        TraceWriter* _trace = nullptr;
+        TraceRecord* _trace_record = nullptr; // instruction being executed
+        void trace_instruction(uint16_t instruction_PC);
+#endif
+#if defined(CPU6502_PROFILE)
+        Profiler* _profiler = nullptr;
+#endif
+#if defined(CPU6502_JIT)
+        friend class JIT;
+        std::unique_ptr<JIT> _jit; // created by the first JIT run
+        bool use_jit();
+#endif
+        // Dispatch
+        //
+        // The tables and interpreters are built once per variant, run() picks
+        // the set matching the CPU's variant on entry
+        template <Variant V> static const std::array<uint8_t, 256> CYCLES;
+        static const std::array<uint8_t, 256>* cycle_table(Variant variant);
+        using Handler = void (CPU6502::*)();
+        template <Variant V> static const std::array<Handler, 256> HANDLERS;
+        template <Variant V> static const std::array<Handler, 256> DECODED_HANDLERS;
+        template <Variant V> static const std::array<bool, 256> WRITES_MEMORY;
+        template <auto Mode, auto Op> void addressed();
+        template <auto Op> void implied();
+        template <auto Op> void accumulator();
+        // Executes a single already fetched opcode, false if it is invalid
+        template <Variant V> bool dispatch(uint8_t opcode);
+        template <Variant V> RunResult run_variant(uint64_t max_instructions, uint64_t cycle_limit, Dispatch dispatch);
+        template <Variant V> RunResult run_switch(uint64_t max_instructions, uint64_t cycle_limit);
+        template <Variant V> RunResult run_table(uint64_t max_instructions, uint64_t cycle_limit);
+        template <Variant V> RunResult run_threaded(uint64_t max_instructions, uint64_t cycle_limit);
+        template <Variant V> RunResult run_decoded(uint64_t max_instructions, uint64_t cycle_limit);
+        // The switch interpreter for the CPU's variant, which the JIT falls
+        // back to for anything it does not translate
+        RunResult interpret(uint64_t max_instructions, uint64_t cycle_limit);
+        // Pre-decoded blocks, a run of records per block keyed by start PC
+        // and checked against the code generations of the pages it was read from
+        struct Decoded {
+            uint8_t opcode;   // picks the handler from DECODED_HANDLERS<V>
+            uint16_t operand; // the bytes after the opcode
+            uint8_t length;
+            uint8_t cycles;
+            bool writes_memory;
+        };
+        struct DecodedBlock {
+            uint32_t first; // index of its first record
+            uint32_t count; // 0 if the first instruction is left to the switch
+            uint32_t max_cycles; // if every branch is taken and every index crosses a page
+            uint8_t first_page;
+            uint8_t last_page;
+            uint32_t generations[2];
+        };
+        std::vector<Decoded> _decoded;
+        std::vector<DecodedBlock> _decoded_blocks;
+        std::vector<uint32_t> _decoded_block_at; // index into _decoded_blocks by PC
+        std::array<uint32_t, PAGE_COUNT> _decode_rewrites{}; // invalidations per page
+        uint16_t _operand = 0; // of the pre-decoded instruction being executed
+        template <Variant V> const DecodedBlock& decoded_block(uint16_t PC);
+        template <Variant V> void decoded_dispatch(uint8_t opcode);
+        template <Variant V> DecodedBlock decode(uint16_t PC);
         // Addressing Modes
         uint8_t imediate();
         uint16_t imediate_16();
-        uint8_t& absolute();
+        uint16_t absolute();
         uint16_t absolute_16();
-        uint8_t& absolute_X();
-        uint8_t& absolute_Y();
-        uint8_t& zeropage();
-        uint8_t& zeropage_X();
-        uint8_t& zeropage_Y();
-        uint8_t& zeropage_X_ptr();
-        uint8_t& zeropage_ptr_Y();
+        uint16_t absolute_X();
+        uint16_t absolute_Y();
+        uint16_t zeropage();
+        uint16_t zeropage_X();
+        uint16_t zeropage_Y();
+        uint16_t zeropage_X_ptr();
+        uint16_t zeropage_ptr_Y();
+        // 65C02 only
+        uint16_t absolute_ptr();
+        uint16_t absolute_X_ptr();
+        uint16_t absolute_X_shift();
+        uint16_t zeropage_ptr();
+        uint8_t decoded_imediate();
+        uint16_t decoded_imediate_16();
+        uint16_t decoded_absolute();
+        uint16_t decoded_absolute_16();
+        uint16_t decoded_absolute_X();
+        uint16_t decoded_absolute_Y();
+        uint16_t decoded_zeropage();
+        uint16_t decoded_zeropage_X();
+        uint16_t decoded_zeropage_Y();
+        uint16_t decoded_zeropage_X_ptr();
+        uint16_t decoded_zeropage_ptr_Y();
+        uint16_t decoded_absolute_ptr();
+        uint16_t decoded_absolute_X_ptr();
+        uint16_t decoded_absolute_X_shift();
+        uint16_t decoded_zeropage_ptr();
+        // Branching
+        void branch(bool taken, uint8_t offset);
         // Flag Manipulation
-        void set_flags(uint8_t value, uint8_t mask);
+        void set_NZ(uint8_t value) { _N_result = value; _Z_result = value; };
         // Opcodes
         void ADC(uint8_t value);
         void AND(uint8_t value);
-        void ASL(uint8_t& value);
+        uint8_t ASL(uint8_t value);
         void BIT(uint8_t value);
         void BPL(uint8_t value);
         void BMI(uint8_t value);
@@ -66,7 +373,7 @@ class CPU6502 {
         void CMP(uint8_t value);
         void CPX(uint8_t value);
         void CPY(uint8_t value);
-        void DEC(uint8_t& value);
+        uint8_t DEC(uint8_t value);
         void EOR(uint8_t value);
         void CLC();
         void SEC();
@@ -75,13 +382,13 @@ class CPU6502 {
         void CLV();
         void CLD();
         void SED();
-        void INC(uint8_t& value);
+        uint8_t INC(uint8_t value);
         void JMP(uint16_t value);
         void JSR(uint16_t value);
         void LDA(uint8_t value);
         void LDX(uint8_t value);
         void LDY(uint8_t value);
-        void LSR(uint8_t& value);
+        uint8_t LSR(uint8_t value);
         void NOP();
         void ORA(uint8_t value);
         void TAX();
@@ -92,18 +399,45 @@ class CPU6502 {
         void TYA();
         void DEY();
         void INY();
-        void ROL(uint8_t& value);
-        void ROR(uint8_t& value);
+        uint8_t ROL(uint8_t value);
+        uint8_t ROR(uint8_t value);
         void RTI();
         void RTS();
         void SBC(uint8_t value);
-        void STA(uint8_t& value);
-        void STX(uint8_t& value);
-        void STY(uint8_t& value);
+        // ADC and SBC with D set, NMOS or 65C02 flags included
+        void ADC_decimal(uint8_t value);
+        void SBC_decimal(uint8_t value);
+        void STA(uint16_t addr);
+        void STX(uint16_t addr);
+        void STY(uint16_t addr);
         void TXS();
         void TSX();
         void PHA();
         void PLA();
         void PHP();
         void PLP();
+        // Undocumented NMOS opcodes
+        void ALR(uint8_t value);
+        void ANC(uint8_t value);
+        void ARR(uint8_t value);
+        uint8_t DCP(uint8_t value);
+        void IGN(uint8_t value); // the NOPs that read an operand
+        uint8_t ISC(uint8_t value);
+        void LAX(uint8_t value);
+        uint8_t RLA(uint8_t value);
+        uint8_t RRA(uint8_t value);
+        void SAX(uint16_t addr);
+        void SBX(uint8_t value);
+        uint8_t SLO(uint8_t value);
+        uint8_t SRE(uint8_t value);
+        // 65C02 additions
+        void BIT_imediate(uint8_t value);
+        void BRA(uint8_t value);
+        void PHX();
+        void PHY();
+        void PLX();
+        void PLY();
+        void STZ(uint16_t addr);
+        uint8_t TRB(uint8_t value);
+        uint8_t TSB(uint8_t value);
 };
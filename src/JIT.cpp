@@ -0,0 +1,991 @@
+#include "CPU6502.h"
+#include "OpcodeMap.h"
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <string_view>
+#include <functional>
+#include <initializer_list>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if defined(CPU6502_JIT)
+
+constexpr size_t CODE_SIZE = 8 << 20;
+// Space a single block can need, checked before translating so the buffer
+// never overflows mid block
+constexpr size_t MAX_BLOCK_CODE = 32 << 10;
+constexpr uint32_t MAX_BLOCK_INSTRUCTIONS = 32;
+// Pages whose translations are thrown away more often than this are left
+// to the interpreter until the next flush
+constexpr uint32_t REWRITE_LIMIT = 64;
+constexpr uint32_t NO_BLOCK = UINT32_MAX;
+
+namespace {
+
+// Decoding
+
+enum class Op : uint8_t {
+    NONE, // left to the interpreter
+    ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BVC, BVS, CLC, CLD, CLI,
+    CLV, CMP, CPX, CPY, DEC, DEX, DEY, EOR, INC, INX, INY, JMP, JSR, LDA, LDX,
+    LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL, ROR, RTS, SBC, SEC, SED, SEI,
+    STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA,
+};
+
+enum class Mode : uint8_t {
+    IMPLIED, ACCUMULATOR, IMMEDIATE, RELATIVE, ZEROPAGE, ZEROPAGE_X, ZEROPAGE_Y,
+    ABSOLUTE, ABSOLUTE_X, ABSOLUTE_Y, ZEROPAGE_X_PTR, ZEROPAGE_PTR_Y,
+};
+
+struct Decoded {
+    Op op;
+    Mode mode;
+};
+
+// Op's names as the opcode maps spell them
+constexpr std::string_view OP_NAMES[] = {
+    "", "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL", "BVC", "BVS", "CLC", "CLD", "CLI",
+    "CLV", "CMP", "CPX", "CPY", "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR", "LDA", "LDX",
+    "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL", "ROR", "RTS", "SBC", "SEC", "SED", "SEI",
+    "STA", "STX", "STY", "TAX", "TAY", "TSX", "TXA", "TXS", "TYA",
+};
+static_assert(std::size(OP_NAMES) == (size_t) Op::TYA + 1);
+
+// Translates the interpreter's names for an opcode's mode and operation,
+// anything without code here is left to the interpreter
+constexpr Decoded decode(std::string_view mode, std::string_view name) {
+    Op op = Op::NONE;
+    for (size_t i = 1; i < std::size(OP_NAMES); i++) {
+        if (OP_NAMES[i] == name) {
+            op = (Op) i;
+        }
+    }
+    bool branch = op >= Op::BCC && op <= Op::BVS && op != Op::BIT;
+    constexpr std::pair<std::string_view, Mode> MODES[] = {
+        {"implied", Mode::IMPLIED}, {"accumulator", Mode::ACCUMULATOR}, {"imediate", Mode::IMMEDIATE},
+        {"imediate_16", Mode::ABSOLUTE}, {"zeropage", Mode::ZEROPAGE}, {"zeropage_X", Mode::ZEROPAGE_X},
+        {"zeropage_Y", Mode::ZEROPAGE_Y}, {"absolute", Mode::ABSOLUTE}, {"absolute_X", Mode::ABSOLUTE_X},
+        {"absolute_Y", Mode::ABSOLUTE_Y}, {"zeropage_X_ptr", Mode::ZEROPAGE_X_PTR},
+        {"zeropage_ptr_Y", Mode::ZEROPAGE_PTR_Y},
+    };
+    for (auto [mode_name, decoded_mode] : MODES) {
+        if (mode_name == mode) {
+            return {op, branch ? Mode::RELATIVE : decoded_mode};
+        }
+    }
+    return {Op::NONE, Mode::IMPLIED};
+}
+
+#define DECODE_ADDRESSED(n, mode, op) table[n] = decode(#mode, #op);
+#define DECODE_IMPLIED(n, op) table[n] = decode("implied", #op);
+#define DECODE_ACCUMULATOR(n, op) table[n] = decode("accumulator", #op);
+
+// The variant's opcode map, BRK, RTI, JMP indirect and anything else the
+// translator has no code for decode as Op::NONE
+template <Variant V>
+constexpr std::array<Decoded, 256> DECODE = [] {
+    std::array<Decoded, 256> table{};
+    VARIANT_MAP(V, DECODE_ADDRESSED, DECODE_IMPLIED, DECODE_ACCUMULATOR)
+    return table;
+}();
+
+uint8_t operand_length(Mode mode) {
+    switch (mode) {
+        case Mode::IMPLIED:
+        case Mode::ACCUMULATOR:
+            return 0;
+        case Mode::ABSOLUTE:
+        case Mode::ABSOLUTE_X:
+        case Mode::ABSOLUTE_Y:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+bool is_branch(Op op) {
+    return op >= Op::BCC && op <= Op::BVS && op != Op::BIT;
+}
+
+// Operations that read their operand, the indexed ones pay for page crossings
+bool reads_operand(Op op) {
+    switch (op) {
+        case Op::ADC: case Op::AND: case Op::BIT: case Op::CMP: case Op::CPX:
+        case Op::CPY: case Op::EOR: case Op::LDA: case Op::LDX: case Op::LDY:
+        case Op::ORA: case Op::SBC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool is_read_modify_write(Op op) {
+    switch (op) {
+        case Op::ASL: case Op::LSR: case Op::ROL: case Op::ROR: case Op::INC: case Op::DEC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+struct Instruction {
+    uint16_t PC;
+    uint8_t opcode;
+    Op op;
+    Mode mode;
+    uint16_t operand;
+};
+
+// x86-64 encoding
+
+enum Reg : uint8_t {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15,
+    NO_REG = 0xFF,
+};
+
+// Guest registers are pinned to callee saved host registers for the whole
+// block, so calls out to the bus leave them alone
+constexpr Reg A_REG = R12;
+constexpr Reg X_REG = R13;
+constexpr Reg Y_REG = R14;
+constexpr Reg P_REG = R15;
+constexpr Reg S_REG = RBX;
+constexpr Reg CPU_REG = RBP;
+
+enum Cond : uint8_t {
+    OVERFLOW = 0x0,
+    CARRY = 0x2,
+    NO_CARRY = 0x3,
+    ZERO = 0x4,
+    NOT_ZERO = 0x5,
+};
+
+// Group opcode extensions
+enum Ext : uint8_t {
+    ADD = 0, OR = 1, AND = 4, SUB = 5, CMP = 7,                 // 0x81 / 0x83
+    ROL = 0, ROR = 1, RCL = 2, RCR = 3, SHL = 4, SHR = 5,       // 0xC1 / 0xD0
+};
+
+struct Mem {
+    Reg base;
+    Reg index;
+    uint8_t scale; // log2 of the index multiplier
+    int32_t disp;
+};
+
+Mem at(Reg base, int32_t disp = 0) {
+    return {base, NO_REG, 0, disp};
+}
+
+Mem at(Reg base, Reg index, uint8_t scale, int32_t disp = 0) {
+    return {base, index, scale, disp};
+}
+
+class Emitter {
+    public:
+        Emitter(uint8_t* start) : _at{start} {};
+        uint8_t* here() { return _at; };
+        void byte(uint8_t value) { *_at++ = value; };
+        void u16(uint16_t value) { std::memcpy(_at, &value, 2); _at += 2; };
+        void u32(uint32_t value) { std::memcpy(_at, &value, 4); _at += 4; };
+        void u64(uint64_t value) { std::memcpy(_at, &value, 8); _at += 8; };
+        // reg, rm register to register forms, byte_regs when the operands
+        // are 8 bit so SPL to DIL get the REX prefix they need
+        void rr(std::initializer_list<uint8_t> opcode, bool wide, int reg, int rm, bool byte_regs = false) {
+            bool low_byte = byte_regs && ((reg >= 4 && reg < 8) || (rm >= 4 && rm < 8));
+            rex(wide, reg, 0, rm, low_byte);
+            for (uint8_t op : opcode) {
+                byte(op);
+            }
+            byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+        };
+        void rm(std::initializer_list<uint8_t> opcode, bool wide, int reg, Mem mem, bool byte_reg = false) {
+            rex(wide, reg, mem.index == NO_REG ? 0 : mem.index, mem.base, byte_reg && reg >= 4 && reg < 8);
+            for (uint8_t op : opcode) {
+                byte(op);
+            }
+            uint8_t mod = (mem.disp == 0 && (mem.base & 7) != 5) ? 0
+                : (mem.disp >= -128 && mem.disp <= 127) ? 1 : 2;
+            if (mem.index != NO_REG || (mem.base & 7) == 4) {
+                byte(mod << 6 | (reg & 7) << 3 | 4);
+                byte(mem.scale << 6 | ((mem.index == NO_REG ? 4 : mem.index) & 7) << 3 | (mem.base & 7));
+            }
+            else {
+                byte(mod << 6 | (reg & 7) << 3 | (mem.base & 7));
+            }
+            if (mod == 1) {
+                byte(mem.disp);
+            }
+            else if (mod == 2) {
+                u32(mem.disp);
+            }
+        };
+        void mov(Reg dst, Reg src) { rr({0x89}, false, src, dst); };
+        void mov(Reg dst, uint32_t imm) { rex(false, 0, 0, dst, false); byte(0xB8 + (dst & 7)); u32(imm); };
+        void mov64(Reg dst, uint64_t imm) { rex(true, 0, 0, dst, false); byte(0xB8 + (dst & 7)); u64(imm); };
+        void mov64(Reg dst, Mem src) { rm({0x8B}, true, dst, src); };
+        void load32(Reg dst, Mem src) { rm({0x8B}, false, dst, src); };
+        void store32(Mem dst, Reg src) { rm({0x89}, false, src, dst); };
+        void store8(Mem dst, Reg src) { rm({0x88}, false, src, dst, true); };
+        void store16(Mem dst, Reg src) { byte(0x66); rm({0x89}, false, src, dst); };
+        void store16(Mem dst, uint16_t imm) { byte(0x66); rm({0xC7}, false, 0, dst); u16(imm); };
+        void movzx8(Reg dst, Reg src) { rr({0x0F, 0xB6}, false, dst, src, true); };
+        void movzx8(Reg dst, Mem src) { rm({0x0F, 0xB6}, false, dst, src); };
+        void movzx16(Reg dst, Reg src) { rr({0x0F, 0xB7}, false, dst, src); };
+        void lea(Reg dst, Mem src) { rm({0x8D}, false, dst, src); };
+        void lea_rip(Reg dst, const uint8_t* target) {
+            rex(true, dst, 0, 0, false);
+            byte(0x8D);
+            byte((dst & 7) << 3 | 5);
+            u32(target - (_at + 4));
+        };
+        // 32 bit ALU, opcode is the r/m, reg form (0x01 ADD, 0x09 OR, 0x21 AND,
+        // 0x29 SUB, 0x85 TEST)
+        void alu(uint8_t opcode, Reg dst, Reg src) { rr({opcode}, false, src, dst); };
+        // 8 bit ALU (0x08 OR, 0x10 ADC, 0x18 SBB, 0x28 SUB)
+        void alu8(uint8_t opcode, Reg dst, Reg src) { rr({opcode}, false, src, dst, true); };
+        void alu(Ext ext, Reg dst, int32_t imm) {
+            if (imm >= -128 && imm <= 127) {
+                rr({0x83}, false, ext, dst);
+                byte(imm);
+            }
+            else {
+                rr({0x81}, false, ext, dst);
+                u32(imm);
+            }
+        };
+        void add64(Mem dst, Reg src) { rm({0x01}, true, src, dst); };
+        void add64(Mem dst, int32_t imm) {
+            if (imm >= -128 && imm <= 127) {
+                rm({0x83}, true, ADD, dst);
+                byte(imm);
+            }
+            else {
+                rm({0x81}, true, ADD, dst);
+                u32(imm);
+            }
+        };
+        void or8(Reg dst, Mem src) { rm({0x0A}, false, dst, src, true); };
+        void or32(Reg dst, Mem src) { rm({0x0B}, false, dst, src); };
+        void test(Reg reg, uint32_t imm) { rr({0xF7}, false, 0, reg); u32(imm); };
+        void test64(Reg a, Reg b) { rr({0x85}, true, b, a); };
+        void shift8(Ext ext, Reg reg) { rr({0xD0}, false, ext, reg, true); };
+        void shift(Ext ext, Reg reg, uint8_t count) { rr({0xC1}, false, ext, reg); byte(count); };
+        void inc8(Reg reg) { rr({0xFE}, false, 0, reg, true); };
+        void dec8(Reg reg) { rr({0xFE}, false, 1, reg, true); };
+        void setcc(Cond cond, Reg reg) { rr({0x0F, (uint8_t) (0x90 + cond)}, false, 0, reg, true); };
+        void bt(Reg reg, uint8_t bit) { rr({0x0F, 0xBA}, false, 4, reg); byte(bit); };
+        void bts64(Mem dst, Reg bit) { rm({0x0F, 0xAB}, true, bit, dst); };
+        void bts64(Mem dst, uint8_t bit) { rm({0x0F, 0xBA}, true, 5, dst); byte(bit); };
+        void cmc() { byte(0xF5); };
+        void push(Reg reg) { rex(false, 0, 0, reg, false); byte(0x50 + (reg & 7)); };
+        void pop(Reg reg) { rex(false, 0, 0, reg, false); byte(0x58 + (reg & 7)); };
+        void call(const void* target) { mov64(RAX, (uint64_t) target); rr({0xFF}, false, 2, RAX); };
+        void ret() { byte(0xC3); };
+        // Forward jumps return where their rel32 is, for bind()
+        uint8_t* jcc(Cond cond) { byte(0x0F); byte(0x80 + cond); u32(0); return _at - 4; };
+        uint8_t* jmp() { byte(0xE9); u32(0); return _at - 4; };
+        void jmp(const uint8_t* target) { bind(jmp(), target); };
+        void bind(uint8_t* rel32) { bind(rel32, _at); };
+        void bind(uint8_t* rel32, const uint8_t* target) {
+            int32_t offset = target - (rel32 + 4);
+            std::memcpy(rel32, &offset, 4);
+        };
+    private:
+        uint8_t* _at;
+        void rex(bool wide, int reg, int index, int base, bool force) {
+            uint8_t prefix = 0x40 | wide << 3 | ((reg >> 3) & 1) << 2 | ((index >> 3) & 1) << 1 | ((base >> 3) & 1);
+            if (prefix != 0x40 || force) {
+                byte(prefix);
+            }
+        };
+};
+
+// Where the generated code finds the CPU's state, as offsets from the CPU
+struct Layout {
+    int32_t A;
+    int32_t X;
+    int32_t Y;
+    int32_t P;
+    int32_t S;
+    int32_t PC;
+    int32_t cycles;
+    int32_t read_pages;
+    int32_t write_pages;
+    int32_t dirty;
+    const void* read_slow;
+    const void* write_slow;
+    const uint8_t* nz_table; // N and Z flags of every byte value
+    const std::array<uint8_t, 256>* cycle_table;
+};
+
+// A guest address, either known at translation time or computed into ESI
+struct Address {
+    bool constant;
+    uint16_t value;
+};
+
+// Emits one block
+class Translator {
+    public:
+        Translator(const Layout& layout, uint8_t* start) : _layout{layout}, _emit{start} {};
+        uint8_t* end() { return _emit.here(); };
+        void block(const std::vector<Instruction>& instructions, uint16_t end_PC);
+    private:
+        // Where a block leaves, either to a known PC or the one in ECX
+        struct Exit {
+            std::vector<uint8_t*> jumps;
+            bool dynamic_PC;
+            uint16_t PC;
+            uint32_t cycles;
+            uint32_t instructions;
+        };
+        const Layout& _layout;
+        Emitter _emit;
+        std::vector<Exit> _exits;
+        // Slow paths, emitted after the block so the fast paths fall through
+        std::vector<std::function<void()>> _slow_paths;
+        uint32_t _cycles = 0;       // static cycles up to and including the instruction
+        uint32_t _instructions = 0; // up to and including the instruction
+        uint16_t _next_PC = 0;
+        Mem cpu(int32_t offset) { return at(CPU_REG, offset); };
+        size_t exit(uint16_t PC, uint32_t extra_cycles = 0);
+        void instruction(const Instruction& instruction);
+        Address address(const Instruction& instruction);
+        void read(Address address);
+        void write(Address address, bool exit_if_code);
+        void push(Reg value, bool exit_if_code);
+        void pull();
+        void set_nz(Reg value);
+        void or_nz(Reg value);
+        void set_c(Cond carry, uint8_t keep);
+        void add_carry_cycle(Reg low, Reg index);
+};
+
+size_t Translator::exit(uint16_t PC, uint32_t extra_cycles) {
+    _exits.push_back({{}, false, PC, _cycles + extra_cycles, _instructions});
+    return _exits.size() - 1;
+}
+
+// P = P & ~(N | Z) | NZ[value]
+void Translator::set_nz(Reg value) {
+    _emit.alu(AND, P_REG, 0x7D);
+    or_nz(value);
+}
+
+void Translator::or_nz(Reg value) {
+    _emit.lea_rip(R8, _layout.nz_table);
+    _emit.or8(P_REG, at(R8, value, 0));
+}
+
+// C from the host carry, clearing the other P bits not in keep
+void Translator::set_c(Cond carry, uint8_t keep) {
+    _emit.setcc(carry, RCX);
+    _emit.movzx8(RCX, RCX);
+    _emit.alu(AND, P_REG, keep);
+    _emit.alu(0x09, P_REG, RCX);
+}
+
+// cycles += (low + index) >> 8, the extra cycle of an indexed read
+void Translator::add_carry_cycle(Reg low, Reg index) {
+    _emit.lea(RCX, at(low, index, 0));
+    _emit.shift(SHR, RCX, 8);
+    _emit.add64(cpu(_layout.cycles), RCX);
+}
+
+Address Translator::address(const Instruction& in) {
+    bool penalty = reads_operand(in.op);
+    switch (in.mode) {
+        case Mode::ZEROPAGE:
+        case Mode::ABSOLUTE:
+            return {true, in.operand};
+        case Mode::ZEROPAGE_X:
+        case Mode::ZEROPAGE_Y:
+            _emit.lea(RSI, at(in.mode == Mode::ZEROPAGE_X ? X_REG : Y_REG, in.operand));
+            _emit.movzx8(RSI, RSI);
+            return {false, 0};
+        case Mode::ABSOLUTE_X:
+        case Mode::ABSOLUTE_Y: {
+            Reg index = in.mode == Mode::ABSOLUTE_X ? X_REG : Y_REG;
+            if (penalty) {
+                _emit.mov(RDX, (uint32_t) (in.operand & 0xFF));
+                add_carry_cycle(RDX, index);
+            }
+            _emit.lea(RSI, at(index, in.operand));
+            _emit.movzx16(RSI, RSI);
+            return {false, 0};
+        }
+        case Mode::ZEROPAGE_X_PTR:
+            // the pointer's high byte wraps around the zero page
+            _emit.lea(RSI, at(X_REG, in.operand));
+            _emit.movzx8(RSI, RSI);
+            _emit.store32(at(RSP, 4), RSI);
+            read({false, 0});
+            _emit.store32(at(RSP), RAX);
+            _emit.load32(RSI, at(RSP, 4));
+            _emit.alu(ADD, RSI, 1);
+            _emit.movzx8(RSI, RSI);
+            read({false, 0});
+            _emit.shift(SHL, RAX, 8);
+            _emit.or32(RAX, at(RSP));
+            _emit.mov(RSI, RAX);
+            return {false, 0};
+        case Mode::ZEROPAGE_PTR_Y:
+            read({true, in.operand});
+            _emit.store32(at(RSP), RAX);
+            read({true, (uint8_t) (in.operand + 1)});
+            _emit.shift(SHL, RAX, 8);
+            _emit.or32(RAX, at(RSP));
+            _emit.lea(RSI, at(RAX, Y_REG, 0));
+            _emit.movzx16(RSI, RSI);
+            if (penalty) {
+                _emit.load32(RDX, at(RSP));
+                add_carry_cycle(RDX, Y_REG);
+            }
+            return {false, 0};
+        default:
+            return {true, 0};
+    }
+}
+
+// EAX = the byte at address, the page table is used inline and only I/O
+// pages call out
+void Translator::read(Address address) {
+    uint8_t* slow;
+    if (address.constant) {
+        _emit.mov64(RDX, cpu(_layout.read_pages + (address.value >> 8) * 8));
+        _emit.test64(RDX, RDX);
+        slow = _emit.jcc(ZERO);
+        _emit.movzx8(RAX, at(RDX, address.value & 0xFF));
+    }
+    else {
+        _emit.mov(RCX, RSI);
+        _emit.shift(SHR, RCX, 8);
+        _emit.mov64(RDX, at(CPU_REG, RCX, 3, _layout.read_pages));
+        _emit.test64(RDX, RDX);
+        slow = _emit.jcc(ZERO);
+        _emit.movzx8(RAX, RSI);
+        _emit.movzx8(RAX, at(RDX, RAX, 0));
+    }
+    uint8_t* done = _emit.here();
+    int32_t cycles = _cycles;
+    _slow_paths.push_back([this, address, slow, done, cycles] {
+        _emit.bind(slow);
+        if (address.constant) {
+            _emit.mov(RSI, (uint32_t) address.value);
+        }
+        _emit.rr({0x89}, true, CPU_REG, RDI);
+        // devices see the cycle counter as the interpreter would have it
+        _emit.add64(cpu(_layout.cycles), cycles);
+        _emit.call(_layout.read_slow);
+        _emit.add64(cpu(_layout.cycles), -cycles);
+        _emit.jmp(done);
+    });
+}
+
+// Writes EDX to address. Writes to pages holding translated code call out,
+// and unless the instruction has more to do the block then ends after it.
+void Translator::write(Address address, bool exit_if_code) {
+    uint8_t* slow;
+    if (address.constant) {
+        uint8_t page = address.value >> 8;
+        _emit.mov64(RAX, cpu(_layout.write_pages + page * 8));
+        _emit.test64(RAX, RAX);
+        slow = _emit.jcc(ZERO);
+        _emit.store8(at(RAX, address.value & 0xFF), RDX);
+        _emit.bts64(cpu(_layout.dirty + (page >> 6) * 8), (uint8_t) (page & 63));
+    }
+    else {
+        _emit.mov(RCX, RSI);
+        _emit.shift(SHR, RCX, 8);
+        _emit.mov64(RAX, at(CPU_REG, RCX, 3, _layout.write_pages));
+        _emit.test64(RAX, RAX);
+        slow = _emit.jcc(ZERO);
+        _emit.movzx8(RDI, RSI);
+        _emit.store8(at(RAX, RDI, 0), RDX);
+        _emit.bts64(cpu(_layout.dirty), RCX);
+    }
+    uint8_t* done = _emit.here();
+    size_t code_written = exit_if_code ? exit(_next_PC) : SIZE_MAX;
+    int32_t cycles = _cycles;
+    _slow_paths.push_back([this, address, slow, done, code_written, cycles] {
+        _emit.bind(slow);
+        if (address.constant) {
+            _emit.mov(RSI, (uint32_t) address.value);
+        }
+        _emit.rr({0x89}, true, CPU_REG, RDI);
+        _emit.add64(cpu(_layout.cycles), cycles);
+        _emit.call(_layout.write_slow);
+        _emit.add64(cpu(_layout.cycles), -cycles);
+        if (code_written != SIZE_MAX) {
+            _emit.alu(0x85, RAX, RAX);
+            _exits[code_written].jumps.push_back(_emit.jcc(NOT_ZERO));
+        }
+        _emit.jmp(done);
+    });
+}
+
+void Translator::push(Reg value, bool exit_if_code) {
+    _emit.mov(RDX, value);
+    _emit.mov(RSI, S_REG);
+    _emit.alu(OR, RSI, 0x100);
+    _emit.dec8(S_REG);
+    write({false, 0}, exit_if_code);
+}
+
+void Translator::pull() {
+    _emit.inc8(S_REG);
+    _emit.mov(RSI, S_REG);
+    _emit.alu(OR, RSI, 0x100);
+    read({false, 0});
+}
+
+void Translator::instruction(const Instruction& in) {
+    Address addr = address(in);
+    // Operand into EAX for everything that reads one
+    if (reads_operand(in.op) || (is_read_modify_write(in.op) && in.mode != Mode::ACCUMULATOR)) {
+        if (in.mode == Mode::IMMEDIATE) {
+            _emit.mov(RAX, (uint32_t) in.operand);
+        }
+        else {
+            if (!addr.constant && is_read_modify_write(in.op)) {
+                _emit.store32(at(RSP, 4), RSI);
+            }
+            read(addr);
+        }
+    }
+    else if (in.mode == Mode::ACCUMULATOR) {
+        _emit.mov(RAX, A_REG);
+    }
+
+    switch (in.op) {
+        case Op::LDA: _emit.mov(A_REG, RAX); set_nz(A_REG); break;
+        case Op::LDX: _emit.mov(X_REG, RAX); set_nz(X_REG); break;
+        case Op::LDY: _emit.mov(Y_REG, RAX); set_nz(Y_REG); break;
+        case Op::AND: _emit.alu(0x21, A_REG, RAX); set_nz(A_REG); break;
+        case Op::ORA: _emit.alu(0x09, A_REG, RAX); set_nz(A_REG); break;
+        case Op::EOR: _emit.alu(0x31, A_REG, RAX); set_nz(A_REG); break;
+        case Op::ADC:
+        case Op::SBC:
+            // the host carry and overflow match the 6502's once the borrow
+            // is inverted either side of SBB
+            _emit.bt(P_REG, 0);
+            if (in.op == Op::SBC) {
+                _emit.cmc();
+                _emit.alu8(0x18, A_REG, RAX);
+            }
+            else {
+                _emit.alu8(0x10, A_REG, RAX);
+            }
+            _emit.setcc(in.op == Op::SBC ? NO_CARRY : CARRY, RCX);
+            _emit.setcc(OVERFLOW, RDX);
+            _emit.movzx8(RCX, RCX);
+            _emit.movzx8(RDX, RDX);
+            _emit.shift(SHL, RDX, 6);
+            _emit.alu(0x09, RCX, RDX);
+            _emit.alu(AND, P_REG, 0x3C);
+            _emit.alu(0x09, P_REG, RCX);
+            or_nz(A_REG);
+            break;
+        case Op::CMP:
+        case Op::CPX:
+        case Op::CPY:
+            _emit.mov(RDX, in.op == Op::CMP ? A_REG : in.op == Op::CPX ? X_REG : Y_REG);
+            _emit.alu8(0x28, RDX, RAX);
+            set_c(NO_CARRY, 0x7C);
+            or_nz(RDX);
+            break;
+        case Op::BIT:
+            _emit.alu(AND, P_REG, 0x3D);
+            _emit.mov(RCX, RAX);
+            _emit.alu(AND, RCX, 0xC0);
+            _emit.alu(0x09, P_REG, RCX);
+            _emit.alu(0x85, A_REG, RAX);
+            _emit.setcc(ZERO, RCX);
+            _emit.movzx8(RCX, RCX);
+            _emit.alu(0x01, RCX, RCX);
+            _emit.alu(0x09, P_REG, RCX);
+            break;
+        case Op::ASL:
+        case Op::LSR:
+        case Op::ROL:
+        case Op::ROR:
+            if (in.op == Op::ROL || in.op == Op::ROR) {
+                _emit.bt(P_REG, 0);
+            }
+            _emit.shift8(in.op == Op::ASL ? SHL : in.op == Op::LSR ? SHR : in.op == Op::ROL ? RCL : RCR, RAX);
+            set_c(CARRY, 0x7C);
+            or_nz(RAX);
+            break;
+        case Op::INC: _emit.inc8(RAX); set_nz(RAX); break;
+        case Op::DEC: _emit.dec8(RAX); set_nz(RAX); break;
+        case Op::INX: _emit.inc8(X_REG); set_nz(X_REG); break;
+        case Op::INY: _emit.inc8(Y_REG); set_nz(Y_REG); break;
+        case Op::DEX: _emit.dec8(X_REG); set_nz(X_REG); break;
+        case Op::DEY: _emit.dec8(Y_REG); set_nz(Y_REG); break;
+        case Op::TAX: _emit.mov(X_REG, A_REG); set_nz(X_REG); break;
+        case Op::TAY: _emit.mov(Y_REG, A_REG); set_nz(Y_REG); break;
+        case Op::TXA: _emit.mov(A_REG, X_REG); set_nz(A_REG); break;
+        case Op::TYA: _emit.mov(A_REG, Y_REG); set_nz(A_REG); break;
+        case Op::TSX: _emit.mov(X_REG, S_REG); set_nz(X_REG); break;
+        case Op::TXS: _emit.mov(S_REG, X_REG); break;
+        case Op::CLC: _emit.alu(AND, P_REG, 0xFE); break;
+        case Op::SEC: _emit.alu(OR, P_REG, 0x01); break;
+        case Op::CLI: _emit.alu(AND, P_REG, 0xFB); break;
+        case Op::SEI: _emit.alu(OR, P_REG, 0x04); break;
+        case Op::CLD: _emit.alu(AND, P_REG, 0xF7); break;
+        case Op::SED: _emit.alu(OR, P_REG, 0x08); break;
+        case Op::CLV: _emit.alu(AND, P_REG, 0xBF); break;
+        case Op::NOP: break;
+        case Op::STA: _emit.mov(RDX, A_REG); write(addr, true); break;
+        case Op::STX: _emit.mov(RDX, X_REG); write(addr, true); break;
+        case Op::STY: _emit.mov(RDX, Y_REG); write(addr, true); break;
+        case Op::PHA: push(A_REG, true); break;
+        case Op::PHP:
+            _emit.mov(RAX, P_REG);
+            _emit.alu(OR, RAX, 0x30);
+            push(RAX, true);
+            break;
+        case Op::PLA: pull(); _emit.mov(A_REG, RAX); set_nz(A_REG); break;
+        case Op::PLP: pull(); _emit.mov(P_REG, RAX); break;
+        case Op::JSR: {
+            // pushes the address of its own last byte, which RTS adds one to
+            uint16_t return_address = _next_PC - 1;
+            _emit.mov(RAX, (uint32_t) (return_address >> 8));
+            push(RAX, false);
+            _emit.mov(RAX, (uint32_t) (return_address & 0xFF));
+            push(RAX, false);
+            _exits[exit(in.operand)].jumps.push_back(_emit.jmp());
+            break;
+        }
+        case Op::RTS:
+            pull();
+            _emit.store32(at(RSP), RAX);
+            pull();
+            _emit.shift(SHL, RAX, 8);
+            _emit.or32(RAX, at(RSP));
+            _emit.alu(ADD, RAX, 1);
+            _emit.movzx16(RCX, RAX);
+            _exits.push_back({{_emit.jmp()}, true, 0, _cycles, _instructions});
+            break;
+        case Op::JMP:
+            _exits[exit(in.operand)].jumps.push_back(_emit.jmp());
+            break;
+        case Op::BPL: case Op::BMI: case Op::BVC: case Op::BVS:
+        case Op::BCC: case Op::BCS: case Op::BNE: case Op::BEQ: {
+            uint8_t flag = (in.op == Op::BPL || in.op == Op::BMI) ? 0x80
+                : (in.op == Op::BVC || in.op == Op::BVS) ? 0x40
+                : (in.op == Op::BCC || in.op == Op::BCS) ? 0x01 : 0x02;
+            bool taken_if_set = in.op == Op::BMI || in.op == Op::BVS || in.op == Op::BCS || in.op == Op::BEQ;
+            uint16_t target = _next_PC + (int8_t) in.operand;
+            uint32_t extra = 1 + ((target ^ _next_PC) > 0xFF);
+            _emit.test(P_REG, flag);
+            _exits[exit(target, extra)].jumps.push_back(_emit.jcc(taken_if_set ? NOT_ZERO : ZERO));
+            break;
+        }
+        case Op::NONE:
+            break;
+    }
+
+    // Read-modify-writes store the result last so the instruction is
+    // complete if the block has to end there
+    if (is_read_modify_write(in.op)) {
+        if (in.mode == Mode::ACCUMULATOR) {
+            _emit.mov(A_REG, RAX);
+        }
+        else {
+            if (!addr.constant) {
+                _emit.load32(RSI, at(RSP, 4));
+            }
+            _emit.mov(RDX, RAX);
+            write(addr, true);
+        }
+    }
+}
+
+void Translator::block(const std::vector<Instruction>& instructions, uint16_t end_PC) {
+    // SysV prologue, the spare 8 bytes keep calls 16 byte aligned and hold
+    // temporaries
+    for (Reg reg : {RBX, RBP, R12, R13, R14, R15}) {
+        _emit.push(reg);
+    }
+    _emit.rr({0x83}, true, SUB, RSP);
+    _emit.byte(8);
+    _emit.rr({0x89}, true, RDI, CPU_REG);
+    _emit.movzx8(A_REG, cpu(_layout.A));
+    _emit.movzx8(X_REG, cpu(_layout.X));
+    _emit.movzx8(Y_REG, cpu(_layout.Y));
+    _emit.movzx8(P_REG, cpu(_layout.P));
+    _emit.movzx8(S_REG, cpu(_layout.S));
+
+    bool ended = false;
+    for (const Instruction& in : instructions) {
+        _next_PC = in.PC + 1 + operand_length(in.mode);
+        _cycles += (*_layout.cycle_table)[in.opcode];
+        _instructions++;
+        instruction(in);
+        ended = in.op == Op::JMP || in.op == Op::JSR || in.op == Op::RTS;
+    }
+    if (!ended) {
+        _exits[exit(end_PC)].jumps.push_back(_emit.jmp());
+    }
+
+    // Slow paths jump back into the body or on to an exit
+    for (auto& slow_path : _slow_paths) {
+        slow_path();
+    }
+
+    // Exits store the PC and cycles, then share the epilogue
+    std::vector<uint8_t*> to_epilogue;
+    for (Exit& exit : _exits) {
+        for (uint8_t* jump : exit.jumps) {
+            _emit.bind(jump);
+        }
+        if (exit.dynamic_PC) {
+            _emit.store16(cpu(_layout.PC), RCX);
+        }
+        else {
+            _emit.store16(cpu(_layout.PC), exit.PC);
+        }
+        _emit.add64(cpu(_layout.cycles), (int32_t) exit.cycles);
+        _emit.mov(RAX, exit.instructions);
+        to_epilogue.push_back(_emit.jmp());
+    }
+    for (uint8_t* jump : to_epilogue) {
+        _emit.bind(jump);
+    }
+    _emit.store8(cpu(_layout.A), A_REG);
+    _emit.store8(cpu(_layout.X), X_REG);
+    _emit.store8(cpu(_layout.Y), Y_REG);
+    _emit.store8(cpu(_layout.P), P_REG);
+    _emit.store8(cpu(_layout.S), S_REG);
+    _emit.rr({0x83}, true, ADD, RSP);
+    _emit.byte(8);
+    for (Reg reg : {R15, R14, R13, R12, RBP, RBX}) {
+        _emit.pop(reg);
+    }
+    _emit.ret();
+}
+
+}
+
+// JIT
+
+// Sets the protection of the host pages holding [start, start + size), the
+// code buffer is only ever writable or executable, never both at once
+static bool protect(uint8_t* start, size_t size, int protection) {
+    uintptr_t host_page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = reinterpret_cast<uintptr_t>(start) & ~(host_page - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(start) + size + host_page - 1) & ~(host_page - 1);
+    return mprotect(reinterpret_cast<void*>(first), end - first, protection) == 0;
+}
+
+JIT::JIT(CPU6502& cpu) : _cpu{cpu} {
+    void* code = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return;
+    }
+    // the N and Z flags of every byte value sit at the start of the buffer,
+    // in reach of RIP relative addressing from every block
+    uint8_t* buffer = static_cast<uint8_t*>(code);
+    for (int value = 0; value < 256; value++) {
+        buffer[value] = (value & 0x80) | (value == 0 ? 0x02 : 0);
+    }
+    if (!protect(buffer, CODE_SIZE, PROT_READ | PROT_EXEC)) {
+        munmap(code, CODE_SIZE);
+        return;
+    }
+    _code = buffer;
+    _code_size = CODE_SIZE;
+    _block_at.resize(0x10000);
+    _rewrites.resize(PAGE_COUNT);
+    flush();
+}
+
+JIT::~JIT() {
+    if (_code != nullptr) {
+        munmap(_code, _code_size);
+    }
+}
+
+void JIT::flush() {
+    _code_used = 256;
+    _blocks.clear();
+    std::fill(_block_at.begin(), _block_at.end(), NO_BLOCK);
+    std::fill(_rewrites.begin(), _rewrites.end(), 0);
+}
+
+uint32_t JIT::read_slow(CPU6502* cpu, uint32_t addr) {
+    return cpu->_bus.read(addr);
+}
+
+uint32_t JIT::write_slow(CPU6502* cpu, uint32_t addr, uint32_t value) {
+    uint8_t page = addr >> 8;
+    uint32_t generation = cpu->_bus.code_generation(page);
+    cpu->_bus.write(addr, value);
+    // a device raising an interrupt also ends the block
+    return cpu->_bus.code_generation(page) != generation || cpu->_events != 0;
+}
+
+const JIT::Block* JIT::lookup(uint16_t PC) {
+    Bus& bus = _cpu._bus;
+    uint32_t index = _block_at[PC];
+    if (index != NO_BLOCK) {
+        Block& block = _blocks[index];
+        bool first_valid = bus.code_generation(block.first_page) == block.generations[0];
+        bool last_valid = bus.code_generation(block.last_page) == block.generations[1];
+        if (first_valid && last_valid) {
+            return &block;
+        }
+        _rewrites[block.first_page] += !first_valid;
+        _rewrites[block.last_page] += !last_valid;
+    }
+    if (_code_size - _code_used < MAX_BLOCK_CODE) {
+        flush();
+        index = NO_BLOCK;
+    }
+    if (index == NO_BLOCK) {
+        index = _blocks.size();
+        _block_at[PC] = index;
+        _blocks.emplace_back();
+    }
+    _blocks[index] = translate(PC);
+    return &_blocks[index];
+}
+
+JIT::Block JIT::translate(uint16_t PC) {
+    Bus& bus = _cpu._bus;
+    std::vector<Instruction> instructions;
+    uint16_t start = PC;
+    auto translatable = [&](uint8_t page) {
+        return bus._read_pages[page] != nullptr && _rewrites[page] <= REWRITE_LIMIT;
+    };
+    const std::array<Decoded, 256>& decode = _cpu._variant == Variant::CMOS_65C02 ? DECODE<Variant::CMOS_65C02>
+        : _cpu._variant == Variant::NMOS_ILLEGAL ? DECODE<Variant::NMOS_ILLEGAL> : DECODE<Variant::NMOS>;
+    while (instructions.size() < MAX_BLOCK_INSTRUCTIONS) {
+        Decoded decoded = decode[bus.peek(PC)];
+        uint16_t last_byte = PC + operand_length(decoded.mode);
+        if (decoded.op == Op::NONE || !translatable(PC >> 8) || !translatable(last_byte >> 8)
+                || ((last_byte >> 8) != (start >> 8) && (last_byte >> 8) != ((start >> 8) + 1) % PAGE_COUNT)) {
+            break;
+        }
+        Instruction in = {PC, bus.peek(PC), decoded.op, decoded.mode, 0};
+        if (operand_length(decoded.mode) >= 1) {
+            in.operand = bus.peek(PC + 1);
+        }
+        if (operand_length(decoded.mode) == 2) {
+            in.operand |= bus.peek(PC + 2) << 8;
+        }
+        uint16_t next_PC = last_byte + 1;
+        // jumps to self are left to the interpreter, which reports the trap
+        bool to_self = ((in.op == Op::JMP || in.op == Op::JSR) && in.operand == PC)
+            || (is_branch(in.op) && (uint16_t) (next_PC + (int8_t) in.operand) == PC);
+        if (to_self) {
+            break;
+        }
+        instructions.push_back(in);
+        PC = next_PC;
+        // CLI and PLP can let a waiting IRQ in, which the dispatcher takes,
+        // and SED and PLP can switch the following ADC or SBC to decimal
+        if (in.op == Op::JMP || in.op == Op::JSR || in.op == Op::RTS || in.op == Op::CLI || in.op == Op::PLP
+                || in.op == Op::SED) {
+            break;
+        }
+    }
+
+    Block block{};
+    block.first_page = start >> 8;
+    block.last_page = instructions.empty() ? block.first_page : (uint8_t) ((PC - 1) >> 8);
+    if (translatable(block.first_page)) {
+        bus.watch(block.first_page);
+        bus.watch(block.last_page);
+    }
+    block.generations[0] = bus.code_generation(block.first_page);
+    block.generations[1] = bus.code_generation(block.last_page);
+    if (instructions.empty()) {
+        return block;
+    }
+
+    Layout layout;
+    auto offset = [&](const void* field) {
+        return (int32_t) (reinterpret_cast<const uint8_t*>(field) - reinterpret_cast<const uint8_t*>(&_cpu));
+    };
+    layout.A = offset(&_cpu._A);
+    layout.X = offset(&_cpu._X);
+    layout.Y = offset(&_cpu._Y);
+    layout.P = offset(&_cpu._P);
+    layout.S = offset(&_cpu._S);
+    layout.PC = offset(&_cpu._PC.PC);
+    layout.cycles = offset(&_cpu._cycles);
+    layout.read_pages = offset(bus._read_pages.data());
+    layout.write_pages = offset(bus._write_pages.data());
+    layout.dirty = offset(bus._dirty.data());
+    layout.read_slow = reinterpret_cast<const void*>(&JIT::read_slow);
+    layout.write_slow = reinterpret_cast<const void*>(&JIT::write_slow);
+    layout.nz_table = _code;
+    layout.cycle_table = CPU6502::cycle_table(_cpu._variant);
+
+    // only the space this block can take is made writable while it is
+    // emitted, and executable again before anything runs
+    uint8_t* start_code = _code + _code_used;
+    if (!protect(start_code, MAX_BLOCK_CODE, PROT_READ | PROT_WRITE)) {
+        return block;
+    }
+    Translator translator(layout, start_code);
+    translator.block(instructions, PC);
+    if (!protect(start_code, MAX_BLOCK_CODE, PROT_READ | PROT_EXEC)) {
+        return block;
+    }
+    _code_used = (translator.end() - _code + 15) & ~size_t{15};
+
+    block.code = reinterpret_cast<Code>(start_code);
+    block.last_PC = instructions.back().PC;
+    block.instructions = instructions.size();
+    for (const Instruction& in : instructions) {
+        block.max_cycles += (*layout.cycle_table)[in.opcode];
+        bool indexed = in.mode == Mode::ABSOLUTE_X || in.mode == Mode::ABSOLUTE_Y || in.mode == Mode::ZEROPAGE_PTR_Y;
+        block.max_cycles += (reads_operand(in.op) && indexed) ? 1 : is_branch(in.op) ? 2 : 0;
+        block.decimal |= in.op == Op::ADC || in.op == Op::SBC;
+    }
+    return block;
+}
+
+RunResult JIT::run(uint64_t max_instructions, uint64_t cycle_limit) {
+    uint64_t executed = 0;
+    uint64_t start_cycles = _cpu._cycles;
+    while (executed < max_instructions && _cpu._cycles < cycle_limit) {
+        const Block* block = lookup(_cpu._PC.PC);
+        // blocks only run when every instruction in them would have, so
+        // budgets end exactly where the interpreter would end them, and only
+        // while no interrupt is waiting. Decimal arithmetic is interpreted.
+        if (_cpu._events || block->code == nullptr || block->instructions > max_instructions - executed
+                || block->max_cycles >= cycle_limit - _cpu._cycles || (block->decimal && (_cpu._P & D_FLAG))) {
+            RunResult step = _cpu.interpret(1, cycle_limit);
+            executed += step.instructions;
+            if (step.reason != StopReason::BUDGET) {
+                return {step.reason, executed, _cpu._cycles - start_cycles};
+            }
+            continue;
+        }
+        // generated code keeps every flag in P, the interpreter keeps N and
+        // Z lazily
+        _cpu._P = _cpu.status();
+        uint32_t retired = block->code(&_cpu);
+        _cpu.set_status(_cpu._P);
+        executed += retired;
+        if (retired == block->instructions && _cpu._PC.PC == block->last_PC) [[unlikely]] {
+            // only an RTS can return to itself undetected at translation
+            StopReason reason = _cpu.self_trap();
+            if (reason != StopReason::BUDGET) {
+                return {reason, executed, _cpu._cycles - start_cycles};
+            }
+        }
+    }
+    return {StopReason::BUDGET, executed, _cpu._cycles - start_cycles};
+}
+
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class CPU6502;
+struct RunResult;
+
+// Translates 6502 basic blocks into x86-64 code, one JIT per CPU.
+//
+// A block runs from a start PC up to the first jump, JSR, RTS or
+// instruction the translator leaves to the interpreter (BRK, RTI, JMP
+// indirect, undocumented and invalid opcodes and jumps to self), so
+// conditional branches are side exits. Inside a block A, X, Y, P and S live
+// in host registers and memory goes through the bus page tables inline,
+// only calling out for I/O and watched pages. Cycles, page crossings and
+// branch penalties are counted exactly as the interpreter counts them.
+//
+// Blocks are cached by start PC along with the code generations of the pages
+// they were read from, and those pages are watched on the bus. Writing to
+// one, even from inside the block, ends the block after that instruction
+// and the stale translation is dropped the next time it is looked up. Pages
+// rewritten over and over are left to the interpreter.
+//
+// The interpreter runs anything the translator cannot, and whenever a block
+// would overrun the instruction or cycle budget or an interrupt is waiting,
+// so runs stop exactly where the interpreter would stop them. Blocks end
+// after CLI, PLP and any write that raises an interrupt so it is taken at
+// the same instruction boundary too.
+//
+// ADC and SBC are translated for binary mode only. Blocks end after SED and
+// a block holding either is interpreted while D is set, so generated code
+// never tests it.
+class JIT {
+    public:
+        JIT(CPU6502& cpu);
+        JIT(const JIT&) = delete;
+        JIT& operator=(const JIT&) = delete;
+        ~JIT();
+        // false if executable memory could not be mapped, the CPU then
+        // interprets instead
+        bool ok() { return _code != nullptr; };
+        RunResult run(uint64_t max_instructions, uint64_t cycle_limit);
+        // Drops every translation
+        void flush();
+    private:
+        // Generated code takes the CPU and returns the instructions it retired
+        using Code = uint32_t (*)(CPU6502* cpu);
+        struct Block {
+            Code code;           // nullptr if the first instruction is interpreted
+            uint8_t first_page;
+            uint8_t last_page;
+            uint32_t generations[2];
+            uint16_t last_PC;    // of the last instruction
+            uint32_t instructions;
+            uint32_t max_cycles; // with every page crossing and branch taken
+            bool decimal;        // has an ADC or SBC, translated for binary only
+        };
+        CPU6502& _cpu;
+        uint8_t* _code = nullptr;  // code buffer, only writable while a block is emitted
+        size_t _code_size = 0;
+        size_t _code_used = 0;
+        std::vector<Block> _blocks;
+        std::vector<uint32_t> _block_at; // index into _blocks by PC
+        // Times each page's translations have been invalidated by writes
+        std::vector<uint32_t> _rewrites;
+        const Block* lookup(uint16_t PC);
+        Block translate(uint16_t PC);
+        // Called by generated code for I/O and watched pages
+        static uint32_t read_slow(CPU6502* cpu, uint32_t addr);
+        static uint32_t write_slow(CPU6502* cpu, uint32_t addr, uint32_t value);
+};
@@ -0,0 +1,121 @@
+#include "JobRunner.h"
+#include <array>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+
+// A worker's queue of job indices, padded so neighbouring workers never
+// share a cache line
+struct alignas(64) WorkQueue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+};
+
+static JobResult run_job(const Job& job, std::span<uint8_t, MEMORY_SIZE> arena) {
+    std::fill(arena.begin(), arena.end(), 0);
+    size_t length = std::min<size_t>(job.image.size(), MEMORY_SIZE - job.load_address);
+    std::memcpy(arena.data() + job.load_address, job.image.data(), length);
+    if (job.program != nullptr) {
+        job.program->copy_to(arena);
+    }
+
+    CPU6502 cpu(arena, job.entry_point, job.variant);
+    if (job.rom != nullptr) {
+        job.rom->map(cpu);
+    }
+    if (job.setup) {
+        job.setup(cpu);
+    }
+    auto start = std::chrono::steady_clock::now();
+    RunResult total = {StopReason::BUDGET, 0, 0};
+    bool halted = false;
+    uint64_t interval = job.halted ? std::max<uint64_t>(job.check_interval, 1) : UINT64_MAX;
+    while (total.instructions < job.max_instructions) {
+        RunResult slice = cpu.run(std::min(interval, job.max_instructions - total.instructions));
+        total.reason = slice.reason;
+        total.instructions += slice.instructions;
+        total.cycles += slice.cycles;
+        if (slice.reason != StopReason::BUDGET) {
+            break;
+        }
+        if (job.halted && job.halted(cpu)) {
+            halted = true;
+            break;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (job.finished) {
+        job.finished(cpu);
+    }
+    return {total, halted, cpu.A(), cpu.X(), cpu.Y(), cpu.P(), cpu.S(), cpu.PC(),
+            std::chrono::duration<double>(end - start).count()};
+}
+
+JobRunner::JobRunner(unsigned threads) : _threads{threads} {
+    if (_threads == 0) {
+        _threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+BatchResult JobRunner::run(const std::vector<Job>& jobs) {
+    BatchResult batch;
+    batch.results.resize(jobs.size());
+    unsigned workers = std::max<size_t>(1, std::min<size_t>(_threads, jobs.size()));
+
+    std::vector<WorkQueue> queues(workers);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        queues[i * workers / jobs.size()].jobs.push_back(i);
+    }
+
+    auto worker = [&](unsigned id) {
+        auto arena = std::make_unique<std::array<uint8_t, MEMORY_SIZE>>();
+        while (true) {
+            size_t index = SIZE_MAX;
+            {
+                std::lock_guard<std::mutex> guard(queues[id].lock);
+                if (!queues[id].jobs.empty()) {
+                    index = queues[id].jobs.front();
+                    queues[id].jobs.pop_front();
+                }
+            }
+            for (unsigned i = 1; i < workers && index == SIZE_MAX; i++) {
+                WorkQueue& victim = queues[(id + i) % workers];
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if (!victim.jobs.empty()) {
+                    index = victim.jobs.back();
+                    victim.jobs.pop_back();
+                }
+            }
+            if (index == SIZE_MAX) {
+                // jobs are never added mid batch so an empty sweep means done
+                return;
+            }
+            batch.results[index] = run_job(jobs[index], *arena);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < workers; i++) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    batch.instructions = 0;
+    batch.cycles = 0;
+    for (auto& result : batch.results) {
+        batch.instructions += result.run.instructions;
+        batch.cycles += result.run.cycles;
+    }
+    batch.seconds = std::chrono::duration<double>(end - start).count();
+    batch.instructions_per_second = batch.seconds > 0 ? batch.instructions / batch.seconds : 0;
+    return batch;
+}
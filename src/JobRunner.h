@@ -0,0 +1,62 @@
+#pragma once
+#include <span>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+#include "CPU6502.h"
+#include "RomImage.h"
+
+// One independent machine to boot and run. The image is copied into zeroed
+// RAM at load_address, then program, and rom, if set, is mapped over them.
+// All of them must stay alive until JobRunner::run() returns.
+struct Job {
+    std::span<const uint8_t> image;
+    uint16_t load_address = 0x0000;
+    RomImage* program = nullptr; // copied into RAM
+    RomImage* rom = nullptr;     // shared between jobs rather than copied
+    uint16_t entry_point = 0x0000;
+    uint64_t max_instructions = UINT64_MAX;
+    Variant variant = Variant::NMOS;
+    // Optional extra halt condition, checked every check_interval instructions
+    std::function<bool(CPU6502&)> halted;
+    uint64_t check_interval = 0x10000;
+    // Optional hooks on the worker thread, once the machine has booted and
+    // once it has stopped. Neither is timed.
+    std::function<void(CPU6502&)> setup;
+    std::function<void(CPU6502&)> finished;
+};
+
+struct JobResult {
+    RunResult run;  // totals over the whole job, reason is why it ended
+    bool halted;    // ended because Job::halted returned true
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P;
+    uint8_t S;
+    uint16_t PC;
+    double seconds;
+};
+
+struct BatchResult {
+    std::vector<JobResult> results; // in the same order as the jobs
+    uint64_t instructions;
+    uint64_t cycles;
+    double seconds;
+    double instructions_per_second;
+};
+
+// Runs batches of jobs on a fixed number of worker threads. Jobs are dealt
+// out in contiguous blocks, a worker that runs dry steals from the back of
+// another worker's queue. Each worker boots all of its jobs in the same
+// 64 KiB arena so a job costs no allocations.
+class JobRunner {
+    public:
+        // 0 uses every hardware thread
+        JobRunner(unsigned threads = 0);
+        BatchResult run(const std::vector<Job>& jobs);
+        unsigned threads() { return _threads; };
+    private:
+        unsigned _threads;
+};
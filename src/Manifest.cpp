@@ -0,0 +1,89 @@
+#include "Manifest.h"
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+// Parses a whole number, false if anything is left over
+static bool parse_number(const std::string& text, uint64_t max, uint64_t& value) {
+    if (text.empty()) {
+        return false;
+    }
+    char* end;
+    value = std::strtoull(text.c_str(), &end, 0);
+    return *end == '\0' && value <= max;
+}
+
+Manifest::Manifest(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        _error = "could not open " + path;
+        return;
+    }
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); number++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        ManifestEntry entry;
+        if (!(words >> entry.path)) {
+            continue;
+        }
+        entry.path = (directory / entry.path).string();
+        std::string setting;
+        while (words >> setting) {
+            size_t equals = setting.find('=');
+            if (equals == std::string::npos || !parse_setting(entry, setting.substr(0, equals), setting.substr(equals + 1))) {
+                _error = path + ":" + std::to_string(number) + ": bad setting " + setting;
+                return;
+            }
+        }
+        for (std::string* output : {&entry.dump_path, &entry.delta_path}) {
+            if (!output->empty()) {
+                *output = (directory / *output).string();
+            }
+        }
+        _entries.push_back(std::move(entry));
+    }
+}
+
+bool Manifest::parse_setting(ManifestEntry& entry, const std::string& key, const std::string& value) {
+    uint64_t number;
+    if (key == "format") {
+        if (value == "raw") entry.format = ImageFormat::RAW;
+        else if (value == "ihex") entry.format = ImageFormat::IHEX;
+        else if (value == "ines") entry.format = ImageFormat::INES;
+        else return false;
+        return true;
+    }
+    if (key == "variant") {
+        if (value == "nmos") entry.variant = Variant::NMOS;
+        else if (value == "nmos_illegal") entry.variant = Variant::NMOS_ILLEGAL;
+        else if (value == "cmos") entry.variant = Variant::CMOS_65C02;
+        else return false;
+        return true;
+    }
+    if (key == "dump" || key == "delta") {
+        (key == "dump" ? entry.dump_path : entry.delta_path) = value;
+        return !value.empty();
+    }
+    if (key == "instructions") {
+        return parse_number(value, UINT64_MAX, entry.max_instructions);
+    }
+    if (key == "brk" || key == "self_loops") {
+        if (!parse_number(value, 1, number)) {
+            return false;
+        }
+        (key == "brk" ? entry.trap_brk : entry.trap_self_loops) = number;
+        return true;
+    }
+    if (!parse_number(value, 0xFFFF, number)) {
+        return false;
+    }
+    if (key == "load") entry.load_address = number;
+    else if (key == "entry") entry.entry_point = number;
+    else if (key == "exit") entry.exit_address = number;
+    else if (key == "break") entry.breakpoints.push_back(number);
+    else return false;
+    return true;
+}
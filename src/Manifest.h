@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+
+#include "CPU6502.h"
+#include "RomImage.h"
+
+// One run listed in a manifest
+struct ManifestEntry {
+    std::string path;
+    ImageFormat format = ImageFormat::DETECT;
+    uint16_t load_address = 0x000a;
+    std::optional<uint16_t> entry_point; // the reset vector, else 0x400, if not given
+    uint64_t max_instructions = UINT64_MAX;
+    Variant variant = Variant::NMOS;
+    bool trap_self_loops = true;
+    bool trap_brk = false;
+    std::optional<uint16_t> exit_address;
+    std::vector<uint16_t> breakpoints;
+    std::string dump_path; // the 64 KiB address space is written here after the run if set
+    std::string delta_path; // and the pages the run wrote here
+};
+
+// A text file listing runs, one per line as an image path followed by any
+// of these settings, with # starting a comment:
+//   format=raw|ihex|ines  load=<address>  entry=<address>
+//   instructions=<count>  variant=nmos|nmos_illegal|cmos
+//   exit=<address>  break=<address> (repeatable)  brk=1  self_loops=0
+//   dump=<path>  delta=<path>
+// Numbers take C syntax, so 0x0400 and 1024 are the same. Relative paths
+// are taken from the manifest's directory.
+class Manifest {
+    public:
+        Manifest(const std::string& path);
+        bool ok() { return _error.empty(); };
+        const std::string& error() { return _error; };
+        const std::vector<ManifestEntry>& entries() { return _entries; };
+    private:
+        std::string _error;
+        std::vector<ManifestEntry> _entries;
+        bool parse_setting(ManifestEntry& entry, const std::string& key, const std::string& value);
+};
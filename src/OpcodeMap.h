@@ -0,0 +1,343 @@
+#pragma once
+
+// The instruction sets as X-macros. Modes and operations are named by the
+// CPU6502 members that implement them.
+
+// Opcode map shared by all the backends, expands ADDRESSED(n, mode, op),
+// IMPLIED(n, op) or ACCUMULATOR(n, op) for every valid opcode n
+#define OPCODE_MAP(ADDRESSED, IMPLIED, ACCUMULATOR) \
+    IMPLIED(0x00, BRK)                   \
+    ADDRESSED(0x01, zeropage_X_ptr, ORA) \
+    ADDRESSED(0x05, zeropage, ORA)       \
+    ADDRESSED(0x06, zeropage, ASL)       \
+    IMPLIED(0x08, PHP)                   \
+    ADDRESSED(0x09, imediate, ORA)       \
+    ACCUMULATOR(0x0A, ASL)               \
+    ADDRESSED(0x0D, absolute, ORA)       \
+    ADDRESSED(0x0E, absolute, ASL)       \
+    ADDRESSED(0x10, imediate, BPL)       \
+    ADDRESSED(0x11, zeropage_ptr_Y, ORA) \
+    ADDRESSED(0x15, zeropage_X, ORA)     \
+    ADDRESSED(0x16, zeropage_X, ASL)     \
+    IMPLIED(0x18, CLC)                   \
+    ADDRESSED(0x19, absolute_Y, ORA)     \
+    ADDRESSED(0x1D, absolute_X, ORA)     \
+    ADDRESSED(0x1E, absolute_X, ASL)     \
+    ADDRESSED(0x20, imediate_16, JSR)    \
+    ADDRESSED(0x21, zeropage_X_ptr, AND) \
+    ADDRESSED(0x24, zeropage, BIT)       \
+    ADDRESSED(0x25, zeropage, AND)       \
+    ADDRESSED(0x26, zeropage, ROL)       \
+    IMPLIED(0x28, PLP)                   \
+    ADDRESSED(0x29, imediate, AND)       \
+    ACCUMULATOR(0x2A, ROL)               \
+    ADDRESSED(0x2C, absolute, BIT)       \
+    ADDRESSED(0x2D, absolute, AND)       \
+    ADDRESSED(0x2E, absolute, ROL)       \
+    ADDRESSED(0x30, imediate, BMI)       \
+    ADDRESSED(0x31, zeropage_ptr_Y, AND) \
+    ADDRESSED(0x35, zeropage_X, AND)     \
+    ADDRESSED(0x36, zeropage_X, ROL)     \
+    IMPLIED(0x38, SEC)                   \
+    ADDRESSED(0x39, absolute_Y, AND)     \
+    ADDRESSED(0x3D, absolute_X, AND)     \
+    ADDRESSED(0x3E, absolute_X, ROL)     \
+    IMPLIED(0x40, RTI)                   \
+    ADDRESSED(0x41, zeropage_X_ptr, EOR) \
+    ADDRESSED(0x45, zeropage, EOR)       \
+    ADDRESSED(0x46, zeropage, LSR)       \
+    IMPLIED(0x48, PHA)                   \
+    ADDRESSED(0x49, imediate, EOR)       \
+    ACCUMULATOR(0x4A, LSR)               \
+    ADDRESSED(0x4C, imediate_16, JMP)    \
+    ADDRESSED(0x4D, absolute, EOR)       \
+    ADDRESSED(0x4E, absolute, LSR)       \
+    ADDRESSED(0x50, imediate, BVC)       \
+    ADDRESSED(0x51, zeropage_ptr_Y, EOR) \
+    ADDRESSED(0x55, zeropage_X, EOR)     \
+    ADDRESSED(0x56, zeropage_X, LSR)     \
+    IMPLIED(0x58, CLI)                   \
+    ADDRESSED(0x59, absolute_Y, EOR)     \
+    ADDRESSED(0x5D, absolute_X, EOR)     \
+    ADDRESSED(0x5E, absolute_X, LSR)     \
+    IMPLIED(0x60, RTS)                   \
+    ADDRESSED(0x61, zeropage_X_ptr, ADC) \
+    ADDRESSED(0x65, zeropage, ADC)       \
+    ADDRESSED(0x66, zeropage, ROR)       \
+    IMPLIED(0x68, PLA)                   \
+    ADDRESSED(0x69, imediate, ADC)       \
+    ACCUMULATOR(0x6A, ROR)               \
+    ADDRESSED(0x6C, absolute_16, JMP)    \
+    ADDRESSED(0x6D, absolute, ADC)       \
+    ADDRESSED(0x6E, absolute, ROR)       \
+    ADDRESSED(0x70, imediate, BVS)       \
+    ADDRESSED(0x71, zeropage_ptr_Y, ADC) \
+    ADDRESSED(0x75, zeropage_X, ADC)     \
+    ADDRESSED(0x76, zeropage_X, ROR)     \
+    IMPLIED(0x78, SEI)                   \
+    ADDRESSED(0x79, absolute_Y, ADC)     \
+    ADDRESSED(0x7D, absolute_X, ADC)     \
+    ADDRESSED(0x7E, absolute_X, ROR)     \
+    ADDRESSED(0x81, zeropage_X_ptr, STA) \
+    ADDRESSED(0x84, zeropage, STY)       \
+    ADDRESSED(0x85, zeropage, STA)       \
+    ADDRESSED(0x86, zeropage, STX)       \
+    IMPLIED(0x88, DEY)                   \
+    IMPLIED(0x8A, TXA)                   \
+    ADDRESSED(0x8C, absolute, STY)       \
+    ADDRESSED(0x8D, absolute, STA)       \
+    ADDRESSED(0x8E, absolute, STX)       \
+    ADDRESSED(0x90, imediate, BCC)       \
+    ADDRESSED(0x91, zeropage_ptr_Y, STA) \
+    ADDRESSED(0x94, zeropage_X, STY)     \
+    ADDRESSED(0x95, zeropage_X, STA)     \
+    ADDRESSED(0x96, zeropage_Y, STX)     \
+    IMPLIED(0x98, TYA)                   \
+    ADDRESSED(0x99, absolute_Y, STA)     \
+    IMPLIED(0x9A, TXS)                   \
+    ADDRESSED(0x9D, absolute_X, STA)     \
+    ADDRESSED(0xA0, imediate, LDY)       \
+    ADDRESSED(0xA1, zeropage_X_ptr, LDA) \
+    ADDRESSED(0xA2, imediate, LDX)       \
+    ADDRESSED(0xA4, zeropage, LDY)       \
+    ADDRESSED(0xA5, zeropage, LDA)       \
+    ADDRESSED(0xA6, zeropage, LDX)       \
+    IMPLIED(0xA8, TAY)                   \
+    ADDRESSED(0xA9, imediate, LDA)       \
+    IMPLIED(0xAA, TAX)                   \
+    ADDRESSED(0xAC, absolute, LDY)       \
+    ADDRESSED(0xAD, absolute, LDA)       \
+    ADDRESSED(0xAE, absolute, LDX)       \
+    ADDRESSED(0xB0, imediate, BCS)       \
+    ADDRESSED(0xB1, zeropage_ptr_Y, LDA) \
+    ADDRESSED(0xB4, zeropage_X, LDY)     \
+    ADDRESSED(0xB5, zeropage_X, LDA)     \
+    ADDRESSED(0xB6, zeropage_Y, LDX)     \
+    IMPLIED(0xB8, CLV)                   \
+    ADDRESSED(0xB9, absolute_Y, LDA)     \
+    IMPLIED(0xBA, TSX)                   \
+    ADDRESSED(0xBC, absolute_X, LDY)     \
+    ADDRESSED(0xBD, absolute_X, LDA)     \
+    ADDRESSED(0xBE, absolute_Y, LDX)     \
+    ADDRESSED(0xC0, imediate, CPY)       \
+    ADDRESSED(0xC1, zeropage_X_ptr, CMP) \
+    ADDRESSED(0xC4, zeropage, CPY)       \
+    ADDRESSED(0xC5, zeropage, CMP)       \
+    ADDRESSED(0xC6, zeropage, DEC)       \
+    IMPLIED(0xC8, INY)                   \
+    ADDRESSED(0xC9, imediate, CMP)       \
+    IMPLIED(0xCA, DEX)                   \
+    ADDRESSED(0xCC, absolute, CPY)       \
+    ADDRESSED(0xCD, absolute, CMP)       \
+    ADDRESSED(0xCE, absolute, DEC)       \
+    ADDRESSED(0xD0, imediate, BNE)       \
+    ADDRESSED(0xD1, zeropage_ptr_Y, CMP) \
+    ADDRESSED(0xD5, zeropage_X, CMP)     \
+    ADDRESSED(0xD6, zeropage_X, DEC)     \
+    IMPLIED(0xD8, CLD)                   \
+    ADDRESSED(0xD9, absolute_Y, CMP)     \
+    ADDRESSED(0xDD, absolute_X, CMP)     \
+    ADDRESSED(0xDE, absolute_X, DEC)     \
+    ADDRESSED(0xE0, imediate, CPX)       \
+    ADDRESSED(0xE1, zeropage_X_ptr, SBC) \
+    ADDRESSED(0xE4, zeropage, CPX)       \
+    ADDRESSED(0xE5, zeropage, SBC)       \
+    ADDRESSED(0xE6, zeropage, INC)       \
+    IMPLIED(0xE8, INX)                   \
+    ADDRESSED(0xE9, imediate, SBC)       \
+    IMPLIED(0xEA, NOP)                   \
+    ADDRESSED(0xEC, absolute, CPX)       \
+    ADDRESSED(0xED, absolute, SBC)       \
+    ADDRESSED(0xEE, absolute, INC)       \
+    ADDRESSED(0xF0, imediate, BEQ)       \
+    ADDRESSED(0xF1, zeropage_ptr_Y, SBC) \
+    ADDRESSED(0xF5, zeropage_X, SBC)     \
+    ADDRESSED(0xF6, zeropage_X, INC)     \
+    IMPLIED(0xF8, SED)                   \
+    ADDRESSED(0xF9, absolute_Y, SBC)     \
+    ADDRESSED(0xFD, absolute_X, SBC)     \
+    ADDRESSED(0xFE, absolute_X, INC)
+
+// The stable undocumented NMOS opcodes, added to the map above by
+// Variant::NMOS_ILLEGAL. The unstable ones (ANE, LXA, SHA, SHX, SHY, TAS,
+// LAS) and the opcodes that jam the CPU stay invalid.
+#define ILLEGAL_OPCODE_MAP(ADDRESSED, IMPLIED, ACCUMULATOR) \
+    ADDRESSED(0x03, zeropage_X_ptr, SLO) \
+    ADDRESSED(0x04, zeropage, IGN)       \
+    ADDRESSED(0x07, zeropage, SLO)       \
+    ADDRESSED(0x0B, imediate, ANC)       \
+    ADDRESSED(0x0C, absolute, IGN)       \
+    ADDRESSED(0x0F, absolute, SLO)       \
+    ADDRESSED(0x13, zeropage_ptr_Y, SLO) \
+    ADDRESSED(0x14, zeropage_X, IGN)     \
+    ADDRESSED(0x17, zeropage_X, SLO)     \
+    IMPLIED(0x1A, NOP)                   \
+    ADDRESSED(0x1B, absolute_Y, SLO)     \
+    ADDRESSED(0x1C, absolute_X, IGN)     \
+    ADDRESSED(0x1F, absolute_X, SLO)     \
+    ADDRESSED(0x23, zeropage_X_ptr, RLA) \
+    ADDRESSED(0x27, zeropage, RLA)       \
+    ADDRESSED(0x2B, imediate, ANC)       \
+    ADDRESSED(0x2F, absolute, RLA)       \
+    ADDRESSED(0x33, zeropage_ptr_Y, RLA) \
+    ADDRESSED(0x34, zeropage_X, IGN)     \
+    ADDRESSED(0x37, zeropage_X, RLA)     \
+    IMPLIED(0x3A, NOP)                   \
+    ADDRESSED(0x3B, absolute_Y, RLA)     \
+    ADDRESSED(0x3C, absolute_X, IGN)     \
+    ADDRESSED(0x3F, absolute_X, RLA)     \
+    ADDRESSED(0x43, zeropage_X_ptr, SRE) \
+    ADDRESSED(0x44, zeropage, IGN)       \
+    ADDRESSED(0x47, zeropage, SRE)       \
+    ADDRESSED(0x4B, imediate, ALR)       \
+    ADDRESSED(0x4F, absolute, SRE)       \
+    ADDRESSED(0x53, zeropage_ptr_Y, SRE) \
+    ADDRESSED(0x54, zeropage_X, IGN)     \
+    ADDRESSED(0x57, zeropage_X, SRE)     \
+    IMPLIED(0x5A, NOP)                   \
+    ADDRESSED(0x5B, absolute_Y, SRE)     \
+    ADDRESSED(0x5C, absolute_X, IGN)     \
+    ADDRESSED(0x5F, absolute_X, SRE)     \
+    ADDRESSED(0x63, zeropage_X_ptr, RRA) \
+    ADDRESSED(0x64, zeropage, IGN)       \
+    ADDRESSED(0x67, zeropage, RRA)       \
+    ADDRESSED(0x6B, imediate, ARR)       \
+    ADDRESSED(0x6F, absolute, RRA)       \
+    ADDRESSED(0x73, zeropage_ptr_Y, RRA) \
+    ADDRESSED(0x74, zeropage_X, IGN)     \
+    ADDRESSED(0x77, zeropage_X, RRA)     \
+    IMPLIED(0x7A, NOP)                   \
+    ADDRESSED(0x7B, absolute_Y, RRA)     \
+    ADDRESSED(0x7C, absolute_X, IGN)     \
+    ADDRESSED(0x7F, absolute_X, RRA)     \
+    ADDRESSED(0x80, imediate, IGN)       \
+    ADDRESSED(0x82, imediate, IGN)       \
+    ADDRESSED(0x83, zeropage_X_ptr, SAX) \
+    ADDRESSED(0x87, zeropage, SAX)       \
+    ADDRESSED(0x89, imediate, IGN)       \
+    ADDRESSED(0x8F, absolute, SAX)       \
+    ADDRESSED(0x97, zeropage_Y, SAX)     \
+    ADDRESSED(0xA3, zeropage_X_ptr, LAX) \
+    ADDRESSED(0xA7, zeropage, LAX)       \
+    ADDRESSED(0xAF, absolute, LAX)       \
+    ADDRESSED(0xB3, zeropage_ptr_Y, LAX) \
+    ADDRESSED(0xB7, zeropage_Y, LAX)     \
+    ADDRESSED(0xBF, absolute_Y, LAX)     \
+    ADDRESSED(0xC2, imediate, IGN)       \
+    ADDRESSED(0xC3, zeropage_X_ptr, DCP) \
+    ADDRESSED(0xC7, zeropage, DCP)       \
+    ADDRESSED(0xCB, imediate, SBX)       \
+    ADDRESSED(0xCF, absolute, DCP)       \
+    ADDRESSED(0xD3, zeropage_ptr_Y, DCP) \
+    ADDRESSED(0xD4, zeropage_X, IGN)     \
+    ADDRESSED(0xD7, zeropage_X, DCP)     \
+    IMPLIED(0xDA, NOP)                   \
+    ADDRESSED(0xDB, absolute_Y, DCP)     \
+    ADDRESSED(0xDC, absolute_X, IGN)     \
+    ADDRESSED(0xDF, absolute_X, DCP)     \
+    ADDRESSED(0xE2, imediate, IGN)       \
+    ADDRESSED(0xE3, zeropage_X_ptr, ISC) \
+    ADDRESSED(0xE7, zeropage, ISC)       \
+    ADDRESSED(0xEB, imediate, SBC)       \
+    ADDRESSED(0xEF, absolute, ISC)       \
+    ADDRESSED(0xF3, zeropage_ptr_Y, ISC) \
+    ADDRESSED(0xF4, zeropage_X, IGN)     \
+    ADDRESSED(0xF7, zeropage_X, ISC)     \
+    IMPLIED(0xFA, NOP)                   \
+    ADDRESSED(0xFB, absolute_Y, ISC)     \
+    ADDRESSED(0xFC, absolute_X, IGN)     \
+    ADDRESSED(0xFF, absolute_X, ISC)
+
+// The 65C02's changes to the documented NMOS map, its new instructions and
+// addressing modes, JMP indirect no longer wrapping within a page, shifts
+// of abs,X only paying for a page crossing when there is one, and NOPs for
+// the unused opcodes. The Rockwell and WDC bit instructions (columns 7 and
+// F) and WAI and STP stay invalid.
+#define CMOS_OPCODE_MAP(ADDRESSED, IMPLIED, ACCUMULATOR) \
+    ADDRESSED(0x02, imediate, IGN)           \
+    IMPLIED(0x03, NOP)                       \
+    ADDRESSED(0x04, zeropage, TSB)           \
+    IMPLIED(0x0B, NOP)                       \
+    ADDRESSED(0x0C, absolute, TSB)           \
+    ADDRESSED(0x12, zeropage_ptr, ORA)       \
+    IMPLIED(0x13, NOP)                       \
+    ADDRESSED(0x14, zeropage, TRB)           \
+    ACCUMULATOR(0x1A, INC)                   \
+    IMPLIED(0x1B, NOP)                       \
+    ADDRESSED(0x1C, absolute, TRB)           \
+    ADDRESSED(0x1E, absolute_X_shift, ASL)   \
+    ADDRESSED(0x22, imediate, IGN)           \
+    IMPLIED(0x23, NOP)                       \
+    IMPLIED(0x2B, NOP)                       \
+    ADDRESSED(0x32, zeropage_ptr, AND)       \
+    IMPLIED(0x33, NOP)                       \
+    ADDRESSED(0x34, zeropage_X, BIT)         \
+    ACCUMULATOR(0x3A, DEC)                   \
+    IMPLIED(0x3B, NOP)                       \
+    ADDRESSED(0x3C, absolute_X, BIT)         \
+    ADDRESSED(0x3E, absolute_X_shift, ROL)   \
+    ADDRESSED(0x42, imediate, IGN)           \
+    IMPLIED(0x43, NOP)                       \
+    ADDRESSED(0x44, zeropage, IGN)           \
+    IMPLIED(0x4B, NOP)                       \
+    ADDRESSED(0x52, zeropage_ptr, EOR)       \
+    IMPLIED(0x53, NOP)                       \
+    ADDRESSED(0x54, zeropage_X, IGN)         \
+    IMPLIED(0x5A, PHY)                       \
+    IMPLIED(0x5B, NOP)                       \
+    ADDRESSED(0x5C, absolute, IGN)           \
+    ADDRESSED(0x5E, absolute_X_shift, LSR)   \
+    ADDRESSED(0x62, imediate, IGN)           \
+    IMPLIED(0x63, NOP)                       \
+    ADDRESSED(0x64, zeropage, STZ)           \
+    IMPLIED(0x6B, NOP)                       \
+    ADDRESSED(0x6C, absolute_ptr, JMP)       \
+    ADDRESSED(0x72, zeropage_ptr, ADC)       \
+    IMPLIED(0x73, NOP)                       \
+    ADDRESSED(0x74, zeropage_X, STZ)         \
+    IMPLIED(0x7A, PLY)                       \
+    IMPLIED(0x7B, NOP)                       \
+    ADDRESSED(0x7C, absolute_X_ptr, JMP)     \
+    ADDRESSED(0x7E, absolute_X_shift, ROR)   \
+    ADDRESSED(0x80, imediate, BRA)           \
+    ADDRESSED(0x82, imediate, IGN)           \
+    IMPLIED(0x83, NOP)                       \
+    ADDRESSED(0x89, imediate, BIT_imediate)  \
+    IMPLIED(0x8B, NOP)                       \
+    ADDRESSED(0x92, zeropage_ptr, STA)       \
+    IMPLIED(0x93, NOP)                       \
+    IMPLIED(0x9B, NOP)                       \
+    ADDRESSED(0x9C, absolute, STZ)           \
+    ADDRESSED(0x9E, absolute_X, STZ)         \
+    IMPLIED(0xA3, NOP)                       \
+    IMPLIED(0xAB, NOP)                       \
+    ADDRESSED(0xB2, zeropage_ptr, LDA)       \
+    IMPLIED(0xB3, NOP)                       \
+    IMPLIED(0xBB, NOP)                       \
+    ADDRESSED(0xC2, imediate, IGN)           \
+    IMPLIED(0xC3, NOP)                       \
+    ADDRESSED(0xD2, zeropage_ptr, CMP)       \
+    IMPLIED(0xD3, NOP)                       \
+    ADDRESSED(0xD4, zeropage_X, IGN)         \
+    IMPLIED(0xDA, PHX)                       \
+    ADDRESSED(0xDC, absolute, IGN)           \
+    ADDRESSED(0xE2, imediate, IGN)           \
+    IMPLIED(0xE3, NOP)                       \
+    IMPLIED(0xEB, NOP)                       \
+    ADDRESSED(0xF2, zeropage_ptr, SBC)       \
+    IMPLIED(0xF3, NOP)                       \
+    ADDRESSED(0xF4, zeropage_X, IGN)         \
+    IMPLIED(0xFA, PLX)                       \
+    IMPLIED(0xFB, NOP)                       \
+    ADDRESSED(0xFC, absolute, IGN)
+
+// Expands the maps making up a variant's instruction set, later entries
+// replacing earlier ones
+#define VARIANT_MAP(V, ADDRESSED, IMPLIED, ACCUMULATOR) \
+    OPCODE_MAP(ADDRESSED, IMPLIED, ACCUMULATOR) \
+    if constexpr (V == Variant::NMOS_ILLEGAL) { \
+        ILLEGAL_OPCODE_MAP(ADDRESSED, IMPLIED, ACCUMULATOR) \
+    } \
+    if constexpr (V == Variant::CMOS_65C02) { \
+        CMOS_OPCODE_MAP(ADDRESSED, IMPLIED, ACCUMULATOR) \
+    }
@@ -0,0 +1,52 @@
+#include "Pacer.h"
+#include <thread>
+#include <algorithm>
+
+Pacer::Pacer(CPU6502& cpu, double frequency, double frame_rate) :
+    _cpu{cpu},
+    _frequency{frequency},
+    _frame_cycles{std::max<uint64_t>(1, frequency / frame_rate)} {}
+
+Pacer::Pacer(Scheduler& scheduler, double frequency, double frame_rate) : Pacer(scheduler.cpu(), frequency, frame_rate) {
+    _scheduler = &scheduler;
+}
+
+RunResult Pacer::run(uint64_t max_cycles) {
+    using Seconds = std::chrono::duration<double>;
+    Clock::time_point start = Clock::now();
+    Clock::time_point run_start = start;
+    uint64_t start_cycles = _cpu.cycles();
+    uint64_t clock_cycles = start_cycles; // the CPU's cycle count at start
+    RunResult total = {StopReason::BUDGET, 0, 0};
+    while (total.cycles < max_cycles) {
+        uint64_t budget = std::min(_frame_cycles, max_cycles - total.cycles);
+        Clock::time_point frame_start = Clock::now();
+        RunResult frame = _scheduler ? _scheduler->run_cycles(budget) : _cpu.run_cycles(budget);
+        Clock::time_point now = Clock::now();
+        total.instructions += frame.instructions;
+        total.cycles += frame.cycles;
+        total.reason = frame.reason;
+
+        double busy = Seconds(now - frame_start).count();
+        _stats.frames++;
+        _stats.busy_seconds += busy;
+        _stats.longest_frame = std::max(_stats.longest_frame, busy);
+        if (frame.reason != StopReason::BUDGET) {
+            break;
+        }
+        auto due = start + std::chrono::duration_cast<Clock::duration>(Seconds((_cpu.cycles() - clock_cycles) / _frequency));
+        if (now < due) {
+            std::this_thread::sleep_until(due);
+            continue;
+        }
+        _stats.late_frames++;
+        if (Seconds(now - due).count() * _frequency > _max_lag * _frame_cycles) {
+            _stats.resyncs++;
+            start = now;
+            clock_cycles = _cpu.cycles();
+        }
+    }
+    _stats.cycles += _cpu.cycles() - start_cycles;
+    _stats.seconds += Seconds(Clock::now() - run_start).count();
+    return total;
+}
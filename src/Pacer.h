@@ -0,0 +1,50 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+#include "CPU6502.h"
+#include "Scheduler.h"
+
+struct PacingStats {
+    uint64_t frames = 0;
+    uint64_t late_frames = 0;   // finished running after the clock said they should have
+    uint64_t resyncs = 0;       // fell so far behind the lost time was given up on
+    uint64_t cycles = 0;
+    double seconds = 0;         // wall time, sleeping included
+    double busy_seconds = 0;    // time spent running the CPU
+    double longest_frame = 0;   // busy seconds of the slowest frame
+    double frequency() { return seconds > 0 ? cycles / seconds : 0; };
+    double mean_frame() { return frames > 0 ? busy_seconds / frames : 0; };
+};
+
+// Runs a CPU at a target clock frequency rather than as fast as it can.
+// Cycles are run in frames, a frame_rate-th of a second's worth at a time,
+// and the thread sleeps until the cycle count the CPU has reached is due.
+// Deadlines are taken from where the run started on the steady clock, not
+// from the previous frame, so oversleeping and the odd instruction running
+// over the end of a frame are made up on the following frames instead of
+// building up.
+//
+// A frame that finishes late is counted and the next one starts straight
+// away to catch up. Once the CPU is more than max_lag frames behind the
+// clock restarts from now rather than running flat out to recover.
+class Pacer {
+    public:
+        Pacer(CPU6502& cpu, double frequency, double frame_rate = 60.0);
+        // Events fire as they come due, through Scheduler::run()
+        Pacer(Scheduler& scheduler, double frequency, double frame_rate = 60.0);
+        // Runs up to max_cycles, ending early like CPU6502::run() does for
+        // anything other than the budget. The clock restarts on every call,
+        // so time spent between calls is not caught up on.
+        RunResult run(uint64_t max_cycles = UINT64_MAX);
+        PacingStats& stats() { return _stats; };
+        void set_max_lag(double frames) { _max_lag = frames; };
+    private:
+        using Clock = std::chrono::steady_clock;
+        CPU6502& _cpu;
+        Scheduler* _scheduler = nullptr;
+        double _frequency;
+        uint64_t _frame_cycles;
+        double _max_lag = 4.0;
+        PacingStats _stats;
+};
@@ -0,0 +1,79 @@
+#include "Profiler.h"
+#include <vector>
+#include <cinttypes>
+#include <numeric>
+#include <algorithm>
+
+void Profiler::start(uint16_t PC, uint64_t cycles) {
+    _depth = 0;
+    _frames[0] = {PC, cycles};
+    _last_cycles = cycles;
+}
+
+void Profiler::call(uint16_t routine, uint64_t cycles) {
+    routine_calls[routine]++;
+    _depth++;
+    _frames[_depth & 0xFF] = {routine, cycles};
+}
+
+void Profiler::ret(uint64_t cycles) {
+    if (_depth == 0) {
+        // an RTS used as a computed jump, there is no frame to leave
+        return;
+    }
+    Frame& frame = _frames[_depth & 0xFF];
+    routine_inclusive_cycles[frame.routine] += cycles - frame.entry_cycles;
+    _depth--;
+}
+
+// Indices of the top largest non-zero counts, largest first
+template <size_t N>
+static std::vector<uint32_t> hottest(const std::array<uint64_t, N>& counts, size_t top) {
+    std::vector<uint32_t> indices(N);
+    std::iota(indices.begin(), indices.end(), 0);
+    top = std::min(top, indices.size());
+    std::partial_sort(indices.begin(), indices.begin() + top, indices.end(),
+        [&](uint32_t a, uint32_t b) { return counts[a] > counts[b]; });
+    indices.resize(top);
+    while (!indices.empty() && counts[indices.back()] == 0) {
+        indices.pop_back();
+    }
+    return indices;
+}
+
+void Profiler::report(FILE* out, size_t top) {
+    uint64_t total_cycles = std::accumulate(routine_self_cycles.begin(), routine_self_cycles.end(), uint64_t{0});
+    uint64_t total_instructions = std::accumulate(opcode_counts.begin(), opcode_counts.end(), uint64_t{0});
+    double cycle_percent = total_cycles ? 100.0 / total_cycles : 0;
+    double instruction_percent = total_instructions ? 100.0 / total_instructions : 0;
+    // routines that have not returned yet, including the one the profiler
+    // started in, have run for everything since they were entered
+    std::vector<uint64_t> inclusive(routine_inclusive_cycles.begin(), routine_inclusive_cycles.end());
+    for (uint64_t depth = _depth >= _frames.size() ? _depth - _frames.size() + 1 : 0; depth <= _depth; depth++) {
+        const Frame& frame = _frames[depth & 0xFF];
+        inclusive[frame.routine] += _last_cycles - frame.entry_cycles;
+    }
+
+    fprintf(out, "Hottest routines by self cycles (%" PRIu64 " cycles)\n", total_cycles);
+    fprintf(out, "%-8s %12s %16s %7s %16s %7s\n", "routine", "calls", "self cycles", "self%", "incl cycles", "incl%");
+    for (uint32_t routine : hottest(routine_self_cycles, top)) {
+        fprintf(out, "%04x     %12" PRIu64 " %16" PRIu64 " %6.2f%% %16" PRIu64 " %6.2f%%\n", routine,
+            routine_calls[routine],
+            routine_self_cycles[routine], routine_self_cycles[routine] * cycle_percent,
+            inclusive[routine], inclusive[routine] * cycle_percent);
+    }
+
+    fprintf(out, "\nHottest addresses (%" PRIu64 " instructions)\n", total_instructions);
+    fprintf(out, "%-8s %16s %7s\n", "address", "executed", "%");
+    for (uint32_t address : hottest(address_counts, top)) {
+        fprintf(out, "%04x     %16" PRIu64 " %6.2f%%\n", address,
+            address_counts[address], address_counts[address] * instruction_percent);
+    }
+
+    fprintf(out, "\nHottest opcodes\n");
+    fprintf(out, "%-8s %16s %7s\n", "opcode", "executed", "%");
+    for (uint32_t opcode : hottest(opcode_counts, top)) {
+        fprintf(out, "%02x       %16" PRIu64 " %6.2f%%\n", opcode,
+            opcode_counts[opcode], opcode_counts[opcode] * instruction_percent);
+    }
+}
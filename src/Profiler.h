@@ -0,0 +1,45 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstdio>
+
+// Counts what a guest program spends its time on: how often each opcode
+// and each address is executed, and how many cycles each subroutine takes.
+// Everything is a flat array indexed by opcode or address, so recording an
+// instruction is a few increments with no hashing or allocation.
+//
+// Subroutines are the targets of JSR. Self cycles are those spent in a
+// routine's own instructions, inclusive cycles add everything it calls.
+// Code that runs before the first JSR is counted against the address the
+// profiler was attached at.
+class Profiler {
+    public:
+        std::array<uint64_t, 256> opcode_counts{};
+        std::array<uint64_t, 0x10000> address_counts{};
+        std::array<uint64_t, 0x10000> routine_calls{};
+        std::array<uint64_t, 0x10000> routine_self_cycles{};
+        std::array<uint64_t, 0x10000> routine_inclusive_cycles{};
+
+        // Called by the CPU, cycles is the counter before the instruction
+        void instruction(uint16_t PC, uint8_t opcode, uint64_t cycles) {
+            opcode_counts[opcode]++;
+            address_counts[PC]++;
+            routine_self_cycles[_frames[_depth & 0xFF].routine] += cycles - _last_cycles;
+            _last_cycles = cycles;
+        };
+        void call(uint16_t routine, uint64_t cycles);
+        void ret(uint64_t cycles);
+        void start(uint16_t PC, uint64_t cycles);
+        // Prints the hottest routines, addresses and opcodes, top of each
+        void report(FILE* out, size_t top = 20);
+    private:
+        struct Frame {
+            uint16_t routine;
+            uint64_t entry_cycles;
+        };
+        // Shadow call stack, a guest can only nest 128 deep before its own
+        // stack wraps so deeper frames just overwrite the oldest
+        std::array<Frame, 256> _frames{};
+        uint64_t _depth = 0;
+        uint64_t _last_cycles = 0;
+};
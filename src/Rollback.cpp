@@ -0,0 +1,90 @@
+#include "Rollback.h"
+#include <algorithm>
+
+using Seconds = std::chrono::duration<double>;
+
+Rollback::Rollback(CPU6502& cpu, uint64_t frame_cycles, ApplyInput apply_input, unsigned run_ahead, unsigned depth, double budget) :
+    _cpu{cpu},
+    _frame_cycles{std::max<uint64_t>(1, frame_cycles)},
+    _first_cycle{cpu.cycles()},
+    _apply_input{std::move(apply_input)},
+    _run_ahead{run_ahead},
+    _depth{std::max(1u, depth)},
+    _budget{budget},
+    _slots(_depth + _run_ahead + 1)
+{
+    slot(0).start = _cpu.snapshot();
+}
+
+RunResult Rollback::advance(Input input) {
+    Clock::time_point start = Clock::now();
+    uint64_t frame = _frame++;
+    if (_run_to > frame && slot(frame).input != input) {
+        _stats.mispredictions++;
+        rewind(frame);
+    }
+    slot(frame).input = input;
+    if (_run_to == frame) {
+        run_frame();
+    }
+    run_ahead(input);
+
+    double seconds = Seconds(Clock::now() - start).count();
+    _stats.frames++;
+    _stats.last_seconds = seconds;
+    _stats.longest_seconds = std::max(_stats.longest_seconds, seconds);
+    _stats.total_seconds += seconds;
+    _stats.over_budget += seconds > _budget;
+    return slot(frame).result;
+}
+
+bool Rollback::correct(uint64_t frame, Input input) {
+    if (frame >= _frame || _frame - frame > _depth) {
+        return false;
+    }
+    if (slot(frame).input == input) {
+        return true;
+    }
+    _stats.corrections++;
+    rewind(frame);
+    slot(frame).input = input;
+    while (_run_to < _frame) {
+        run_frame();
+    }
+    run_ahead(slot(_frame - 1).input);
+    return true;
+}
+
+void Rollback::run_frame() {
+    Slot& current = slot(_run_to);
+    _apply_input(_cpu, current.input);
+    uint64_t end = _first_cycle + (_run_to + 1) * _frame_cycles;
+    current.result = _cpu.run_cycles(end > _cpu.cycles() ? end - _cpu.cycles() : 0);
+    if (current.result.reason == StopReason::TRAP && _cpu.cycles() < end) {
+        // an idle jump to self still runs out the frame, the next frame's
+        // input may raise an interrupt that gets it out
+        _cpu.set_trap_self_loops(false);
+        RunResult rest = _cpu.run_cycles(end - _cpu.cycles());
+        _cpu.set_trap_self_loops(true);
+        current.result = {rest.reason, current.result.instructions + rest.instructions, current.result.cycles + rest.cycles};
+    }
+    _stats.frames_run++;
+    _run_to++;
+    Clock::time_point start = Clock::now();
+    slot(_run_to).start = _cpu.snapshot();
+    _stats.state_seconds += Seconds(Clock::now() - start).count();
+}
+
+void Rollback::rewind(uint64_t frame) {
+    Clock::time_point start = Clock::now();
+    _cpu.restore(slot(frame).start);
+    _stats.state_seconds += Seconds(Clock::now() - start).count();
+    _run_to = frame;
+}
+
+void Rollback::run_ahead(Input prediction) {
+    while (_run_to < _frame + _run_ahead) {
+        slot(_run_to).input = prediction;
+        run_frame();
+    }
+}
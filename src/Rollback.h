@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#include "CPU6502.h"
+
+struct RollbackStats {
+    uint64_t frames = 0;          // advanced with real input
+    uint64_t mispredictions = 0;  // run ahead with an input that turned out wrong
+    uint64_t corrections = 0;     // rolled back by correct()
+    uint64_t frames_run = 0;      // every frame emulated, reruns and run-ahead included
+    uint64_t over_budget = 0;     // advance() calls that took longer than the budget
+    double last_seconds = 0;      // the last advance() call
+    double longest_seconds = 0;
+    double total_seconds = 0;
+    double state_seconds = 0;     // spent taking and restoring snapshots
+};
+
+// Runs a CPU a frame at a time and keeps snapshots of the starts of recent
+// frames, so frames can be run ahead of the input and run again when the
+// input turns out different. Snapshots share the pages they have in common,
+// so keeping one costs the pages written during its frame.
+//
+// Every frame ends at a fixed cycle count from the first, even when the CPU
+// idles in a jump to self, and each frame is given its input at its start
+// through apply_input, so running a frame again from its snapshot with the
+// same input gives the same state. Only
+// the CPU and its RAM are rolled back, anything else a frame depends on,
+// such as device state behind I/O pages, has to come from the input.
+//
+// advance() confirms the input for the next frame and runs run_ahead frames
+// past it guessing the input stays the same. When the guess holds the frames
+// already run ahead are kept, otherwise the CPU goes back to the start of
+// the frame and runs them again. Up to depth confirmed frames are kept
+// for correct() to change an earlier frame's input.
+class Rollback {
+    public:
+        using Input = uint32_t;
+        using ApplyInput = std::function<void(CPU6502&, Input)>;
+        Rollback(CPU6502& cpu, uint64_t frame_cycles, ApplyInput apply_input,
+                 unsigned run_ahead = 1, unsigned depth = 8, double budget = 1.0 / 60);
+        Rollback(const Rollback&) = delete;
+        Rollback& operator=(const Rollback&) = delete;
+        // Runs the next frame with input and leaves the CPU run_ahead frames
+        // past it. The result is the confirmed frame's, however long ago it
+        // was actually run.
+        RunResult advance(Input input);
+        // Changes the input of one of the last depth frames advanced and
+        // runs everything since it again, false if it is older than that
+        bool correct(uint64_t frame, Input input);
+        // Frames advanced, the CPU is run_ahead frames further on
+        uint64_t frame() { return _frame; };
+        RollbackStats& stats() { return _stats; };
+    private:
+        using Clock = std::chrono::steady_clock;
+        struct Slot {
+            Snapshot start;
+            Input input;
+            RunResult result;
+        };
+        CPU6502& _cpu;
+        uint64_t _frame_cycles;
+        uint64_t _first_cycle;
+        ApplyInput _apply_input;
+        unsigned _run_ahead;
+        unsigned _depth;
+        double _budget;
+        // The start of every frame from depth frames back to the one the CPU
+        // is at, indexed by frame number modulo its size
+        std::vector<Slot> _slots;
+        uint64_t _frame = 0;
+        uint64_t _run_to = 0; // frame the CPU is at the start of
+        RollbackStats _stats;
+        Slot& slot(uint64_t frame) { return _slots[frame % _slots.size()]; };
+        // Runs frame _run_to with its slot's input and snapshots the next
+        void run_frame();
+        // Puts the CPU back at the start of frame
+        void rewind(uint64_t frame);
+        void run_ahead(Input prediction);
+};
@@ -0,0 +1,236 @@
+#include "RomImage.h"
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+constexpr char INES_MAGIC[4] = {'N', 'E', 'S', 0x1A};
+constexpr size_t INES_HEADER_SIZE = 16;
+constexpr size_t INES_TRAINER_SIZE = 512;
+constexpr size_t INES_PRG_BANK_SIZE = 0x4000;
+constexpr uint8_t INES_TRAINER = 0x04;
+
+constexpr uint8_t IHEX_DATA = 0x00;
+constexpr uint8_t IHEX_END_OF_FILE = 0x01;
+constexpr uint8_t IHEX_SEGMENT_ADDRESS = 0x02;
+constexpr uint8_t IHEX_LINEAR_ADDRESS = 0x04;
+
+static bool has_extension(const std::string& path, const char* extension) {
+    size_t length = std::strlen(extension);
+    if (path.size() < length) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (std::tolower(static_cast<unsigned char>(path[path.size() - length + i])) != extension[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int hex_digit(uint8_t c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// -1 if either character is not a hex digit
+static int hex_byte(const uint8_t* text) {
+    int high = hex_digit(text[0]);
+    int low = hex_digit(text[1]);
+    return high < 0 || low < 0 ? -1 : high << 4 | low;
+}
+
+RomImage::RomImage(const std::string& path, uint16_t load_address, ImageFormat format) : _format{format} {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        _error = "could not open " + path;
+        return;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        _error = "empty or unreadable image " + path;
+        close(fd);
+        return;
+    }
+    _file_size = status.st_size;
+    void* file = mmap(nullptr, _file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive on its own
+    close(fd);
+    if (file == MAP_FAILED) {
+        _error = "could not map " + path;
+        _file_size = 0;
+        return;
+    }
+    _file = static_cast<const uint8_t*>(file);
+
+    if (_format == ImageFormat::DETECT) {
+        if (_file_size >= sizeof(INES_MAGIC) && std::memcmp(_file, INES_MAGIC, sizeof(INES_MAGIC)) == 0) {
+            _format = ImageFormat::INES;
+        }
+        else if (has_extension(path, ".hex") || has_extension(path, ".ihx") || has_extension(path, ".ihex")) {
+            _format = ImageFormat::IHEX;
+        }
+        else {
+            _format = ImageFormat::RAW;
+        }
+    }
+    switch (_format) {
+        case ImageFormat::IHEX: load_ihex(); break;
+        case ImageFormat::INES: load_ines(); break;
+        default: load_raw(load_address); break;
+    }
+    if (!_error.empty()) {
+        _error = path + ": " + _error;
+        _segments.clear();
+    }
+}
+
+RomImage::~RomImage() {
+    if (_file != nullptr) {
+        munmap(const_cast<uint8_t*>(_file), _file_size);
+    }
+}
+
+void RomImage::load_raw(uint16_t load_address) {
+    size_t length = std::min<size_t>(_file_size, MEMORY_SIZE - load_address);
+    _segments.push_back({load_address, {_file, length}});
+}
+
+void RomImage::load_ines() {
+    if (_file_size < INES_HEADER_SIZE || std::memcmp(_file, INES_MAGIC, sizeof(INES_MAGIC)) != 0) {
+        _error = "not an iNES image";
+        return;
+    }
+    size_t banks = _file[4];
+    size_t offset = INES_HEADER_SIZE + (_file[6] & INES_TRAINER ? INES_TRAINER_SIZE : 0);
+    if (banks == 0 || _file_size < offset + banks * INES_PRG_BANK_SIZE) {
+        _error = "truncated PRG ROM";
+        return;
+    }
+    // Without a mapper only two banks fit, most mappers power up with the
+    // last one fixed at 0xC000 and a 16 KiB image is mirrored into both
+    const uint8_t* prg = _file + offset;
+    _segments.push_back({0x8000, {prg, INES_PRG_BANK_SIZE}});
+    _segments.push_back({0xC000, {prg + (banks - 1) * INES_PRG_BANK_SIZE, INES_PRG_BANK_SIZE}});
+}
+
+void RomImage::load_ihex() {
+    _decoded.assign(MEMORY_SIZE, 0);
+    std::vector<bool> covered(MEMORY_SIZE, false);
+    uint32_t base = 0;
+    size_t position = 0;
+    size_t line = 1;
+    bool ended = false;
+    while (!ended) {
+        while (position < _file_size && std::isspace(_file[position])) {
+            line += _file[position] == '\n';
+            position++;
+        }
+        if (position == _file_size) {
+            break;
+        }
+        const uint8_t* record = _file + position + 1;
+        int length = _file[position] == ':' && position + 11 <= _file_size ? hex_byte(record) : -1;
+        if (length < 0 || position + 11 + 2 * length > _file_size) {
+            _error = "bad record on line " + std::to_string(line);
+            return;
+        }
+        // length, address, type, data and checksum bytes all sum to zero
+        uint8_t bytes[0x105];
+        uint8_t sum = 0;
+        for (int i = 0; i < length + 5; i++) {
+            int value = hex_byte(record + 2 * i);
+            if (value < 0) {
+                _error = "bad record on line " + std::to_string(line);
+                return;
+            }
+            bytes[i] = value;
+            sum += value;
+        }
+        if (sum != 0) {
+            _error = "bad checksum on line " + std::to_string(line);
+            return;
+        }
+        uint32_t offset = bytes[1] << 8 | bytes[2];
+        switch (bytes[3]) {
+            case IHEX_DATA:
+                if (base >= MEMORY_SIZE || size_t(base) + offset + length > MEMORY_SIZE) {
+                    _error = "data above 64 KiB on line " + std::to_string(line);
+                    return;
+                }
+                std::memcpy(_decoded.data() + base + offset, bytes + 4, length);
+                std::fill_n(covered.begin() + base + offset, length, true);
+                break;
+            case IHEX_END_OF_FILE:
+                ended = true;
+                break;
+            case IHEX_SEGMENT_ADDRESS:
+            case IHEX_LINEAR_ADDRESS:
+                if (length != 2) {
+                    _error = "bad record on line " + std::to_string(line);
+                    return;
+                }
+                base = (bytes[4] << 8 | bytes[5]) << (bytes[3] == IHEX_SEGMENT_ADDRESS ? 4 : 16);
+                break;
+            default:
+                // start addresses, the entry point comes from the reset vector
+                break;
+        }
+        position += 11 + 2 * length;
+    }
+    for (uint32_t address = 0; address < MEMORY_SIZE;) {
+        if (!covered[address]) {
+            address++;
+            continue;
+        }
+        uint32_t end = address;
+        while (end < MEMORY_SIZE && covered[end]) {
+            end++;
+        }
+        _segments.push_back({static_cast<uint16_t>(address), {_decoded.data() + address, end - address}});
+        address = end;
+    }
+}
+
+std::optional<uint16_t> RomImage::reset_vector() {
+    for (const Segment& segment : _segments) {
+        if (segment.address <= 0xFFFC && segment.address + segment.data.size() > 0xFFFD) {
+            const uint8_t* vector = segment.data.data() + (0xFFFC - segment.address);
+            return vector[0] | vector[1] << 8;
+        }
+    }
+    return std::nullopt;
+}
+
+void RomImage::copy_to(std::span<uint8_t, MEMORY_SIZE> memory) {
+    for (const Segment& segment : _segments) {
+        std::memcpy(memory.data() + segment.address, segment.data.data(), segment.data.size());
+    }
+}
+
+void RomImage::map(CPU6502& cpu) {
+    auto memory = cpu.memory();
+    for (const Segment& segment : _segments) {
+        uint32_t start = segment.address;
+        uint32_t end = start + segment.data.size();
+        uint32_t first_page = (start + PAGE_SIZE - 1) / PAGE_SIZE;
+        uint32_t end_page = end / PAGE_SIZE;
+        if (first_page < end_page) {
+            cpu.bus().map_rom(first_page, end_page - first_page, segment.data.data() + (first_page * PAGE_SIZE - start));
+        }
+        // the ragged ends go into RAM
+        for (uint32_t address = start; address < end; address++) {
+            uint32_t page = address / PAGE_SIZE;
+            if (page < first_page || page >= end_page) {
+                memory[address] = segment.data[address - start];
+                cpu.bus().touch(page);
+            }
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+
+#include "CPU6502.h"
+
+enum class ImageFormat {
+    DETECT, // iNES by its magic, Intel HEX by a .hex, .ihx or .ihex extension, raw otherwise
+    RAW,    // bytes placed at the load address, cut off at the top of memory
+    IHEX,   // Intel HEX, data records below 64 KiB
+    INES,   // the first PRG bank at 0x8000 and the last at 0xC000
+};
+
+// A run of image bytes and the address they belong at
+struct Segment {
+    uint16_t address;
+    std::span<const uint8_t> data;
+};
+
+// An image file mapped read only. Raw and iNES segments point straight into
+// the mapping and Intel HEX is decoded once into a buffer the image owns,
+// so one RomImage can be loaded into or mapped by any number of CPUs
+// without reading the file again, and must outlive them.
+class RomImage {
+    public:
+        RomImage(const std::string& path, uint16_t load_address = 0x0000, ImageFormat format = ImageFormat::DETECT);
+        RomImage(const RomImage&) = delete;
+        RomImage& operator=(const RomImage&) = delete;
+        ~RomImage();
+        bool ok() { return _error.empty(); };
+        const std::string& error() { return _error; };
+        ImageFormat format() { return _format; };
+        const std::vector<Segment>& segments() { return _segments; };
+        // From the bytes at 0xFFFC, if the image covers them
+        std::optional<uint16_t> reset_vector();
+        uint16_t entry_point(uint16_t fallback) { return reset_vector().value_or(fallback); };
+        // Copies every segment into memory
+        void copy_to(std::span<uint8_t, MEMORY_SIZE> memory);
+        // Maps the pages the image fully covers onto the bus as ROM, shared
+        // with every other CPU mapping the same image, and copies the bytes
+        // of partly covered pages into the CPU's RAM
+        void map(CPU6502& cpu);
+    private:
+        std::string _error;
+        ImageFormat _format;
+        const uint8_t* _file = nullptr;
+        size_t _file_size = 0;
+        std::vector<uint8_t> _decoded; // Intel HEX data by address
+        std::vector<Segment> _segments;
+        void load_raw(uint16_t load_address);
+        void load_ihex();
+        void load_ines();
+};
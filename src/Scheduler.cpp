@@ -0,0 +1,74 @@
+#include "Scheduler.h"
+#include <algorithm>
+
+// Orders the heap so the earliest event is at the front
+static constexpr auto later = [](const auto& a, const auto& b) {
+    return a.cycle != b.cycle ? a.cycle > b.cycle : a.id > b.id;
+};
+
+Scheduler::EventId Scheduler::schedule(uint64_t cycle, std::function<void()> callback) {
+    EventId id = _next_id++;
+    _heap.push_back({cycle, id, std::move(callback)});
+    std::push_heap(_heap.begin(), _heap.end(), later);
+    return id;
+}
+
+void Scheduler::cancel(EventId id) {
+    for (Event& event : _heap) {
+        if (event.id == id) {
+            event.callback = nullptr;
+            break;
+        }
+    }
+    drop_cancelled();
+}
+
+uint64_t Scheduler::next_deadline() {
+    return _heap.empty() ? UINT64_MAX : _heap.front().cycle;
+}
+
+void Scheduler::drop_cancelled() {
+    while (!_heap.empty() && !_heap.front().callback) {
+        std::pop_heap(_heap.begin(), _heap.end(), later);
+        _heap.pop_back();
+    }
+}
+
+void Scheduler::fire_due() {
+    while (!_heap.empty() && _heap.front().cycle <= _cpu.cycles()) {
+        std::pop_heap(_heap.begin(), _heap.end(), later);
+        std::function<void()> callback = std::move(_heap.back().callback);
+        _heap.pop_back();
+        // the callback may schedule or cancel events itself
+        callback();
+        drop_cancelled();
+    }
+}
+
+RunResult Scheduler::run(uint64_t max_instructions, uint64_t max_cycles, Dispatch dispatch) {
+    uint64_t start_cycles = _cpu.cycles();
+    uint64_t cycle_limit = (max_cycles > UINT64_MAX - start_cycles) ? UINT64_MAX : start_cycles + max_cycles;
+    uint64_t executed = 0;
+    bool spinning = false;
+    while (true) {
+        fire_due();
+        if (executed >= max_instructions || _cpu.cycles() >= cycle_limit) {
+            return {StopReason::BUDGET, executed, _cpu.cycles() - start_cycles};
+        }
+        uint64_t until = std::min(cycle_limit, next_deadline());
+        // A trapped jump to self would stop every instruction, so spin
+        // straight through to the next event and trap again after it
+        if (spinning) {
+            _cpu.set_trap_self_loops(false);
+        }
+        RunResult step = _cpu.run(max_instructions - executed, until - _cpu.cycles(), dispatch);
+        if (spinning) {
+            _cpu.set_trap_self_loops(true);
+        }
+        executed += step.instructions;
+        spinning = step.reason == StopReason::TRAP;
+        if (step.reason != StopReason::BUDGET && (step.reason != StopReason::TRAP || _heap.empty())) {
+            return {step.reason, executed, _cpu.cycles() - start_cycles};
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+#include "CPU6502.h"
+
+// Runs a CPU alongside cycle timed device events. Events are kept in a
+// binary min-heap keyed by the absolute cycle count they are due at, and the
+// CPU runs straight up to the earliest one rather than devices polling every
+// instruction.
+//
+// An event fires at the first instruction boundary at or after its cycle,
+// the same boundary interrupts are sampled at, so a timer raising an IRQ
+// from its callback has it taken before the next instruction. Callbacks can
+// schedule further events, including themselves for periodic devices.
+class Scheduler {
+    public:
+        using EventId = uint64_t;
+        Scheduler(CPU6502& cpu) : _cpu{cpu} {};
+        Scheduler(const Scheduler&) = delete;
+        Scheduler& operator=(const Scheduler&) = delete;
+        // Calls callback once the CPU's cycle counter reaches cycle, straight
+        // away on the next run if it already has
+        EventId schedule(uint64_t cycle, std::function<void()> callback);
+        // Calls callback cycles from now
+        EventId schedule_in(uint64_t cycles, std::function<void()> callback) {
+            return schedule(_cpu.cycles() + cycles, std::move(callback));
+        };
+        // Does nothing if the event has already fired or been cancelled. Looks
+        // through every scheduled event, there are only ever a few.
+        void cancel(EventId id);
+        // Cycle the next event is due at, UINT64_MAX if none are scheduled
+        uint64_t next_deadline();
+        // Runs up to max_instructions or max_cycles like CPU6502::run(),
+        // firing events as they come due. A jump to self only ends the run
+        // when nothing is scheduled, otherwise the CPU spins up to the next
+        // event in one go as it may raise an interrupt that gets it out.
+        // Other traps always end it.
+        RunResult run(uint64_t max_instructions, uint64_t max_cycles, Dispatch dispatch = CPU6502::default_dispatch());
+        RunResult run_cycles(uint64_t max_cycles) { return run(UINT64_MAX, max_cycles); };
+        CPU6502& cpu() { return _cpu; };
+    private:
+        struct Event {
+            uint64_t cycle;
+            EventId id; // also orders events due on the same cycle
+            std::function<void()> callback; // empty once cancelled
+        };
+        CPU6502& _cpu;
+        std::vector<Event> _heap;
+        EventId _next_id = 0;
+        // Fires every event due by the current cycle
+        void fire_due();
+        // Drops cancelled events from the top of the heap
+        void drop_cancelled();
+};
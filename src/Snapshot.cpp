@@ -0,0 +1,52 @@
+#include "CPU6502.h"
+#include <cstring>
+
+Snapshot CPU6502::snapshot() {
+    Snapshot snapshot = {_A, _X, _Y, status(), _S, _PC.PC, _cycles, _irq_line, _nmi_line, _events & (NMI_EVENT | RESET_EVENT), {}};
+    const auto& generations = _bus.store_generations();
+    for (int page = 0; page < PAGE_COUNT; page++) {
+        if (!ram_mapped(page)) {
+            // whatever is under ROM, I/O or other memory is not the machine's state
+            _snapshot_pages[page] = nullptr;
+        }
+        else if (generations[page] != _snapshot_generations[page] || _snapshot_pages[page] == nullptr) {
+            auto copy = std::make_shared<Page>();
+            std::memcpy(copy->data(), _ram + page * PAGE_SIZE, PAGE_SIZE);
+            _snapshot_pages[page] = std::move(copy);
+        }
+        snapshot.pages[page] = _snapshot_pages[page];
+    }
+    _snapshot_generations = generations;
+    return snapshot;
+}
+
+void CPU6502::restore(const Snapshot& snapshot) {
+    _A = snapshot.A;
+    _X = snapshot.X;
+    _Y = snapshot.Y;
+    _irq_line = snapshot.irq_line;
+    _nmi_line = snapshot.nmi_line;
+    _events = (_events & ~(NMI_EVENT | RESET_EVENT)) | snapshot.pending;
+    set_status(snapshot.P); // brings IRQ_EVENT up to date
+    _S = snapshot.S;
+    _PC.PC = snapshot.PC;
+    _cycles = snapshot.cycles;
+    const auto& generations = _bus.store_generations();
+    for (int page = 0; page < PAGE_COUNT; page++) {
+        // pages that are not RAM now, or were not when the snapshot was
+        // taken, are left alone and copied again by the next snapshot
+        if (snapshot.pages[page] == nullptr || !ram_mapped(page)) {
+            _snapshot_pages[page] = nullptr;
+        }
+        // RAM still holds _snapshot_pages wherever it has not been written
+        // since, so only those pages and pages the two snapshots disagree
+        // on need copying
+        else if (generations[page] != _snapshot_generations[page] || _snapshot_pages[page] != snapshot.pages[page]) {
+            std::memcpy(_ram + page * PAGE_SIZE, snapshot.pages[page]->data(), PAGE_SIZE);
+            _snapshot_pages[page] = snapshot.pages[page];
+            _bus.touch(page);
+        }
+    }
+    // the copies are writes as far as anyone else watching is concerned
+    _snapshot_generations = _bus.store_generations();
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <cstdint>
+
+#include "Bus.h"
+
+using Page = std::array<uint8_t, PAGE_SIZE>;
+
+// Full machine state captured by CPU6502::snapshot(). Pages are immutable
+// and shared between snapshots, a snapshot only owns copies of the pages
+// that were written since the one before it. Pages that were not mapped to
+// the CPU's RAM are null.
+struct Snapshot {
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P;
+    uint8_t S;
+    uint16_t PC;
+    uint64_t cycles;
+    bool irq_line;
+    bool nmi_line;
+    uint32_t pending; // NMI and RESET waiting to be taken
+    std::array<std::shared_ptr<const Page>, PAGE_COUNT> pages;
+};
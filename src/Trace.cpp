@@ -0,0 +1,219 @@
+#include "Trace.h"
+#include <cstdint>
+
+#include "CPU6502.h"
+
+constexpr char TRACE_MAGIC[8] = {'6', '5', '0', '2', 'T', 'R', 'C', 2};
+
+constexpr uint8_t PC_PRESENT = 0x01;
+constexpr uint8_t A_PRESENT = 0x02;
+constexpr uint8_t X_PRESENT = 0x04;
+constexpr uint8_t Y_PRESENT = 0x08;
+constexpr uint8_t P_PRESENT = 0x10;
+constexpr uint8_t S_PRESENT = 0x20;
+constexpr uint8_t ADDRESS_PRESENT = 0x40;
+
+// Writer
+
+TraceWriter::TraceWriter(const std::string& path, Variant variant, size_t chunk_records, size_t chunks) :
+    _variant{variant}, _chunk_records{chunk_records > 0 ? chunk_records : 1}
+{
+    // one chunk is always being filled so at least one more is needed for
+    // the writer thread to work on
+    chunks = chunks < 2 ? 2 : chunks;
+    _buffer.resize(_chunk_records * chunks);
+    _fill = _buffer.data();
+    _chunk_end = _fill + _chunk_records;
+    _file = fopen(path.c_str(), "wb");
+    if (_file != nullptr) {
+        fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), _file);
+        fputc(static_cast<int>(variant), _file);
+    }
+    _thread = std::thread(&TraceWriter::write_chunks, this);
+}
+
+TraceWriter::~TraceWriter() {
+    flush();
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stopping = true;
+    }
+    _changed.notify_all();
+    _thread.join();
+    if (_file != nullptr) {
+        fclose(_file);
+    }
+}
+
+void TraceWriter::next_chunk() {
+    hand_off(_chunk_records);
+}
+
+void TraceWriter::flush() {
+    hand_off(_fill - (_buffer.data() + _chunk * _chunk_records));
+    std::unique_lock<std::mutex> guard(_lock);
+    _changed.wait(guard, [&] { return _full.empty(); });
+    if (_file != nullptr) {
+        fflush(_file);
+    }
+}
+
+// Queues the chunk being filled and moves on to the next one, waiting for
+// the writer if every other chunk is still queued
+void TraceWriter::hand_off(size_t records) {
+    size_t chunks = _buffer.size() / _chunk_records;
+    {
+        std::unique_lock<std::mutex> guard(_lock);
+        if (records > 0) {
+            _full.emplace_back(_chunk, records);
+            _changed.notify_all();
+        }
+        _changed.wait(guard, [&] { return _full.size() < chunks; });
+    }
+    if (records > 0) {
+        _chunk = (_chunk + 1) % chunks;
+    }
+    _fill = _buffer.data() + _chunk * _chunk_records;
+    _chunk_end = _fill + _chunk_records;
+}
+
+void TraceWriter::write_chunks() {
+    while (true) {
+        std::pair<size_t, size_t> chunk;
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _changed.wait(guard, [&] { return !_full.empty() || _stopping; });
+            if (_full.empty()) {
+                return;
+            }
+            chunk = _full.front();
+        }
+        _encoded.clear();
+        const TraceRecord* records = _buffer.data() + chunk.first * _chunk_records;
+        for (size_t i = 0; i < chunk.second; i++) {
+            encode(records[i]);
+        }
+        if (_file != nullptr) {
+            fwrite(_encoded.data(), 1, _encoded.size(), _file);
+        }
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _full.pop_front();
+        }
+        _changed.notify_all();
+    }
+}
+
+void TraceWriter::encode(const TraceRecord& record) {
+    uint8_t flags = 0;
+    uint16_t sequential_PC = _previous.PC + instruction_length(_variant, _previous.opcode);
+    flags |= (_first || record.PC != sequential_PC) ? PC_PRESENT : 0;
+    flags |= (_first || record.A != _previous.A) ? A_PRESENT : 0;
+    flags |= (_first || record.X != _previous.X) ? X_PRESENT : 0;
+    flags |= (_first || record.Y != _previous.Y) ? Y_PRESENT : 0;
+    flags |= (_first || record.P != _previous.P) ? P_PRESENT : 0;
+    flags |= (_first || record.S != _previous.S) ? S_PRESENT : 0;
+    flags |= record.has_address ? ADDRESS_PRESENT : 0;
+    _encoded.push_back(flags);
+    if (flags & PC_PRESENT) {
+        _encoded.push_back(record.PC & 0xFF);
+        _encoded.push_back(record.PC >> 8);
+    }
+    if (flags & A_PRESENT) {
+        _encoded.push_back(record.A);
+    }
+    if (flags & X_PRESENT) {
+        _encoded.push_back(record.X);
+    }
+    if (flags & Y_PRESENT) {
+        _encoded.push_back(record.Y);
+    }
+    if (flags & P_PRESENT) {
+        _encoded.push_back(record.P);
+    }
+    if (flags & S_PRESENT) {
+        _encoded.push_back(record.S);
+    }
+    if (flags & ADDRESS_PRESENT) {
+        _encoded.push_back(record.address & 0xFF);
+        _encoded.push_back(record.address >> 8);
+    }
+    _encoded.push_back(record.opcode);
+    for (int i = 1; i < instruction_length(_variant, record.opcode); i++) {
+        _encoded.push_back(record.operands[i - 1]);
+    }
+    _previous = record;
+    _first = false;
+}
+
+// Reader
+
+TraceReader::TraceReader(const std::string& path) {
+    _file = fopen(path.c_str(), "rb");
+    char magic[sizeof(TRACE_MAGIC)];
+    int variant = EOF;
+    if (_file != nullptr && (fread(magic, 1, sizeof(magic), _file) != sizeof(magic)
+            || std::char_traits<char>::compare(magic, TRACE_MAGIC, sizeof(magic)) != 0
+            || (variant = fgetc(_file)) > static_cast<int>(Variant::CMOS_65C02) || variant < 0)) {
+        fclose(_file);
+        _file = nullptr;
+    }
+    _variant = static_cast<Variant>(variant < 0 ? 0 : variant);
+}
+
+TraceReader::~TraceReader() {
+    if (_file != nullptr) {
+        fclose(_file);
+    }
+}
+
+bool TraceReader::next(TraceRecord& record) {
+    if (_file == nullptr) {
+        return false;
+    }
+    int flags = fgetc(_file);
+    if (flags == EOF) {
+        return false;
+    }
+    record = _previous;
+    if (flags & PC_PRESENT) {
+        record.PC = fgetc(_file);
+        record.PC |= fgetc(_file) << 8;
+    }
+    else {
+        record.PC = _previous.PC + instruction_length(_variant, _previous.opcode);
+    }
+    if (flags & A_PRESENT) {
+        record.A = fgetc(_file);
+    }
+    if (flags & X_PRESENT) {
+        record.X = fgetc(_file);
+    }
+    if (flags & Y_PRESENT) {
+        record.Y = fgetc(_file);
+    }
+    if (flags & P_PRESENT) {
+        record.P = fgetc(_file);
+    }
+    if (flags & S_PRESENT) {
+        record.S = fgetc(_file);
+    }
+    record.has_address = (flags & ADDRESS_PRESENT) ? 1 : 0;
+    record.address = 0;
+    if (flags & ADDRESS_PRESENT) {
+        record.address = fgetc(_file);
+        record.address |= fgetc(_file) << 8;
+    }
+    int opcode = fgetc(_file);
+    if (opcode == EOF) {
+        return false;
+    }
+    record.opcode = opcode;
+    record.operands[0] = 0;
+    record.operands[1] = 0;
+    for (int i = 1; i < instruction_length(_variant, record.opcode); i++) {
+        record.operands[i - 1] = fgetc(_file);
+    }
+    _previous = record;
+    return !feof(_file);
+}
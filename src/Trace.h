@@ -0,0 +1,101 @@
+#pragma once
+#include <array>
+#include <mutex>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <condition_variable>
+
+// One executed instruction, with the registers as they were before it ran
+struct TraceRecord {
+    uint16_t PC;
+    uint16_t address;     // effective address, if has_address is set
+    uint8_t opcode;
+    uint8_t operands[2];  // the two bytes after the opcode, whether used or not
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P;
+    uint8_t S;
+    uint8_t has_address;
+};
+
+enum class Variant : int;
+
+// Length in bytes of each of the variant's opcodes, 1 for invalid ones, used
+// to tell which operand bytes matter and whether the PC moved on
+// sequentially
+uint8_t instruction_length(Variant variant, uint8_t opcode);
+
+// Records instructions into a preallocated ring of fixed size chunks. Full
+// chunks are encoded and written to disk by a background thread, so the
+// CPU thread only fills in records. The CPU blocks if it gets a whole ring
+// ahead of the disk rather than dropping records.
+//
+// File format: the magic "6502TRC" and a version byte, the variant traced
+// as a byte so lengths are read the way they were written, then one record
+// per instruction. Each record starts with a byte of flags saying which fields
+// follow, everything not present is unchanged from the record before:
+//   0x01 PC (2 bytes), otherwise the previous PC plus its instruction length
+//   0x02 A, 0x04 X, 0x08 Y, 0x10 P, 0x20 S (1 byte each)
+//   0x40 effective address (2 bytes)
+// followed by the opcode and its operand bytes. Multi-byte fields are
+// little endian.
+class TraceWriter {
+    public:
+        TraceWriter(const std::string& path, Variant variant, size_t chunk_records = 0x4000, size_t chunks = 8);
+        TraceWriter(const TraceWriter&) = delete;
+        TraceWriter& operator=(const TraceWriter&) = delete;
+        ~TraceWriter();
+        bool ok() { return _file != nullptr; };
+        TraceRecord* next() {
+            if (_fill == _chunk_end) [[unlikely]] {
+                next_chunk();
+            }
+            return _fill++;
+        };
+        // Writes out everything recorded so far
+        void flush();
+    private:
+        FILE* _file;
+        Variant _variant;
+        size_t _chunk_records;
+        std::vector<TraceRecord> _buffer;
+        TraceRecord* _fill;
+        TraceRecord* _chunk_end;
+        size_t _chunk = 0; // chunk being filled
+        // Chunks handed to the writer thread as (chunk, record count)
+        std::mutex _lock;
+        std::condition_variable _changed;
+        std::deque<std::pair<size_t, size_t>> _full;
+        bool _stopping = false;
+        std::thread _thread;
+        // Encoder state, only touched by the writer thread
+        TraceRecord _previous{};
+        bool _first = true;
+        std::vector<uint8_t> _encoded;
+        void next_chunk();
+        void hand_off(size_t records);
+        void write_chunks();
+        void encode(const TraceRecord& record);
+};
+
+// Reads back a file written by TraceWriter
+class TraceReader {
+    public:
+        TraceReader(const std::string& path);
+        TraceReader(const TraceReader&) = delete;
+        TraceReader& operator=(const TraceReader&) = delete;
+        ~TraceReader();
+        bool ok() { return _file != nullptr; };
+        Variant variant() { return _variant; };
+        // Decodes the next record, false at the end of the trace
+        bool next(TraceRecord& record);
+    private:
+        FILE* _file;
+        Variant _variant;
+        TraceRecord _previous{};
+};
@@ -1,54 +1,305 @@
+#include <span>
 #include <array>
 #include <vector>
 #include <chrono>
 #include <thread>
 #include <memory>
 #include <cstdint>
+#include <cstring>
+#include <cinttypes>
 #include <fstream>
+#include <optional>
 #include <iostream>
 #include <iterator>
 
 #include <stdio.h>
 
 #include "CPU6502.h"
+#include "RomImage.h"
+#include "Manifest.h"
+#include "JobRunner.h"
+#include "Pacer.h"
 
-void dump_memory_page(std::shared_ptr<std::array<uint8_t, MEMORY_SIZE>> memory, uint16_t offset) {
+void dump_memory_page(std::span<const uint8_t, MEMORY_SIZE> memory, uint16_t offset) {
     for (int i = 0; i < 0x100; i++) {
-        printf("%02x ", (*memory)[offset + i]);
+        printf("%02x ", memory[offset + i]);
         if (i % 0x10 == 0xF) {
             puts("");
         }
     }
 }
 
+static void usage(const char* name) {
+    std::cout << "Usage : " << name << " --batch <manifest> [--threads <count>]" << std::endl;
+#if defined(CPU6502_TRACE)
+    std::cout << "        " << name << " [--load <address>] [--entry <address>] [--break <address>] [--exit <address>] [--clock <hz>] <path to rom> [path to trace]" << std::endl;
+#else
+    std::cout << "        " << name << " [--load <address>] [--entry <address>] [--break <address>] [--exit <address>] [--clock <hz>] <path to rom>" << std::endl;
+#endif
+    exit(1);
+}
+
+static const char* reason_name(StopReason reason) {
+    switch (reason) {
+        case StopReason::BUDGET: return "budget";
+        case StopReason::INVALID_OPCODE: return "invalid_opcode";
+        case StopReason::TRAP: return "trap";
+        case StopReason::BREAKPOINT: return "breakpoint";
+        case StopReason::EXIT: return "exit";
+        case StopReason::BRK: return "brk";
+    }
+    return "unknown";
+}
+
+static std::string json_string(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        }
+        else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+static bool write_file(const std::string& path, const std::vector<uint8_t>& data) {
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    return bool(file.write(reinterpret_cast<const char*>(data.data()), data.size()));
+}
+
+// Runs every entry in a manifest across the worker threads and prints one
+// JSON object per entry, in manifest order, once they have all finished.
+// Nothing is printed per instruction and memory is only written out to the
+// dump files asked for. A delta dump holds each page written during the
+// run as its page number followed by its 256 bytes, found from the bus
+// store generations with Bus::delta() rather than by comparing memory.
+static int run_batch(const std::string& path, unsigned threads) {
+    Manifest manifest(path);
+    if (!manifest.ok()) {
+        std::cerr << manifest.error() << std::endl;
+        return 1;
+    }
+    const std::vector<ManifestEntry>& entries = manifest.entries();
+    std::vector<std::unique_ptr<RomImage>> images;
+    std::vector<std::string> errors(entries.size());
+    std::vector<std::array<uint32_t, PAGE_COUNT>> loaded_generations(entries.size());
+    std::vector<size_t> job_entries;
+    std::vector<Job> jobs;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const ManifestEntry& entry = entries[i];
+        auto image = std::make_unique<RomImage>(entry.path, entry.load_address, entry.format);
+        if (!image->ok()) {
+            errors[i] = image->error();
+            continue;
+        }
+        Job job;
+        job.entry_point = entry.entry_point.value_or(image->entry_point(0x400));
+        (image->format() == ImageFormat::INES ? job.rom : job.program) = image.get();
+        job.max_instructions = entry.max_instructions;
+        job.variant = entry.variant;
+        // each job only touches its own error so the workers never share one
+        std::string& error = errors[i];
+        std::array<uint32_t, PAGE_COUNT>& loaded = loaded_generations[i];
+        job.setup = [&entry, &error, &loaded](CPU6502& cpu) {
+            loaded = cpu.bus().store_generations();
+            cpu.set_trap_self_loops(entry.trap_self_loops);
+            cpu.set_trap_brk(entry.trap_brk);
+            for (uint16_t breakpoint : entry.breakpoints) {
+                cpu.set_breakpoint(breakpoint);
+            }
+            if (entry.exit_address && !cpu.set_exit_address(entry.exit_address)) {
+                error = "exit address is not RAM";
+            }
+        };
+        if (!entry.dump_path.empty() || !entry.delta_path.empty()) {
+            job.finished = [&entry, &error, &loaded](CPU6502& cpu) {
+                if (!entry.dump_path.empty()) {
+                    std::vector<uint8_t> dump(MEMORY_SIZE);
+                    for (int32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+                        dump[addr] = cpu.bus().peek(addr);
+                    }
+                    if (!write_file(entry.dump_path, dump)) {
+                        error = "could not write " + entry.dump_path;
+                    }
+                }
+                if (!entry.delta_path.empty()) {
+                    if (!write_file(entry.delta_path, cpu.bus().delta(loaded))) {
+                        error = "could not write " + entry.delta_path;
+                    }
+                }
+            };
+        }
+        images.push_back(std::move(image));
+        job_entries.push_back(i);
+        jobs.push_back(std::move(job));
+    }
+
+    BatchResult batch = JobRunner(threads).run(jobs);
+    std::vector<const JobResult*> results(entries.size(), nullptr);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        results[job_entries[i]] = &batch.results[i];
+    }
+    std::string output;
+    char line[512];
+    for (size_t i = 0; i < entries.size(); i++) {
+        output += "{\"rom\":" + json_string(entries[i].path);
+        if (const JobResult* result = results[i]) {
+            double mips = result->seconds > 0 ? result->run.instructions / result->seconds / 1e6 : 0;
+            snprintf(line, sizeof(line),
+                ",\"reason\":\"%s\",\"instructions\":%" PRIu64 ",\"cycles\":%" PRIu64 ",\"seconds\":%.6f,\"mips\":%.2f"
+                ",\"A\":%u,\"X\":%u,\"Y\":%u,\"P\":%u,\"S\":%u,\"PC\":%u",
+                reason_name(result->run.reason), result->run.instructions, result->run.cycles, result->seconds, mips,
+                result->A, result->X, result->Y, result->P, result->S, result->PC);
+            output += line;
+        }
+        if (!errors[i].empty()) {
+            output += ",\"error\":" + json_string(errors[i]);
+        }
+        output += "}\n";
+    }
+    fwrite(output.data(), 1, output.size(), stdout);
+    return 0;
+}
+
 int main(int argc, char**argv) {
+    // Raw images default to the functional test's layout
+    uint16_t load_address = 0x000a;
+    std::optional<uint16_t> entry_point;
+    std::optional<uint16_t> exit_address;
+    std::vector<uint16_t> breakpoints;
+    double clock = 0;
+    std::string batch;
+    unsigned threads = 0;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg += 2) {
+        if (arg + 1 == argc) {
+            usage(argv[0]);
+        }
+        uint16_t value = strtoul(argv[arg + 1], nullptr, 0);
+        if (strcmp(argv[arg], "--batch") == 0) {
+            batch = argv[arg + 1];
+        }
+        else if (strcmp(argv[arg], "--threads") == 0) {
+            threads = strtoul(argv[arg + 1], nullptr, 0);
+        }
+        else if (strcmp(argv[arg], "--load") == 0) {
+            load_address = value;
+        }
+        else if (strcmp(argv[arg], "--entry") == 0) {
+            entry_point = value;
+        }
+        else if (strcmp(argv[arg], "--break") == 0) {
+            breakpoints.push_back(value);
+        }
+        else if (strcmp(argv[arg], "--exit") == 0) {
+            exit_address = value;
+        }
+        else if (strcmp(argv[arg], "--clock") == 0) {
+            clock = strtod(argv[arg + 1], nullptr);
+            if (clock <= 0) {
+                usage(argv[0]);
+            }
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    int positional = argc - arg;
+    if (!batch.empty()) {
+        if (positional != 0) {
+            usage(argv[0]);
+        }
+        return run_batch(batch, threads);
+    }
     std::cout << "6502 Emulator" << std::endl;
-    if (argc != 2) {
-        std::cout << "Usage : " << argv[0] << " <path to rom>" << std::endl;
+#if defined(CPU6502_TRACE)
+    if (positional != 1 && positional != 2) {
+        usage(argv[0]);
+    }
+#else
+    if (positional != 1) {
+        usage(argv[0]);
+    }
+#endif
+    RomImage rom(argv[arg], load_address);
+    if (!rom.ok()) {
+        std::cout << "Could not load ROM: " << rom.error() << std::endl;
         exit(1);
     }
-    std::ifstream file(argv[1], std::ios::in | std::ios::binary);
-    if (!file) {
-        std::cout << "Could not open ROM file: " << argv[1] << std::endl;
+    CPU6502 cpu(entry_point.value_or(rom.entry_point(0x400)));
+    auto memory = cpu.memory();
+    // iNES PRG ROM is mapped as ROM, anything else is a program loaded into RAM
+    if (rom.format() == ImageFormat::INES) {
+        rom.map(cpu);
+    }
+    else {
+        rom.copy_to(memory);
+    }
+    for (uint16_t breakpoint : breakpoints) {
+        cpu.set_breakpoint(breakpoint);
+    }
+    if (exit_address && !cpu.set_exit_address(exit_address)) {
+        std::cout << "Exit address is not RAM" << std::endl;
         exit(1);
     }
-    auto memory = std::make_shared<std::array<uint8_t, MEMORY_SIZE>>();
-    file.read(reinterpret_cast<char*>(memory->data()+0xa), MEMORY_SIZE);
-    auto cpu = CPU6502(memory, 0x400);
+#if defined(CPU6502_TRACE)
+    std::unique_ptr<TraceWriter> trace;
+    if (positional == 2) {
+        trace = std::make_unique<TraceWriter>(argv[arg + 1], cpu.variant());
+        if (!trace->ok()) {
+            std::cout << "Could not open trace file: " << argv[arg + 1] << std::endl;
+            exit(1);
+        }
+        cpu.set_trace(trace.get());
+    }
+#endif
+#if defined(CPU6502_PROFILE)
+    auto profiler = std::make_unique<Profiler>();
+    cpu.set_profiler(profiler.get());
+#endif
     dump_memory_page(memory, 0x400);
-    printf("A:%02x X:%02x Y:%02x P:%02x SP:%02x PC:%04x OP:%02x\n", cpu.A(), cpu.X(), cpu.Y(), cpu.P(), cpu.S(), cpu.PC(), (*memory)[cpu.PC()]);
-    auto old_PC = cpu.PC();
-    while(cpu.execute_instruction()) {
-        if (cpu.PC() == old_PC) {
-            printf("A:%02x X:%02x Y:%02x P:%02x SP:%02x PC:%04x OP:%02x rLSR + X :%02x fLSR + X:%02x\n", cpu.A(), cpu.X(), cpu.Y(), cpu.P(), cpu.S(), cpu.PC(), (*memory)[cpu.PC()], (*memory)[0x022d + cpu.X()], (*memory)[0x0245+ cpu.X()]);
-            dump_memory_page(memory, 0x0000);
-            dump_memory_page(memory, 0x0100);
-            break;
-        }
-        // When it comes time we can tweak this so we get a reasonable clock speed
-        // for now it can run arbitrarily fast
-        // std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        old_PC = cpu.PC();
+    printf("A:%02x X:%02x Y:%02x P:%02x SP:%02x PC:%04x OP:%02x\n", cpu.A(), cpu.X(), cpu.Y(), cpu.P(), cpu.S(), cpu.PC(), cpu.bus().peek(cpu.PC()));
+    // Runs as fast as it can unless a clock speed is given
+    std::unique_ptr<Pacer> pacer;
+    RunResult result;
+    if (clock > 0) {
+        pacer = std::make_unique<Pacer>(cpu, clock);
+        result = pacer->run();
+    }
+    else {
+        result = cpu.run(UINT64_MAX);
+    }
+    if (result.reason == StopReason::INVALID_OPCODE) {
+        printf("Invalid Opcode 0x%02x\n", cpu.bus().peek(cpu.PC() - 1));
+    }
+    else if (result.reason == StopReason::TRAP) {
+        printf("A:%02x X:%02x Y:%02x P:%02x SP:%02x PC:%04x OP:%02x\n", cpu.A(), cpu.X(), cpu.Y(), cpu.P(), cpu.S(), cpu.PC(), cpu.bus().peek(cpu.PC()));
+        dump_memory_page(memory, 0x0000);
+        dump_memory_page(memory, 0x0100);
+    }
+    else if (result.reason == StopReason::BREAKPOINT) {
+        printf("Breakpoint at %04x\n", cpu.PC());
+    }
+    else if (result.reason == StopReason::EXIT) {
+        printf("Exited with %02x\n", cpu.bus().peek(*exit_address));
+    }
+    if (pacer) {
+        PacingStats& stats = pacer->stats();
+        printf("Ran at %.6f MHz for a %.6f MHz clock: %" PRIu64 " frames, %" PRIu64 " late, %" PRIu64 " resyncs, "
+               "frames took %.3f ms on average and %.3f ms at most, %.1f%% busy\n",
+            stats.frequency() / 1e6, clock / 1e6, stats.frames, stats.late_frames, stats.resyncs,
+            stats.mean_frame() * 1e3, stats.longest_frame * 1e3, 100 * stats.busy_seconds / stats.seconds);
     }
+#if defined(CPU6502_PROFILE)
+    profiler->report(stderr);
+#endif
     return 0;
 }
@@ -0,0 +1,38 @@
+#include <iostream>
+
+#include <stdio.h>
+
+#include "Trace.h"
+
+// Prints a trace written by TraceWriter, one instruction per line with the
+// registers as they were before it executed
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::cout << "Usage : " << argv[0] << " <path to trace>" << std::endl;
+        exit(1);
+    }
+    TraceReader trace(argv[1]);
+    if (!trace.ok()) {
+        std::cout << "Could not open trace file: " << argv[1] << std::endl;
+        exit(1);
+    }
+    TraceRecord record;
+    while (trace.next(record)) {
+        int length = instruction_length(trace.variant(), record.opcode);
+        printf("%04x  %02x", record.PC, record.opcode);
+        for (int i = 0; i < 2; i++) {
+            if (i + 1 < length) {
+                printf(" %02x", record.operands[i]);
+            }
+            else {
+                printf("   ");
+            }
+        }
+        printf("  A:%02x X:%02x Y:%02x P:%02x SP:%02x", record.A, record.X, record.Y, record.P, record.S);
+        if (record.has_address) {
+            printf(" EA:%04x", record.address);
+        }
+        puts("");
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <array>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <initializer_list>
+
+#include <gtest/gtest.h>
+
+#include "CPU6502.h"
+
+// N and Z are kept as the last result and only folded into P when
+// something reads the flags. These programs read them every way the CPU
+// can straight after a result set them: PHP, BRK and IRQ pushes, and PLP
+// and RTI replacing them.
+
+using Memory = std::array<uint8_t, MEMORY_SIZE>;
+
+class LazyFlags : public testing::TestWithParam<std::tuple<Variant, Dispatch>> {
+    protected:
+        std::unique_ptr<Memory> _memory = std::make_unique<Memory>();
+        std::unique_ptr<CPU6502> _cpu;
+        // Loads program at 0x0400 with IRQ and BRK going to 0x0700
+        CPU6502& load(std::initializer_list<uint8_t> program) {
+            std::copy(program.begin(), program.end(), _memory->begin() + 0x0400);
+            (*_memory)[0xFFFE] = 0x00;
+            (*_memory)[0xFFFF] = 0x07;
+            _cpu = std::make_unique<CPU6502>(*_memory, 0x0400, std::get<0>(GetParam()));
+            return *_cpu;
+        };
+        RunResult run(uint64_t instructions) {
+            return _cpu->run(instructions, UINT64_MAX, std::get<1>(GetParam()));
+        };
+};
+
+static std::string backend_name(const testing::TestParamInfo<LazyFlags::ParamType>& info) {
+    const char* variants[] = {"NMOS", "NMOS_ILLEGAL", "CMOS_65C02"};
+    const char* dispatches[] = {"SWITCH", "TABLE", "THREADED", "JIT", "DECODED"};
+    return std::string(variants[(int) std::get<0>(info.param)]) + "_" + dispatches[(int) std::get<1>(info.param)];
+}
+
+TEST_P(LazyFlags, PHP) {
+    // LDX #$FF, TXS, LDA #$80, PHP, LDA #$00, PHP
+    load({0xA2, 0xFF, 0x9A, 0xA9, 0x80, 0x08, 0xA9, 0x00, 0x08});
+    run(6);
+    EXPECT_EQ(_memory->at(0x01FF), 0xB0);
+    EXPECT_EQ(_memory->at(0x01FE), 0x32);
+}
+
+TEST_P(LazyFlags, BRK) {
+    // LDX #$FF, TXS, LDA #$00, BRK
+    load({0xA2, 0xFF, 0x9A, 0xA9, 0x00, 0x00});
+    run(4);
+    EXPECT_EQ(_cpu->PC(), 0x0700);
+    EXPECT_EQ(_memory->at(0x01FD), 0x32);
+    EXPECT_EQ(_cpu->P() & (N_FLAG | Z_FLAG | I_FLAG), Z_FLAG | I_FLAG);
+}
+
+TEST_P(LazyFlags, IRQ) {
+    // LDX #$FF, TXS, CLI, LDA #$80, NOP
+    load({0xA2, 0xFF, 0x9A, 0x58, 0xA9, 0x80, 0xEA});
+    run(4);
+    _cpu->set_irq(true);
+    run(1);
+    EXPECT_EQ(_cpu->PC(), 0x0700);
+    EXPECT_EQ(_memory->at(0x01FD), 0xA0);
+    EXPECT_EQ(_cpu->P() & (N_FLAG | Z_FLAG | I_FLAG), N_FLAG | I_FLAG);
+}
+
+TEST_P(LazyFlags, PLP) {
+    // LDX #$FF, TXS, LDA #$82, PHA, LDA #$01, PLP, PHP
+    load({0xA2, 0xFF, 0x9A, 0xA9, 0x82, 0x48, 0xA9, 0x01, 0x28, 0x08});
+    run(7);
+    EXPECT_EQ(_cpu->P() & (N_FLAG | Z_FLAG | C_FLAG), N_FLAG | Z_FLAG);
+    EXPECT_EQ(_memory->at(0x01FF), 0xB2);
+}
+
+TEST_P(LazyFlags, RTI) {
+    // LDX #$FF, TXS, LDA #$06, PHA, LDA #$10, PHA, LDA #$82, PHA, LDA #$01, RTI
+    // and PHP at 0x0610
+    load({0xA2, 0xFF, 0x9A, 0xA9, 0x06, 0x48, 0xA9, 0x10, 0x48, 0xA9, 0x82, 0x48, 0xA9, 0x01, 0x40});
+    (*_memory)[0x0610] = 0x08;
+    run(10);
+    EXPECT_EQ(_cpu->PC(), 0x0610);
+    EXPECT_EQ(_cpu->P() & (N_FLAG | Z_FLAG | C_FLAG), N_FLAG | Z_FLAG);
+    run(1);
+    EXPECT_EQ(_memory->at(0x01FF), 0xB2);
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, LazyFlags, testing::Combine(
+    testing::Values(Variant::NMOS, Variant::NMOS_ILLEGAL, Variant::CMOS_65C02),
+    testing::Values(Dispatch::SWITCH, Dispatch::TABLE, Dispatch::THREADED, Dispatch::DECODED, Dispatch::JIT)),
+    backend_name);
@@ -0,0 +1,81 @@
+#include "Lockstep.h"
+#include <cstdio>
+#include <algorithm>
+
+Lockstep::Lockstep(std::span<const uint8_t, MEMORY_SIZE> memory, uint16_t entry_point, Variant variant,
+                   Dispatch reference, Dispatch candidate) :
+    _reference{_reference_memory, entry_point, variant}, _candidate{_candidate_memory, entry_point, variant},
+    _reference_dispatch{reference}, _candidate_dispatch{candidate}
+{
+    std::copy(memory.begin(), memory.end(), _reference_memory.begin());
+    std::copy(memory.begin(), memory.end(), _candidate_memory.begin());
+}
+
+bool Lockstep::run(uint64_t max_instructions, uint64_t max_cycles, bool irq) {
+    if (!_divergence.empty()) {
+        return false;
+    }
+    _reference_start = _reference.snapshot();
+    _candidate_start = _candidate.snapshot();
+    RunResult reference;
+    RunResult candidate;
+    if (replay(max_instructions, max_cycles, irq, reference, candidate)) {
+        _result = reference;
+        return true;
+    }
+    // the first budget they disagree after is the instruction that went
+    // wrong, or the one whose side effects did
+    uint64_t agree = 0;
+    uint64_t disagree = std::min(max_instructions, std::max(reference.instructions, candidate.instructions));
+    if (replay(disagree, max_cycles, irq, reference, candidate)) {
+        agree = disagree;
+        disagree = max_instructions;
+    }
+    while (disagree - agree > 1) {
+        uint64_t middle = agree + (disagree - agree) / 2;
+        (replay(middle, max_cycles, irq, reference, candidate) ? agree : disagree) = middle;
+    }
+    replay(agree, max_cycles, irq, reference, candidate);
+    uint16_t PC = _reference.PC();
+    uint8_t opcode = _reference.bus().peek(PC);
+    replay(disagree, max_cycles, irq, reference, candidate);
+    char where[64];
+    snprintf(where, sizeof(where), "instruction %lu of the slice, %02x at %04x: ", agree + 1, opcode, PC);
+    _divergence = where + describe(reference, candidate);
+    return false;
+}
+
+bool Lockstep::replay(uint64_t max_instructions, uint64_t max_cycles, bool irq, RunResult& reference, RunResult& candidate) {
+    _reference.restore(_reference_start);
+    _candidate.restore(_candidate_start);
+    _reference.set_irq(irq);
+    _candidate.set_irq(irq);
+    reference = _reference.run(max_instructions, max_cycles, _reference_dispatch);
+    candidate = _candidate.run(max_instructions, max_cycles, _candidate_dispatch);
+    return same(reference, candidate);
+}
+
+bool Lockstep::same(const RunResult& reference, const RunResult& candidate) {
+    return reference.reason == candidate.reason && reference.instructions == candidate.instructions
+        && reference.cycles == candidate.cycles && _reference.cycles() == _candidate.cycles()
+        && _reference.A() == _candidate.A() && _reference.X() == _candidate.X() && _reference.Y() == _candidate.Y()
+        && _reference.P() == _candidate.P() && _reference.S() == _candidate.S() && _reference.PC() == _candidate.PC()
+        && _reference_memory == _candidate_memory;
+}
+
+std::string Lockstep::describe(const RunResult& reference, const RunResult& candidate) {
+    char text[256];
+    snprintf(text, sizeof(text),
+        "reason %d/%d instructions %lu/%lu cycles %lu/%lu A %02x/%02x X %02x/%02x Y %02x/%02x P %02x/%02x S %02x/%02x PC %04x/%04x",
+        (int) reference.reason, (int) candidate.reason, reference.instructions, candidate.instructions,
+        _reference.cycles(), _candidate.cycles(), _reference.A(), _candidate.A(), _reference.X(), _candidate.X(),
+        _reference.Y(), _candidate.Y(), _reference.P(), _candidate.P(), _reference.S(), _candidate.S(),
+        _reference.PC(), _candidate.PC());
+    std::string description = text;
+    auto [first, second] = std::mismatch(_reference_memory.begin(), _reference_memory.end(), _candidate_memory.begin());
+    if (first != _reference_memory.end()) {
+        snprintf(text, sizeof(text), " memory [%04lx] %02x/%02x", first - _reference_memory.begin(), *first, *second);
+        description += text;
+    }
+    return description;
+}
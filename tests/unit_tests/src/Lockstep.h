@@ -0,0 +1,45 @@
+#pragma once
+#include <span>
+#include <array>
+#include <string>
+#include <cstdint>
+
+#include "CPU6502.h"
+
+// Runs one machine on two backends side by side, a slice at a time, and
+// compares registers, cycles and all of memory after every slice. When a
+// slice diverges both machines are rolled back to its start and replayed
+// with ever smaller budgets to find the first instruction they disagree
+// after, so a fast backend can be checked at full speed and still have its
+// first mistake pinned down exactly.
+class Lockstep {
+    public:
+        Lockstep(std::span<const uint8_t, MEMORY_SIZE> memory, uint16_t entry_point, Variant variant,
+                 Dispatch reference, Dispatch candidate);
+        Lockstep(const Lockstep&) = delete;
+        Lockstep& operator=(const Lockstep&) = delete;
+        CPU6502& reference() { return _reference; };
+        CPU6502& candidate() { return _candidate; };
+        // Runs both machines with the same budget and IRQ line level. False
+        // once they diverge, divergence() then describes where.
+        bool run(uint64_t max_instructions, uint64_t max_cycles, bool irq = false);
+        const std::string& divergence() { return _divergence; };
+        // What the last slice both agreed on returned
+        const RunResult& result() { return _result; };
+    private:
+        std::array<uint8_t, MEMORY_SIZE> _reference_memory;
+        std::array<uint8_t, MEMORY_SIZE> _candidate_memory;
+        CPU6502 _reference;
+        CPU6502 _candidate;
+        Dispatch _reference_dispatch;
+        Dispatch _candidate_dispatch;
+        std::string _divergence;
+        RunResult _result{};
+        // Snapshots of both machines at the start of the slice
+        Snapshot _reference_start;
+        Snapshot _candidate_start;
+        // Runs both from the start of the slice, true if they still agree
+        bool replay(uint64_t max_instructions, uint64_t max_cycles, bool irq, RunResult& reference, RunResult& candidate);
+        bool same(const RunResult& reference, const RunResult& candidate);
+        std::string describe(const RunResult& reference, const RunResult& candidate);
+};
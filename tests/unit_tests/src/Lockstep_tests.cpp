@@ -0,0 +1,120 @@
+#include <array>
+#include <tuple>
+#include <random>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "CPU6502.h"
+#include "RomImage.h"
+#include "Lockstep.h"
+
+using Memory = std::array<uint8_t, MEMORY_SIZE>;
+
+// Opcodes the variant implements, found by running each one
+static std::vector<uint8_t> valid_opcodes(Variant variant) {
+    std::vector<uint8_t> valid;
+    for (int opcode = 0; opcode < 256; opcode++) {
+        CPU6502 cpu(0x0400, variant);
+        cpu.memory()[0x0400] = opcode;
+        if (cpu.run(1, UINT64_MAX, Dispatch::SWITCH).reason != StopReason::INVALID_OPCODE) {
+            valid.push_back(opcode);
+        }
+    }
+    return valid;
+}
+
+static uint64_t iterations() {
+    const char* value = std::getenv("CPU6502_LOCKSTEP_ITERATIONS");
+    return value != nullptr ? std::strtoull(value, nullptr, 0) : 200;
+}
+
+class Differential : public testing::TestWithParam<std::tuple<Variant, Dispatch>> {};
+
+static std::string backend_name(const testing::TestParamInfo<Differential::ParamType>& info) {
+    const char* variants[] = {"NMOS", "NMOS_ILLEGAL", "CMOS_65C02"};
+    const char* dispatches[] = {"SWITCH", "TABLE", "THREADED", "JIT", "DECODED"};
+    return std::string(variants[(int) std::get<0>(info.param)]) + "_" + dispatches[(int) std::get<1>(info.param)];
+}
+
+// Random memory, mostly valid opcodes so programs run for a while, with a
+// ROM page, random budgets down to a single instruction and the IRQ line
+// moving between slices. Each backend is checked against the switch.
+TEST_P(Differential, AgreesWithSwitch) {
+    auto [variant, dispatch] = GetParam();
+    std::vector<uint8_t> valid = valid_opcodes(variant);
+    std::mt19937_64 random(1);
+    static Memory rom;
+    for (uint64_t iteration = 0; iteration < iterations(); iteration++) {
+        auto memory = std::make_unique<Memory>();
+        uint64_t density = random() % 4;
+        for (auto& byte : *memory) {
+            byte = random() % 4 >= density ? valid[random() % valid.size()] : random();
+        }
+        for (auto& byte : rom) {
+            byte = valid[random() % valid.size()];
+        }
+        auto machines = std::make_unique<Lockstep>(*memory, random(), variant, Dispatch::SWITCH, dispatch);
+        uint8_t rom_page = random();
+        machines->reference().bus().map_rom(rom_page, 1, rom.data());
+        machines->candidate().bus().map_rom(rom_page, 1, rom.data());
+        for (int slice = 0; slice < 20; slice++) {
+            uint64_t max_instructions = random() % 3 == 0 ? random() % 5 : random() % 2000;
+            uint64_t max_cycles = random() % 3 == 0 ? random() % 100 : UINT64_MAX;
+            ASSERT_TRUE(machines->run(max_instructions, max_cycles, random() % 4 == 0))
+                << "iteration " << iteration << " slice " << slice << ": " << machines->divergence();
+            if (machines->reference().PC() == machines->candidate().PC() && random() % 8 == 0) {
+                break;
+            }
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, Differential, testing::Combine(
+    testing::Values(Variant::NMOS, Variant::NMOS_ILLEGAL, Variant::CMOS_65C02),
+    testing::Values(Dispatch::TABLE, Dispatch::THREADED, Dispatch::DECODED, Dispatch::JIT)),
+    backend_name);
+
+// A write the candidate drops, as its page is ROM there, is reported at the
+// store rather than at the end of the slice
+TEST(Lockstep, FindsFirstDivergence) {
+    Memory memory{};
+    uint8_t program[] = {0xEA, 0xEA, 0xA9, 0x01, 0x8D, 0x00, 0x90, 0xEA, 0x4C, 0x07, 0x04};
+    std::copy(std::begin(program), std::end(program), memory.begin() + 0x0400);
+    auto machines = std::make_unique<Lockstep>(memory, 0x0400, Variant::NMOS, Dispatch::SWITCH, Dispatch::SWITCH);
+    machines->candidate().bus().map_rom(0x90, 1, memory.data() + 0x9000);
+    EXPECT_FALSE(machines->run(1000, UINT64_MAX));
+    EXPECT_EQ(machines->divergence().rfind("instruction 4 of the slice, 8d at 0404", 0), 0u) << machines->divergence();
+    EXPECT_NE(machines->divergence().find("memory [9000] 01/00"), std::string::npos) << machines->divergence();
+}
+
+// Runs the image in CPU6502_LOCKSTEP_ROM, loaded like 6502_emulator loads
+// it, on every backend for CPU6502_LOCKSTEP_INSTRUCTIONS (10 million by
+// default) and reports where each first leaves the switch
+TEST(Lockstep, Rom) {
+    const char* path = std::getenv("CPU6502_LOCKSTEP_ROM");
+    if (path == nullptr) {
+        GTEST_SKIP() << "CPU6502_LOCKSTEP_ROM is not set";
+    }
+    const char* budget = std::getenv("CPU6502_LOCKSTEP_INSTRUCTIONS");
+    uint64_t instructions = budget != nullptr ? std::strtoull(budget, nullptr, 0) : 10000000;
+    RomImage rom(path, 0x000a);
+    ASSERT_TRUE(rom.ok()) << rom.error();
+    auto memory = std::make_unique<Memory>();
+    rom.copy_to(*memory);
+    uint16_t entry_point = rom.entry_point(0x0400);
+    if (const char* entry = std::getenv("CPU6502_LOCKSTEP_ENTRY")) {
+        entry_point = std::strtoul(entry, nullptr, 0);
+    }
+    for (Dispatch dispatch : {Dispatch::TABLE, Dispatch::THREADED, Dispatch::DECODED, Dispatch::JIT}) {
+        auto machines = std::make_unique<Lockstep>(*memory, entry_point, Variant::NMOS, Dispatch::SWITCH, dispatch);
+        uint64_t executed = 0;
+        do {
+            ASSERT_TRUE(machines->run(std::min<uint64_t>(instructions - executed, 100000), UINT64_MAX))
+                << "dispatch " << (int) dispatch << " after " << executed << " instructions: " << machines->divergence();
+            executed += machines->result().instructions;
+        } while (executed < instructions && machines->result().reason == StopReason::BUDGET);
+    }
+}
@@ -0,0 +1,151 @@
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "CPU6502.h"
+#include "Rollback.h"
+
+constexpr uint64_t FRAME_CYCLES = 5000;
+
+// Adds the input in 0x00 into a table indexed by X and rolls a second one,
+// so every frame's input shows up in memory and in the registers
+static void load(CPU6502& cpu) {
+    const uint8_t program[] = {0xA5, 0x00, 0x18, 0x7D, 0x00, 0x02, 0x9D, 0x00, 0x02, 0xE8, 0x3E, 0x00, 0x03, 0x4C, 0x00, 0x04};
+    for (size_t i = 0; i < sizeof(program); i++) {
+        cpu.bus().write(0x0400 + i, program[i]);
+    }
+}
+
+static void apply_input(CPU6502& cpu, Rollback::Input input) {
+    cpu.bus().write(0x0000, input);
+}
+
+// The CPU run straight through frames, each given its input and run out to
+// its end cycle as Rollback does
+static std::unique_ptr<CPU6502> straight(const std::vector<Rollback::Input>& inputs) {
+    auto cpu = std::make_unique<CPU6502>(0x0400);
+    cpu->set_trap_self_loops(false);
+    load(*cpu);
+    for (uint64_t frame = 0; frame < inputs.size(); frame++) {
+        apply_input(*cpu, inputs[frame]);
+        cpu->run_cycles((frame + 1) * FRAME_CYCLES - cpu->cycles());
+    }
+    return cpu;
+}
+
+// The inputs the rolled back CPU has run with: the confirmed ones and
+// run_ahead more repeating the last
+static std::vector<Rollback::Input> with_run_ahead(std::vector<Rollback::Input> inputs, unsigned run_ahead) {
+    inputs.insert(inputs.end(), run_ahead, inputs.back());
+    return inputs;
+}
+
+static void expect_same(CPU6502& cpu, CPU6502& expected) {
+    EXPECT_EQ(cpu.cycles(), expected.cycles());
+    EXPECT_EQ(cpu.PC(), expected.PC());
+    EXPECT_EQ(cpu.A(), expected.A());
+    EXPECT_EQ(cpu.X(), expected.X());
+    EXPECT_EQ(cpu.P(), expected.P());
+    EXPECT_TRUE(std::equal(cpu.memory().begin(), cpu.memory().end(), expected.memory().begin()));
+}
+
+TEST(Rollback, MispredictionRerunsFromTheFrame) {
+    CPU6502 cpu(0x0400);
+    load(cpu);
+    Rollback rollback(cpu, FRAME_CYCLES, apply_input, 2);
+    std::vector<Rollback::Input> inputs = {0, 0, 0, 0, 0, 7};
+    for (Rollback::Input input : inputs) {
+        rollback.advance(input);
+    }
+    // three frames for the first advance, one run ahead for each of the
+    // next four, and frames 5 to 7 again once 7 was not the 0 guessed
+    EXPECT_EQ(rollback.stats().mispredictions, 1u);
+    EXPECT_EQ(rollback.stats().frames_run, 10u);
+    EXPECT_EQ(rollback.frame(), 6u);
+    expect_same(cpu, *straight(with_run_ahead(inputs, 2)));
+}
+
+TEST(Rollback, CorrectsUpToDepthFramesBack) {
+    CPU6502 cpu(0x0400);
+    load(cpu);
+    Rollback rollback(cpu, FRAME_CYCLES, apply_input, 1, 4);
+    std::vector<Rollback::Input> inputs(10, 1);
+    for (Rollback::Input input : inputs) {
+        rollback.advance(input);
+    }
+    EXPECT_FALSE(rollback.correct(5, 9));
+    EXPECT_FALSE(rollback.correct(10, 9));
+    ASSERT_TRUE(rollback.correct(6, 9));
+    inputs[6] = 9;
+    EXPECT_EQ(rollback.stats().corrections, 1u);
+    expect_same(cpu, *straight(with_run_ahead(inputs, 1)));
+}
+
+// Far more frames than the ring holds, with mispredictions and corrections
+// landing all over it
+TEST(Rollback, RingWrapsAround) {
+    CPU6502 cpu(0x0400);
+    load(cpu);
+    constexpr unsigned RUN_AHEAD = 2;
+    constexpr unsigned DEPTH = 3;
+    Rollback rollback(cpu, FRAME_CYCLES, apply_input, RUN_AHEAD, DEPTH);
+    std::mt19937 random(5);
+    std::vector<Rollback::Input> inputs;
+    for (int frame = 0; frame < 200; frame++) {
+        inputs.push_back(random() % 3 == 0 ? random() % 256 : inputs.empty() ? 0 : inputs.back());
+        rollback.advance(inputs.back());
+        if (random() % 4 == 0) {
+            uint64_t back = 1 + random() % DEPTH;
+            inputs[inputs.size() - back] ^= 0x55;
+            ASSERT_TRUE(rollback.correct(inputs.size() - back, inputs[inputs.size() - back]));
+        }
+    }
+    EXPECT_GT(rollback.stats().mispredictions, 0u);
+    EXPECT_GT(rollback.stats().corrections, 0u);
+    expect_same(cpu, *straight(with_run_ahead(inputs, RUN_AHEAD)));
+}
+
+// The program idles in a jump to self and each frame's input comes in
+// through an NMI, so frames still have to run out to their end cycle
+TEST(Rollback, IdleLoopRunsOutTheFrame) {
+    CPU6502 cpu(0x0400);
+    // JMP $0400, and an NMI handler adding 0x00 into 0x0200
+    const uint8_t idle[] = {0x4C, 0x00, 0x04};
+    const uint8_t handler[] = {0xA5, 0x00, 0x18, 0x6D, 0x00, 0x02, 0x8D, 0x00, 0x02, 0x40};
+    for (size_t i = 0; i < sizeof(idle); i++) {
+        cpu.bus().write(0x0400 + i, idle[i]);
+    }
+    for (size_t i = 0; i < sizeof(handler); i++) {
+        cpu.bus().write(0x0500 + i, handler[i]);
+    }
+    cpu.bus().write(0xFFFA, 0x00);
+    cpu.bus().write(0xFFFB, 0x05);
+    auto interrupt = [](CPU6502& cpu, Rollback::Input input) {
+        cpu.bus().write(0x0000, input);
+        cpu.set_nmi(false);
+        cpu.set_nmi(true);
+    };
+    constexpr unsigned RUN_AHEAD = 2;
+    uint64_t start = cpu.cycles();
+    Rollback rollback(cpu, FRAME_CYCLES, interrupt, RUN_AHEAD);
+    std::vector<Rollback::Input> inputs = {1, 2, 2, 5, 5, 5, 3};
+    for (size_t frame = 0; frame < inputs.size(); frame++) {
+        RunResult result = rollback.advance(inputs[frame]);
+        EXPECT_EQ(result.reason, StopReason::BUDGET);
+        // frames end on the first instruction boundary at or after their
+        // end cycle, a JMP at most 3 cycles on
+        uint64_t end = start + (frame + 1 + RUN_AHEAD) * FRAME_CYCLES;
+        EXPECT_GE(cpu.cycles(), end);
+        EXPECT_LT(cpu.cycles(), end + 3);
+    }
+    uint8_t sum = 0;
+    for (Rollback::Input input : with_run_ahead(inputs, RUN_AHEAD)) {
+        sum += input;
+    }
+    EXPECT_EQ(cpu.memory()[0x0200], sum);
+    ASSERT_TRUE(rollback.correct(inputs.size() - 2, 9));
+    EXPECT_EQ(cpu.memory()[0x0200], uint8_t(sum - 5 + 9));
+}
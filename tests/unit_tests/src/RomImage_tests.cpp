@@ -0,0 +1,66 @@
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+#include "RomImage.h"
+
+// One Intel HEX record with its checksum
+static std::string record(uint8_t type, uint16_t address, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> bytes = {uint8_t(data.size()), uint8_t(address >> 8), uint8_t(address), type};
+    bytes.insert(bytes.end(), data.begin(), data.end());
+    uint8_t sum = 0;
+    std::string text = ":";
+    char hex[3];
+    for (uint8_t byte : bytes) {
+        sum += byte;
+        snprintf(hex, sizeof(hex), "%02X", byte);
+        text += hex;
+    }
+    snprintf(hex, sizeof(hex), "%02X", uint8_t(-sum));
+    return text + hex + "\n";
+}
+
+static std::string write_hex(const std::string& name, const std::string& records) {
+    std::string path = testing::TempDir() + name;
+    std::ofstream(path) << records << record(0x01, 0, {});
+    return path;
+}
+
+TEST(RomImage, IntelHex) {
+    std::string path = write_hex("image.hex", record(0x00, 0x0400, {0xA9, 0x01}) + record(0x00, 0xFFFC, {0x00, 0x04}));
+    RomImage image(path);
+    ASSERT_TRUE(image.ok()) << image.error();
+    EXPECT_EQ(image.format(), ImageFormat::IHEX);
+    ASSERT_EQ(image.segments().size(), 2u);
+    EXPECT_EQ(image.segments()[0].address, 0x0400);
+    EXPECT_EQ(image.segments()[0].data.size(), 2u);
+    EXPECT_EQ(image.entry_point(0), 0x0400);
+}
+
+TEST(RomImage, IntelHexAbove64KiB) {
+    // an extended linear address that would wrap the address sum back
+    // round into memory, a segment address past 64 KiB, and data running
+    // off the top
+    const std::string records[] = {
+        record(0x04, 0, {0xFF, 0xFF}) + record(0x00, 0xFFFF, {0xEA, 0xEA}),
+        record(0x02, 0, {0x10, 0x00}) + record(0x00, 0x0000, {0xEA}),
+        record(0x00, 0xFFFF, {0xEA, 0xEA}),
+    };
+    for (const std::string& records_text : records) {
+        RomImage image(write_hex("above.hex", records_text));
+        EXPECT_FALSE(image.ok());
+        EXPECT_NE(image.error().find("above 64 KiB"), std::string::npos) << image.error();
+    }
+}
+
+TEST(RomImage, IntelHexShortAddressRecord) {
+    for (uint8_t type : {0x02, 0x04}) {
+        RomImage image(write_hex("short.hex", record(type, 0, {0x00}) + record(0x00, 0x0400, {0xEA})));
+        EXPECT_FALSE(image.ok());
+        EXPECT_NE(image.error().find("bad record on line 1"), std::string::npos) << image.error();
+    }
+}
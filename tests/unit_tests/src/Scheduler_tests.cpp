@@ -0,0 +1,80 @@
+#include <array>
+#include <memory>
+#include <iterator>
+#include <algorithm>
+#include <cstdint>
+
+#include <gtest/gtest.h>
+
+#include "CPU6502.h"
+#include "Scheduler.h"
+
+using Memory = std::array<uint8_t, MEMORY_SIZE>;
+
+constexpr uint64_t SLICE_CYCLES = 100;
+
+class SchedulerTiming : public testing::TestWithParam<Dispatch> {
+    protected:
+        std::unique_ptr<Memory> _memory = std::make_unique<Memory>();
+        // CLI then a jump to self at 0x0400, and an IRQ handler at 0x0700
+        // that is a jump to self too
+        std::unique_ptr<CPU6502> load() {
+            const uint8_t program[] = {0x58, 0x4C, 0x01, 0x04};
+            std::copy(std::begin(program), std::end(program), _memory->begin() + 0x0400);
+            const uint8_t handler[] = {0x4C, 0x00, 0x07};
+            std::copy(std::begin(handler), std::end(handler), _memory->begin() + 0x0700);
+            (*_memory)[0xFFFE] = 0x00;
+            (*_memory)[0xFFFF] = 0x07;
+            return std::make_unique<CPU6502>(*_memory, 0x0400);
+        };
+        // Runs in slices until the handler's jump to self traps with nothing
+        // left scheduled, returning the instructions run
+        uint64_t run_sliced(Scheduler& scheduler, uint64_t slice_cycles) {
+            uint64_t instructions = 0;
+            RunResult result;
+            do {
+                result = scheduler.run(UINT64_MAX, slice_cycles, GetParam());
+                instructions += result.instructions;
+            } while (result.reason == StopReason::BUDGET);
+            EXPECT_EQ(result.reason, StopReason::TRAP);
+            return instructions;
+        };
+};
+
+static std::string dispatch_name(const testing::TestParamInfo<Dispatch>& info) {
+    const char* dispatches[] = {"SWITCH", "TABLE", "THREADED", "JIT", "DECODED"};
+    return dispatches[(int) info.param];
+}
+
+// The IRQ is raised by an event partway through a slice, exactly on the
+// boundary between two and just after one, while the CPU spins. It has to
+// be taken at the first instruction boundary at or after the event however
+// the run is sliced.
+TEST_P(SchedulerTiming, IrqAcrossSliceBoundary) {
+    for (uint64_t offset : {250, 300, 301}) {
+        std::unique_ptr<CPU6502> cpu = load();
+        Scheduler scheduler(*cpu);
+        uint64_t start = cpu->cycles();
+        uint64_t due = start + offset;
+        scheduler.schedule(due, [&cpu] { cpu->set_irq(true); });
+        uint64_t instructions = run_sliced(scheduler, SLICE_CYCLES);
+
+        // CLI takes 2 cycles, then each JMP 3 until the first boundary at or
+        // after due, the IRQ 7, and the handler's JMP runs once before it traps
+        uint64_t spins = (due - (start + 2) + 2) / 3;
+        EXPECT_EQ(cpu->PC(), 0x0700) << offset;
+        EXPECT_EQ(cpu->cycles(), start + 2 + spins * 3 + 7 + 3) << offset;
+        EXPECT_EQ(instructions, 1 + spins + 1) << offset;
+
+        // and the same as running it in one go
+        std::unique_ptr<CPU6502> whole = load();
+        Scheduler unsliced(*whole);
+        unsliced.schedule(due, [&whole] { whole->set_irq(true); });
+        EXPECT_EQ(run_sliced(unsliced, UINT64_MAX), instructions) << offset;
+        EXPECT_EQ(whole->cycles(), cpu->cycles()) << offset;
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, SchedulerTiming,
+    testing::Values(Dispatch::SWITCH, Dispatch::TABLE, Dispatch::THREADED, Dispatch::DECODED, Dispatch::JIT),
+    dispatch_name);
@@ -0,0 +1,369 @@
+#include "SingleStep.h"
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+
+constexpr char STEP_MAGIC[8] = {'6', '5', '0', '2', 'S', 'S', 'T', 1};
+
+// Reading
+
+// Just enough JSON for the vector files, every call skips leading
+// whitespace and returns false on anything unexpected
+class JsonCursor {
+    public:
+        JsonCursor(const std::string& text, size_t& position) : _text{text}, _position{position} {};
+        bool peek(char c) {
+            skip_whitespace();
+            return _position < _text.size() && _text[_position] == c;
+        };
+        bool consume(char c) {
+            if (!peek(c)) {
+                return false;
+            }
+            _position++;
+            return true;
+        };
+        bool string(std::string& value) {
+            if (!consume('"')) {
+                return false;
+            }
+            value.clear();
+            while (_position < _text.size() && _text[_position] != '"') {
+                if (_text[_position] == '\\') {
+                    _position++;
+                }
+                if (_position < _text.size()) {
+                    value += _text[_position++];
+                }
+            }
+            return consume_raw('"');
+        };
+        bool number(int64_t& value) {
+            skip_whitespace();
+            const char* start = _text.c_str() + _position;
+            char* end;
+            value = std::strtoll(start, &end, 10);
+            _position += end - start;
+            return end != start;
+        };
+        // Skips a value of any type, nested or not
+        bool skip() {
+            skip_whitespace();
+            if (_position == _text.size()) {
+                return false;
+            }
+            char c = _text[_position];
+            if (c == '"') {
+                std::string ignored;
+                return string(ignored);
+            }
+            if (c == '[' || c == '{') {
+                char close = c == '[' ? ']' : '}';
+                _position++;
+                if (consume(close)) {
+                    return true;
+                }
+                do {
+                    if (c == '{') {
+                        std::string key;
+                        if (!string(key) || !consume(':')) {
+                            return false;
+                        }
+                    }
+                    if (!skip()) {
+                        return false;
+                    }
+                } while (consume(','));
+                return consume(close);
+            }
+            // numbers, true, false and null
+            size_t start = _position;
+            while (_position < _text.size() && std::strchr(",]} \t\r\n", _text[_position]) == nullptr) {
+                _position++;
+            }
+            return _position != start;
+        };
+        // Calls member(key) for each member of an object
+        template <typename F>
+        bool object(F member) {
+            if (!consume('{')) {
+                return false;
+            }
+            if (consume('}')) {
+                return true;
+            }
+            do {
+                std::string key;
+                if (!string(key) || !consume(':') || !member(key)) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume('}');
+        };
+        // Calls element() for each element of an array
+        template <typename F>
+        bool array(F element) {
+            if (!consume('[')) {
+                return false;
+            }
+            if (consume(']')) {
+                return true;
+            }
+            do {
+                if (!element()) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(']');
+        };
+    private:
+        const std::string& _text;
+        size_t& _position;
+        void skip_whitespace() {
+            while (_position < _text.size() && std::strchr(" \t\r\n", _text[_position]) != nullptr) {
+                _position++;
+            }
+        };
+        bool consume_raw(char c) {
+            if (_position == _text.size() || _text[_position] != c) {
+                return false;
+            }
+            _position++;
+            return true;
+        };
+};
+
+static bool json_state(JsonCursor& json, StepState& state) {
+    state.ram.clear();
+    return json.object([&](const std::string& key) {
+        int64_t value = 0;
+        if (key == "ram") {
+            return json.array([&] {
+                int64_t address;
+                int64_t byte;
+                if (!json.consume('[') || !json.number(address) || !json.consume(',') || !json.number(byte)) {
+                    return false;
+                }
+                state.ram.push_back({static_cast<uint16_t>(address), static_cast<uint8_t>(byte)});
+                return json.consume(']');
+            });
+        }
+        if (key != "pc" && key != "s" && key != "a" && key != "x" && key != "y" && key != "p") {
+            return json.skip();
+        }
+        if (!json.number(value)) {
+            return false;
+        }
+        if (key == "pc") state.PC = value;
+        else if (key == "s") state.S = value;
+        else if (key == "a") state.A = value;
+        else if (key == "x") state.X = value;
+        else if (key == "y") state.Y = value;
+        else state.P = value;
+        return true;
+    });
+}
+
+StepReader::StepReader(const std::string& path) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file) {
+        _error = "could not open " + path;
+        return;
+    }
+    _contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    _binary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+    if (_binary) {
+        if (_contents.size() < sizeof(STEP_MAGIC) || std::memcmp(_contents.data(), STEP_MAGIC, sizeof(STEP_MAGIC)) != 0) {
+            _error = path + ": not a single step vector file";
+        }
+        _position = sizeof(STEP_MAGIC);
+    }
+}
+
+bool StepReader::next(StepVector& vector) {
+    if (!_error.empty()) {
+        return false;
+    }
+    bool read = _binary ? next_binary(vector) : next_json(vector);
+    if (!read && _error.empty() && _position < _contents.size()) {
+        _error = "malformed vector at byte " + std::to_string(_position);
+    }
+    return read;
+}
+
+bool StepReader::next_json(StepVector& vector) {
+    JsonCursor json(_contents, _position);
+    if (!_started) {
+        _started = true;
+        if (!json.consume('[')) {
+            return false;
+        }
+        if (json.consume(']')) {
+            _position = _contents.size();
+            return false;
+        }
+    }
+    else if (!json.consume(',')) {
+        if (json.consume(']')) {
+            _position = _contents.size();
+        }
+        return false;
+    }
+    vector.cycles = 0;
+    vector.name.clear();
+    return json.object([&](const std::string& key) {
+        if (key == "name") {
+            return json.string(vector.name);
+        }
+        if (key == "initial") {
+            return json_state(json, vector.initial);
+        }
+        if (key == "final") {
+            return json_state(json, vector.final);
+        }
+        if (key == "cycles") {
+            return json.array([&] {
+                vector.cycles++;
+                return json.skip();
+            });
+        }
+        return json.skip();
+    });
+}
+
+bool StepReader::next_binary(StepVector& vector) {
+    auto byte = [&] { return static_cast<uint8_t>(_contents[_position++]); };
+    auto word = [&] { uint16_t low = byte(); return static_cast<uint16_t>(low | byte() << 8); };
+    auto available = [&](size_t bytes) { return _contents.size() - _position >= bytes; };
+    auto state = [&](StepState& state) {
+        if (!available(9)) {
+            return false;
+        }
+        state.PC = word();
+        state.S = byte();
+        state.A = byte();
+        state.X = byte();
+        state.Y = byte();
+        state.P = byte();
+        uint16_t count = word();
+        if (!available(count * 3)) {
+            return false;
+        }
+        state.ram.resize(count);
+        for (auto& [address, value] : state.ram) {
+            address = word();
+            value = byte();
+        }
+        return true;
+    };
+    if (!available(2)) {
+        return false;
+    }
+    uint16_t length = word();
+    if (!available(length)) {
+        return false;
+    }
+    vector.name.assign(_contents, _position, length);
+    _position += length;
+    if (!state(vector.initial) || !state(vector.final) || !available(2)) {
+        return false;
+    }
+    vector.cycles = word();
+    return true;
+}
+
+// Writing
+
+StepWriter::StepWriter(const std::string& path) {
+    _file = fopen(path.c_str(), "wb");
+    if (_file != nullptr) {
+        fwrite(STEP_MAGIC, 1, sizeof(STEP_MAGIC), _file);
+    }
+}
+
+StepWriter::~StepWriter() {
+    if (_file != nullptr) {
+        fclose(_file);
+    }
+}
+
+void StepWriter::write(const StepVector& vector) {
+    std::vector<uint8_t> record;
+    auto word = [&](uint16_t value) {
+        record.push_back(value & 0xFF);
+        record.push_back(value >> 8);
+    };
+    auto state = [&](const StepState& state) {
+        word(state.PC);
+        record.insert(record.end(), {state.S, state.A, state.X, state.Y, state.P});
+        word(state.ram.size());
+        for (auto [address, value] : state.ram) {
+            word(address);
+            record.push_back(value);
+        }
+    };
+    word(vector.name.size());
+    record.insert(record.end(), vector.name.begin(), vector.name.end());
+    state(vector.initial);
+    state(vector.final);
+    word(vector.cycles);
+    fwrite(record.data(), 1, record.size(), _file);
+}
+
+// Running
+
+StepOutcome run_step(CPU6502& cpu, const StepVector& vector, Dispatch dispatch, std::string& mismatch) {
+    // through the bus so the pages are marked dirty for snapshot()
+    for (auto [address, value] : vector.initial.ram) {
+        cpu.bus().write(address, value);
+    }
+    Snapshot state = cpu.snapshot();
+    state.PC = vector.initial.PC;
+    state.S = vector.initial.S;
+    state.A = vector.initial.A;
+    state.X = vector.initial.X;
+    state.Y = vector.initial.Y;
+    state.P = vector.initial.P;
+    state.cycles = 0;
+    cpu.restore(state);
+
+    RunResult result = cpu.run(1, UINT64_MAX, dispatch);
+    StepOutcome outcome = StepOutcome::PASS;
+    std::ostringstream report;
+    auto expect = [&](const char* what, uint32_t actual, uint32_t expected) {
+        if (actual != expected) {
+            report << " " << what << " " << std::hex << actual << " expected " << expected << std::dec;
+            outcome = StepOutcome::FAIL;
+        }
+    };
+    if (result.reason == StopReason::INVALID_OPCODE) {
+        outcome = StepOutcome::SKIP;
+    }
+    else {
+        constexpr uint8_t COMPARED_FLAGS = ~(B_FLAG | U_FLAG);
+        expect("PC", cpu.PC(), vector.final.PC);
+        expect("S", cpu.S(), vector.final.S);
+        expect("A", cpu.A(), vector.final.A);
+        expect("X", cpu.X(), vector.final.X);
+        expect("Y", cpu.Y(), vector.final.Y);
+        expect("P", cpu.P() & COMPARED_FLAGS, vector.final.P & COMPARED_FLAGS);
+        expect("cycles", cpu.cycles(), vector.cycles);
+        for (auto [address, value] : vector.final.ram) {
+            if (cpu.bus().peek(address) != value) {
+                report << " [" << std::hex << address << "] " << (int) cpu.bus().peek(address)
+                       << " expected " << (int) value << std::dec;
+                outcome = StepOutcome::FAIL;
+            }
+        }
+    }
+    mismatch = vector.name + ":" + report.str();
+
+    for (auto [address, value] : vector.initial.ram) {
+        cpu.bus().write(address, 0);
+    }
+    for (auto [address, value] : vector.final.ram) {
+        cpu.bus().write(address, 0);
+    }
+    return outcome;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <utility>
+
+#include "CPU6502.h"
+
+// Registers and the memory a single step vector touches
+struct StepState {
+    uint16_t PC;
+    uint8_t S;
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P;
+    std::vector<std::pair<uint16_t, uint8_t>> ram;
+};
+
+// One instruction run from initial, which must leave the machine in final
+// after taking one cycle per bus access
+struct StepVector {
+    std::string name;
+    StepState initial;
+    StepState final;
+    uint32_t cycles;
+};
+
+// Reads single step vectors one at a time, so a file is never held parsed
+// in memory as a whole.
+//
+// JSON files are an array of objects laid out as in the ProcessorTests
+// corpus: "name", "initial" and "final" states holding "pc", "s", "a",
+// "x", "y", "p" and "ram" as [address, value] pairs, and "cycles" with one
+// [address, value, kind] entry per bus cycle, of which only the count is
+// checked. Anything else in them is skipped.
+//
+// Binary files, picked by a .bin extension, are the magic "6502SST" and a
+// version byte followed by one record per vector: the name as a 16 bit
+// length and its bytes, then the initial and final states each as PC (2
+// bytes), S, A, X, Y and P, a 16 bit count of RAM entries and 3 bytes per
+// entry (address then value), and last the 16 bit cycle count. Multi-byte
+// fields are little endian.
+class StepReader {
+    public:
+        StepReader(const std::string& path);
+        bool ok() { return _error.empty(); };
+        const std::string& error() { return _error; };
+        // The next vector, false at the end of the file or on an error
+        bool next(StepVector& vector);
+    private:
+        std::string _error;
+        std::string _contents;
+        size_t _position = 0;
+        bool _binary;
+        bool _started = false;
+        bool next_json(StepVector& vector);
+        bool next_binary(StepVector& vector);
+};
+
+// Writes vectors in the binary format
+class StepWriter {
+    public:
+        StepWriter(const std::string& path);
+        StepWriter(const StepWriter&) = delete;
+        StepWriter& operator=(const StepWriter&) = delete;
+        ~StepWriter();
+        bool ok() { return _file != nullptr; };
+        void write(const StepVector& vector);
+    private:
+        FILE* _file;
+};
+
+enum class StepOutcome {
+    PASS,
+    FAIL,
+    SKIP, // the opcode is invalid for the CPU's variant
+};
+
+// Loads the initial state into cpu, runs one instruction on the backend and
+// checks the registers, memory and cycles against the final state. The
+// memory the vector touched is zeroed again afterwards so the CPU can be
+// reused for the next one. B and the unused bit are not compared in P, they
+// only exist on the stack. mismatch says what differed on a FAIL.
+StepOutcome run_step(CPU6502& cpu, const StepVector& vector, Dispatch dispatch, std::string& mismatch);
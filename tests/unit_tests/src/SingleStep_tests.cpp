@@ -0,0 +1,193 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+
+#include <gtest/gtest.h>
+
+#include "CPU6502.h"
+#include "SingleStep.h"
+
+// A few vectors in the corpus' JSON layout: LDA #$80, decimal ADC and the
+// NMOS JMP ($xxFF) page wrap, followed by an opcode NMOS leaves invalid
+const char* SAMPLE_VECTORS = R"([
+    {"name": "a9 80", "initial": {"pc": 1024, "s": 253, "a": 0, "x": 0, "y": 0, "p": 32, "ram": [[1024, 169], [1025, 128]]},
+     "final": {"pc": 1026, "s": 253, "a": 128, "x": 0, "y": 0, "p": 160, "ram": [[1024, 169], [1025, 128]]},
+     "cycles": [[1024, 169, "read"], [1025, 128, "read"]]},
+    {"name": "69 19", "initial": {"pc": 512, "s": 255, "a": 40, "x": 1, "y": 2, "p": 41, "ram": [[512, 105], [513, 25]]},
+     "final": {"pc": 514, "s": 255, "a": 72, "x": 1, "y": 2, "p": 40, "ram": [[512, 105], [513, 25]]},
+     "cycles": [[512, 105, "read"], [513, 25, "read"]]},
+    {"name": "6c ff 30", "initial": {"pc": 768, "s": 255, "a": 0, "x": 0, "y": 0, "p": 36,
+                                     "ram": [[768, 108], [769, 255], [770, 48], [12543, 52], [12288, 18], [12544, 86]]},
+     "final": {"pc": 4660, "s": 255, "a": 0, "x": 0, "y": 0, "p": 36,
+               "ram": [[768, 108], [769, 255], [770, 48], [12543, 52], [12288, 18], [12544, 86]]},
+     "cycles": [[768, 108, "read"], [769, 255, "read"], [770, 48, "read"], [12543, 52, "read"], [12288, 18, "read"]]},
+    {"name": "02", "initial": {"pc": 0, "s": 0, "a": 0, "x": 0, "y": 0, "p": 0, "ram": [[0, 2]]},
+     "final": {"pc": 1, "s": 0, "a": 0, "x": 0, "y": 0, "p": 0, "ram": [[0, 2]]}, "cycles": []}
+])";
+
+// Vectors on the edges the NMOS gets right and easy emulation gets wrong:
+// (zp,X) and (zp),Y pointers at 0xFF take their high byte from 0x00, not
+// 0x100, and JSR pushes its return address less one with the borrow
+const char* EDGE_VECTORS = R"([
+    {"name": "a1 ef", "initial": {"pc": 1024, "s": 253, "a": 0, "x": 16, "y": 0, "p": 36,
+                                  "ram": [[1024, 161], [1025, 239], [255, 52], [0, 18], [256, 86], [4660, 119], [22068, 153]]},
+     "final": {"pc": 1026, "s": 253, "a": 119, "x": 16, "y": 0, "p": 36,
+               "ram": [[1024, 161], [1025, 239], [255, 52], [0, 18], [256, 86], [4660, 119], [22068, 153]]},
+     "cycles": [[1024, 161, "read"], [1025, 239, "read"], [239, 0, "read"], [255, 52, "read"], [0, 18, "read"], [4660, 119, "read"]]},
+    {"name": "b1 ff", "initial": {"pc": 1024, "s": 253, "a": 0, "x": 0, "y": 1, "p": 36,
+                                  "ram": [[1024, 177], [1025, 255], [255, 52], [0, 18], [256, 86], [4661, 136], [22069, 153]]},
+     "final": {"pc": 1026, "s": 253, "a": 136, "x": 0, "y": 1, "p": 164,
+               "ram": [[1024, 177], [1025, 255], [255, 52], [0, 18], [256, 86], [4661, 136], [22069, 153]]},
+     "cycles": [[1024, 177, "read"], [1025, 255, "read"], [255, 52, "read"], [0, 18, "read"], [4661, 136, "read"]]},
+    {"name": "20 00 30", "initial": {"pc": 1277, "s": 253, "a": 0, "x": 0, "y": 0, "p": 36,
+                                     "ram": [[1277, 32], [1278, 0], [1279, 48]]},
+     "final": {"pc": 12288, "s": 251, "a": 0, "x": 0, "y": 0, "p": 36,
+               "ram": [[1277, 32], [1278, 0], [1279, 48], [509, 4], [508, 255]]},
+     "cycles": [[1277, 32, "read"], [1278, 0, "read"], [509, 0, "read"], [509, 4, "write"], [508, 255, "write"], [1279, 48, "read"]]}
+])";
+
+static std::string write_vectors(const std::string& name, const char* vectors) {
+    std::string path = testing::TempDir() + name;
+    std::ofstream(path) << vectors;
+    return path;
+}
+
+static std::string write_sample() {
+    return write_vectors("sample_vectors.json", SAMPLE_VECTORS);
+}
+
+static std::vector<StepOutcome> run_file(const std::string& path, Dispatch dispatch, Variant variant = Variant::NMOS) {
+    StepReader reader(path);
+    EXPECT_TRUE(reader.ok()) << reader.error();
+    CPU6502 cpu(0x0000, variant);
+    std::vector<StepOutcome> outcomes;
+    StepVector vector;
+    std::string mismatch;
+    while (reader.next(vector)) {
+        outcomes.push_back(run_step(cpu, vector, dispatch, mismatch));
+        EXPECT_NE(outcomes.back(), StepOutcome::FAIL) << mismatch;
+    }
+    EXPECT_TRUE(reader.ok()) << reader.error();
+    return outcomes;
+}
+
+TEST(SingleStep, RunsJsonVectors) {
+    std::vector<StepOutcome> expected = {StepOutcome::PASS, StepOutcome::PASS, StepOutcome::PASS, StepOutcome::SKIP};
+    for (Dispatch dispatch : {Dispatch::SWITCH, Dispatch::TABLE, Dispatch::THREADED, Dispatch::DECODED, Dispatch::JIT}) {
+        EXPECT_EQ(run_file(write_sample(), dispatch), expected);
+    }
+}
+
+TEST(SingleStep, PointerAndReturnAddressEdges) {
+    std::vector<StepOutcome> expected(3, StepOutcome::PASS);
+    for (Variant variant : {Variant::NMOS, Variant::NMOS_ILLEGAL, Variant::CMOS_65C02}) {
+        for (Dispatch dispatch : {Dispatch::SWITCH, Dispatch::TABLE, Dispatch::THREADED, Dispatch::DECODED, Dispatch::JIT}) {
+            EXPECT_EQ(run_file(write_vectors("edge_vectors.json", EDGE_VECTORS), dispatch, variant), expected);
+        }
+    }
+}
+
+TEST(SingleStep, BinaryMatchesJson) {
+    std::string binary = testing::TempDir() + "sample_vectors.bin";
+    {
+        StepReader reader(write_sample());
+        StepWriter writer(binary);
+        ASSERT_TRUE(writer.ok());
+        StepVector vector;
+        while (reader.next(vector)) {
+            writer.write(vector);
+        }
+    }
+    EXPECT_EQ(run_file(binary, Dispatch::SWITCH), run_file(write_sample(), Dispatch::SWITCH));
+}
+
+TEST(SingleStep, ReportsMismatches) {
+    StepReader reader(write_sample());
+    StepVector vector;
+    ASSERT_TRUE(reader.next(vector));
+    vector.final.A = 0x7F;
+    vector.cycles = 3;
+    CPU6502 cpu(0x0000);
+    std::string mismatch;
+    EXPECT_EQ(run_step(cpu, vector, Dispatch::SWITCH, mismatch), StepOutcome::FAIL);
+    EXPECT_NE(mismatch.find("A 80 expected 7f"), std::string::npos) << mismatch;
+    EXPECT_NE(mismatch.find("cycles 2 expected 3"), std::string::npos) << mismatch;
+}
+
+// The full corpus, one .json or .bin file per opcode in the directory named
+// by CPU6502_STEP_TESTS, checked on every hardware thread. The variant comes
+// from CPU6502_STEP_VARIANT (nmos, nmos_illegal or cmos, nmos_illegal by
+// default) and opcodes it leaves invalid are skipped.
+TEST(SingleStep, Corpus) {
+    const char* directory = std::getenv("CPU6502_STEP_TESTS");
+    if (directory == nullptr) {
+        GTEST_SKIP() << "CPU6502_STEP_TESTS is not set";
+    }
+    Variant variant = Variant::NMOS_ILLEGAL;
+    if (const char* name = std::getenv("CPU6502_STEP_VARIANT")) {
+        variant = std::string(name) == "nmos" ? Variant::NMOS : std::string(name) == "cmos" ? Variant::CMOS_65C02 : variant;
+    }
+    std::vector<std::string> files;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        std::string extension = entry.path().extension().string();
+        if (extension == ".json" || extension == ".bin") {
+            files.push_back(entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    ASSERT_FALSE(files.empty()) << "no vectors in " << directory;
+
+    struct FileResult {
+        uint64_t passed = 0;
+        uint64_t failed = 0;
+        uint64_t skipped = 0;
+        std::string error;
+        std::vector<std::string> mismatches; // the first few
+    };
+    std::vector<FileResult> results(files.size());
+    std::atomic<size_t> next_file = 0;
+    auto worker = [&] {
+        CPU6502 cpu(0x0000, variant);
+        StepVector vector;
+        std::string mismatch;
+        for (size_t index = next_file++; index < files.size(); index = next_file++) {
+            FileResult& result = results[index];
+            StepReader reader(files[index]);
+            while (reader.next(vector)) {
+                switch (run_step(cpu, vector, Dispatch::SWITCH, mismatch)) {
+                    case StepOutcome::PASS: result.passed++; break;
+                    case StepOutcome::SKIP: result.skipped++; break;
+                    case StepOutcome::FAIL:
+                        result.failed++;
+                        if (result.mismatches.size() < 3) {
+                            result.mismatches.push_back(mismatch);
+                        }
+                        break;
+                }
+            }
+            result.error = reader.error();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); i++) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    uint64_t passed = 0;
+    uint64_t skipped = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        passed += results[i].passed;
+        skipped += results[i].skipped;
+        EXPECT_TRUE(results[i].error.empty()) << results[i].error;
+        EXPECT_EQ(results[i].failed, 0u) << files[i] << ": " << results[i].failed << " failed, first "
+            << testing::PrintToString(results[i].mismatches);
+    }
+    std::cout << passed << " vectors passed, " << skipped << " skipped" << std::endl;
+}
@@ -0,0 +1,65 @@
+#include <array>
+#include <memory>
+#include <cstdint>
+
+#include <gtest/gtest.h>
+
+#include "CPU6502.h"
+
+// Snapshots hold the CPU's RAM as the bus maps it. The RAM underneath pages
+// mapped to ROM or I/O is not part of the machine's state, so it is neither
+// saved nor written back over.
+
+using Memory = std::array<uint8_t, MEMORY_SIZE>;
+
+TEST(Snapshot, SkipsPagesNotMappedToRam) {
+    auto memory = std::make_unique<Memory>();
+    CPU6502 cpu(*memory, 0x0400);
+    Page rom{};
+    rom[0] = 0xEA;
+    cpu.bus().map_rom(0x80, 1, rom.data());
+    cpu.bus().map_io(0x90, 1, {[](uint16_t) { return uint8_t(0x55); }, [](uint16_t, uint8_t) {}});
+    (*memory)[0x8000] = 1;
+    (*memory)[0x9000] = 1;
+    cpu.bus().write(0x0200, 1);
+
+    Snapshot snapshot = cpu.snapshot();
+    EXPECT_EQ(snapshot.pages[0x80], nullptr);
+    EXPECT_EQ(snapshot.pages[0x90], nullptr);
+    ASSERT_NE(snapshot.pages[0x02], nullptr);
+
+    (*memory)[0x8000] = 2;
+    (*memory)[0x9000] = 2;
+    cpu.bus().write(0x0200, 2);
+    cpu.restore(snapshot);
+    EXPECT_EQ(memory->at(0x0200), 1);
+    EXPECT_EQ(memory->at(0x8000), 2);
+    EXPECT_EQ(memory->at(0x9000), 2);
+    EXPECT_EQ(cpu.bus().read(0x8000), 0xEA);
+
+    // once mapped back to RAM the page is saved, and restoring the older
+    // snapshot leaves it alone
+    cpu.bus().map_ram(0x80, 1, memory->data() + 0x8000);
+    Snapshot mapped = cpu.snapshot();
+    ASSERT_NE(mapped.pages[0x80], nullptr);
+    EXPECT_EQ(mapped.pages[0x80]->at(0), 2);
+    cpu.bus().write(0x8000, 3);
+    cpu.restore(snapshot);
+    EXPECT_EQ(memory->at(0x8000), 3);
+    cpu.restore(mapped);
+    EXPECT_EQ(memory->at(0x8000), 2);
+}
+
+// Watched and trapped pages are still RAM, only their writes go the slow way
+TEST(Snapshot, KeepsTrappedPages) {
+    CPU6502 cpu(0x0400);
+    unsigned trapped = 0;
+    ASSERT_TRUE(cpu.bus().trap_write(0x0310, [&trapped](uint8_t) { trapped++; }));
+    cpu.bus().write(0x0300, 1);
+    Snapshot snapshot = cpu.snapshot();
+    ASSERT_NE(snapshot.pages[0x03], nullptr);
+    cpu.bus().write(0x0300, 2);
+    cpu.restore(snapshot);
+    EXPECT_EQ(cpu.bus().read(0x0300), 1);
+    EXPECT_EQ(trapped, 0u);
+}
@@ -0,0 +1,94 @@
+#include <array>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <initializer_list>
+
+#include <gtest/gtest.h>
+
+#include "CPU6502.h"
+
+// Several users each keep the store generations they last read and find
+// the pages written since from them: batch mode's delta dumps, snapshots,
+// and anything else. One reading them must not hide writes from another.
+
+using Memory = std::array<uint8_t, MEMORY_SIZE>;
+
+class StoreGenerations : public testing::TestWithParam<Dispatch> {
+    protected:
+        std::unique_ptr<Memory> _memory = std::make_unique<Memory>();
+        std::unique_ptr<CPU6502> _cpu;
+        // Loads program at 0x0400, it should end in a jump to itself
+        CPU6502& load(std::initializer_list<uint8_t> program) {
+            std::copy(program.begin(), program.end(), _memory->begin() + 0x0400);
+            _cpu = std::make_unique<CPU6502>(*_memory, 0x0400);
+            return *_cpu;
+        };
+        RunResult run() {
+            return _cpu->run(1000, UINT64_MAX, GetParam());
+        };
+};
+
+static std::string dispatch_name(const testing::TestParamInfo<Dispatch>& info) {
+    const char* dispatches[] = {"SWITCH", "TABLE", "THREADED", "JIT", "DECODED"};
+    return dispatches[(int) info.param];
+}
+
+// LDA #$AB, STA $0210, STA $0520, JMP $0408
+constexpr std::initializer_list<uint8_t> STORES = {0xA9, 0xAB, 0x8D, 0x10, 0x02, 0x8D, 0x20, 0x05, 0x4C, 0x08, 0x04};
+
+TEST_P(StoreGenerations, DeltaHoldsThePagesWritten) {
+    CPU6502& cpu = load(STORES);
+    std::array<uint32_t, PAGE_COUNT> loaded = cpu.bus().store_generations();
+    // another user reading them in between changes nothing for this one
+    std::array<uint32_t, PAGE_COUNT> other = cpu.bus().store_generations();
+    EXPECT_EQ(run().reason, StopReason::TRAP);
+    cpu.bus().store_generations();
+
+    std::vector<uint8_t> expected;
+    for (uint8_t page : {0x02, 0x05}) {
+        expected.push_back(page);
+        expected.insert(expected.end(), _memory->begin() + page * PAGE_SIZE, _memory->begin() + (page + 1) * PAGE_SIZE);
+    }
+    std::vector<uint8_t> delta = cpu.bus().delta(loaded);
+    EXPECT_EQ(delta, expected);
+    EXPECT_EQ(delta[1 + 0x10], 0xAB);
+    EXPECT_EQ(cpu.bus().delta(other), expected);
+    EXPECT_TRUE(cpu.bus().delta(cpu.bus().store_generations()).empty());
+}
+
+TEST_P(StoreGenerations, RestoreAfterAnotherReader) {
+    CPU6502& cpu = load(STORES);
+    Snapshot before = cpu.snapshot();
+    std::array<uint32_t, PAGE_COUNT> other = cpu.bus().store_generations();
+    run();
+    // the writes are folded in here, before the snapshot looks for them
+    other = cpu.bus().store_generations();
+    Snapshot after = cpu.snapshot();
+
+    cpu.restore(before);
+    EXPECT_EQ(_memory->at(0x0210), 0x00);
+    EXPECT_EQ(_memory->at(0x0520), 0x00);
+    EXPECT_EQ(cpu.PC(), 0x0400);
+    // restoring writes the pages back, which the other user sees
+    EXPECT_EQ(cpu.bus().delta(other).size(), 2u * (1 + PAGE_SIZE));
+
+    cpu.bus().store_generations();
+    cpu.restore(after);
+    EXPECT_EQ(_memory->at(0x0210), 0xAB);
+    EXPECT_EQ(_memory->at(0x0520), 0xAB);
+    EXPECT_EQ(cpu.PC(), 0x0408);
+
+    // and running again from the restored state writes the same memory
+    cpu.restore(before);
+    other = cpu.bus().store_generations();
+    run();
+    EXPECT_EQ(_memory->at(0x0210), 0xAB);
+    EXPECT_EQ(_memory->at(0x0520), 0xAB);
+    EXPECT_EQ(cpu.bus().delta(other).size(), 2u * (1 + PAGE_SIZE));
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, StoreGenerations,
+    testing::Values(Dispatch::SWITCH, Dispatch::TABLE, Dispatch::THREADED, Dispatch::DECODED, Dispatch::JIT),
+    dispatch_name);
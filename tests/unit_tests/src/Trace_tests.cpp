@@ -0,0 +1,91 @@
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+#include <gtest/gtest.h>
+
+#include "CPU6502.h"
+#include "Trace.h"
+
+// 65C02 code whose lengths differ from the NMOS opcodes in the same places:
+// (zp) and immediate NOPs take an operand, the x3 and xB NOPs do not
+static std::vector<TraceRecord> cmos_records() {
+    struct Instruction {
+        uint8_t opcode;
+        uint8_t operand;
+        uint8_t length;
+        bool has_address;
+    };
+    const Instruction program[] = {
+        {0xB2, 0x10, 2, true},  // LDA ($10)
+        {0x02, 0x44, 2, false}, // NOP #$44
+        {0x03, 0x00, 1, false}, // NOP
+        {0x0B, 0x00, 1, false}, // NOP
+        {0x92, 0x20, 2, true},  // STA ($20)
+        {0xEA, 0x00, 1, false}, // NOP
+    };
+    std::vector<TraceRecord> records;
+    uint16_t PC = 0x0400;
+    for (const Instruction& instruction : program) {
+        TraceRecord record{};
+        record.PC = PC;
+        record.opcode = instruction.opcode;
+        record.operands[0] = instruction.operand;
+        record.has_address = instruction.has_address;
+        record.address = instruction.has_address ? 0x0300 : 0;
+        record.S = 0xFD;
+        record.P = 0x24;
+        records.push_back(record);
+        PC += instruction.length;
+    }
+    return records;
+}
+
+TEST(Trace, InstructionLengths) {
+    for (uint8_t opcode : {0x12, 0x32, 0x52, 0x72, 0x92, 0xB2, 0xD2, 0xF2, 0x02, 0x22, 0x42, 0x62}) {
+        EXPECT_EQ(instruction_length(Variant::CMOS_65C02, opcode), 2) << int(opcode);
+    }
+    for (uint8_t opcode : {0x03, 0x13, 0x23, 0x0B, 0x1B, 0xFB}) {
+        EXPECT_EQ(instruction_length(Variant::CMOS_65C02, opcode), 1) << int(opcode);
+    }
+    EXPECT_EQ(instruction_length(Variant::NMOS_ILLEGAL, 0x03), 2);
+    EXPECT_EQ(instruction_length(Variant::NMOS, 0xB2), 1);
+}
+
+// Sequential PCs are left out and only the operand bytes each opcode has
+// are written, so the file is exactly as long as the 65C02 lengths say
+TEST(Trace, CmosRoundTrip) {
+    std::string path = testing::TempDir() + "cmos.trace";
+    std::vector<TraceRecord> records = cmos_records();
+    {
+        TraceWriter writer(path, Variant::CMOS_65C02, 4, 2);
+        ASSERT_TRUE(writer.ok());
+        for (const TraceRecord& record : records) {
+            *writer.next() = record;
+        }
+    }
+    // magic and variant, then flags, the first record's PC and registers,
+    // addresses, opcodes and operands
+    size_t expected_size = 8 + 1 + 2 + 5;
+    for (const TraceRecord& record : records) {
+        expected_size += 1 + (record.has_address ? 2 : 0) + instruction_length(Variant::CMOS_65C02, record.opcode);
+    }
+    EXPECT_EQ(std::filesystem::file_size(path), expected_size);
+
+    TraceReader reader(path);
+    ASSERT_TRUE(reader.ok());
+    EXPECT_EQ(reader.variant(), Variant::CMOS_65C02);
+    TraceRecord record;
+    for (const TraceRecord& expected : records) {
+        ASSERT_TRUE(reader.next(record));
+        EXPECT_EQ(record.PC, expected.PC);
+        EXPECT_EQ(record.opcode, expected.opcode);
+        EXPECT_EQ(record.operands[0], expected.operands[0]);
+        EXPECT_EQ(record.operands[1], expected.operands[1]);
+        EXPECT_EQ(record.has_address, expected.has_address);
+        EXPECT_EQ(record.address, expected.address);
+        EXPECT_EQ(record.S, expected.S);
+        EXPECT_EQ(record.P, expected.P);
+    }
+    EXPECT_FALSE(reader.next(record));
+}
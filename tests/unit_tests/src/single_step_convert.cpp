@@ -0,0 +1,28 @@
+#include <iostream>
+
+#include "SingleStep.h"
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cout << "Usage : " << argv[0] << " <vectors.json> <vectors.bin>" << std::endl;
+        return 1;
+    }
+    StepReader reader(argv[1]);
+    StepWriter writer(argv[2]);
+    if (!writer.ok()) {
+        std::cout << "Could not open output file: " << argv[2] << std::endl;
+        return 1;
+    }
+    StepVector vector;
+    uint64_t count = 0;
+    while (reader.next(vector)) {
+        writer.write(vector);
+        count++;
+    }
+    if (!reader.ok()) {
+        std::cout << reader.error() << std::endl;
+        return 1;
+    }
+    std::cout << count << " vectors" << std::endl;
+    return 0;
+}